@@ -11,9 +11,9 @@ echo "initpackage reltrans lmodel_reltrans.dat `pwd` \nexit" | xspec
 #sed -i '' 's/HD_SHLIB_LIBS           =/HD_SHLIB_LIBS = ${optimization} ${libs}/g' Makefile
 
 #For Linux OS (it needs to be tested!!)
-sed -i  '1s/^/libs = -L fftw\/fftw_comp\/lib\/ -lfftw3 -lm \n/' Makefile
+sed -i  '1s/^/libs = -L fftw\/fftw_comp\/lib\/ -lfftw3 -lm -fopenmp \n/' Makefile
 sed -i  '1s/^/incs = -I fftw\/fftw_comp\/include\/ \n/' Makefile
-sed -i  '1s/^/optimization = -O3 \n/' Makefile
+sed -i  '1s/^/optimization = -O3 -fopenmp \n/' Makefile
 sed -i  's/HD_FFLAGS		=/HD_FFLAGS = ${optimization} ${incs}/g' Makefile
 sed -i  's/HD_SHLIB_LIBS           =/HD_SHLIB_LIBS = ${optimization} ${libs}/g' Makefile
 
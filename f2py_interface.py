@@ -68,12 +68,46 @@ wsim_relt = lib.simrelt_
 wsim_dist.argtypes = [type_float_p, type_int_p, type_float_p, type_int_p, type_float_p]
 wsim_dist.restype  = None
 
-def gen_wrap(ear, params, func):
+wbatch = lib.tdbatch_
+wbatch.argtypes = [type_int_p, type_float_p, type_int_p, type_float_p, type_int_p, type_int_p, type_int_p, type_float_p]
+wbatch.restype  = None
+
+wjac = lib.tdfdjac_
+wjac.argtypes = [type_int_p, type_float_p, type_int_p, type_float_p, type_int_p, type_int_p, type_int_p, type_int_p,
+                 type_float_p, type_float_p]
+wjac.restype  = None
+
+wsetctx = lib.tdsetctx_
+wsetctx.argtypes = [type_int_p]
+wsetctx.restype  = None
+
+wemutol = lib.setemutol_
+wemutol.argtypes = [type_double_p]
+wemutol.restype  = None
+
+# model numbers of tdbatch
+batch_models = {'reltransDCp': 1, 'reltransPL': 2, 'reltransx': 3, 'reltransDbl': 4, 'rtdist': 5, 'rtdistX': 6}
+
+# emulator tolerance set by set_emulator_tolerance (< 0: RELTRANS_EMU_TOL),
+# restored after a call made with its own emu_tol
+emu_tol_default = -1.0
+
+def emu_tol_call(emu_tol, call, *args):
+    if emu_tol is None:
+        return call(*args)
+    wemutol(ct.byref(ct.c_double(emu_tol)))
+    try:
+        return call(*args)
+    finally:
+        wemutol(ct.byref(ct.c_double(emu_tol_default)))
+
+def gen_wrap(ear, params, func, emu_tol = None):
     '''
     Takes:
 
-    ear   : numpy array of energies
-    params: array of parameters (double)
+    ear    : numpy array of energies
+    params : array of parameters (double)
+    emu_tol: emulator tolerance for this call only (see set_emulator_tolerance)
 
     Returns:
 
@@ -90,32 +124,134 @@ def gen_wrap(ear, params, func):
 
     photar = np.zeros(ne, dtype = np.float32)
 
-    func(ear.ctypes.data_as(type_float_p),
-               ct.byref(ct.c_int(ne)),
-               params.ctypes.data_as(type_float_p),
-               ct.byref(ct.c_int(1)),
-               photar.ctypes.data_as(type_float_p))
+    emu_tol_call(emu_tol, func,
+                 ear.ctypes.data_as(type_float_p),
+                 ct.byref(ct.c_int(ne)),
+                 params.ctypes.data_as(type_float_p),
+                 ct.byref(ct.c_int(1)),
+                 photar.ctypes.data_as(type_float_p))
 
     return photar
 
 # def reltrans(ear, params):
 #     return gen_wrap(ear, params, w)
 
-def reltransPL(ear, params):
-    return gen_wrap(ear, params, wPL)
+def reltransPL(ear, params, emu_tol = None):
+    return gen_wrap(ear, params, wPL, emu_tol)
 
-def reltransDCp(ear, params):
-    return gen_wrap(ear, params, wDCp)
+def reltransDCp(ear, params, emu_tol = None):
+    return gen_wrap(ear, params, wDCp, emu_tol)
 
-def reltransDbl(ear, params):
-    return gen_wrap(ear, params,wDbl)
+def reltransDbl(ear, params, emu_tol = None):
+    return gen_wrap(ear, params,wDbl, emu_tol)
 
-def reltransx(ear, params):
-    return gen_wrap(ear, params, wx)
+def reltransx(ear, params, emu_tol = None):
+    return gen_wrap(ear, params, wx, emu_tol)
 
-def rtdist(ear, params):
-    return gen_wrap(ear, params, wdist)
+def rtdist(ear, params, emu_tol = None):
+    return gen_wrap(ear, params, wdist, emu_tol)
 
 def simrtdist(ear, params):
     return gen_wrap(ear, params, wsim_dist)
 
+def batch_wrap(ear, params, model, emu_tol = None):
+    '''
+    Takes:
+
+    ear    : numpy array of energies
+    params : K x npar array of parameters, one vector per row
+    model  : name of the model, one of batch_models
+    emu_tol: emulator tolerance for this call only (see set_emulator_tolerance)
+
+    Returns:
+
+    photar: K x ne numpy.array, one model per row
+
+    All K vectors are evaluated in one library call; vectors with the
+    same geometry share the ray tracing and kernels (see tdbatch)
+    '''
+
+    ear    = np.ascontiguousarray(ear, dtype = np.float32)
+    params = np.ascontiguousarray(np.atleast_2d(params), dtype = np.float32)
+
+    ne       = len(ear) - 1
+    nk, npar = params.shape
+
+    photar = np.zeros((nk, ne), dtype = np.float32)
+
+    # row-major K x npar is column-major npar x K, as tdbatch expects
+    emu_tol_call(emu_tol, wbatch,
+                 ct.byref(ct.c_int(batch_models[model])),
+                 ear.ctypes.data_as(type_float_p),
+                 ct.byref(ct.c_int(ne)),
+                 params.ctypes.data_as(type_float_p),
+                 ct.byref(ct.c_int(npar)),
+                 ct.byref(ct.c_int(nk)),
+                 ct.byref(ct.c_int(1)),
+                 photar.ctypes.data_as(type_float_p))
+
+    return photar
+
+def set_emulator_tolerance(tol):
+    '''
+    Accuracy required from the emulator (RELTRANS_EMU, see make_emulator.py)
+    in the following calls: it is used only if its largest validation error
+    in any energy bin is <= tol, so tol = 0 always runs the full model and
+    tol < 0 goes back to RELTRANS_EMU_TOL. The wrappers also take emu_tol
+    for a single call
+    '''
+    global emu_tol_default
+    emu_tol_default = tol
+    wemutol(ct.byref(ct.c_double(tol)))
+
+def set_context(ic):
+    '''
+    Makes the following calls use model context ic (1, 2, ...), e.g. one per
+    walker, so that each keeps its own kernels and transfer functions;
+    ic = 0 goes back to choosing the context automatically (RELTRANS_NCTX).
+    The calls must still be made one at a time, contexts are not thread safe
+    '''
+    wsetctx(ct.byref(ct.c_int(ic)))
+
+def fdjac_wrap(ear, params, model, ijac):
+    '''
+    Takes:
+
+    ear   : numpy array of energies
+    params: array of parameters of the model
+    model : name of the model, one of batch_models
+    ijac  : indices (0-based) of the parameters to differentiate with respect to
+
+    Returns:
+
+    photar: numpy.array, the model
+    jac   : len(ijac) x ne numpy.array, its derivative with respect to each parameter
+
+    The derivatives are finite differences (about 4-5 significant digits),
+    not closed-form ones, which are not implemented;
+    those with respect to Nh, boost, DelA, DelAB, g (and eta for one lamp
+    post) reuse the transfer functions of the model, see tdfdjac
+    '''
+
+    ear    = np.ascontiguousarray(ear, dtype = np.float32)
+    params = np.ascontiguousarray(params, dtype = np.float32)
+    ijac   = np.ascontiguousarray(np.atleast_1d(ijac) + 1, dtype = np.int32)
+
+    ne = len(ear) - 1
+    nj = len(ijac)
+
+    photar = np.zeros(ne, dtype = np.float32)
+    jac    = np.zeros((nj, ne), dtype = np.float32)
+
+    wjac(ct.byref(ct.c_int(batch_models[model])),
+         ear.ctypes.data_as(type_float_p),
+         ct.byref(ct.c_int(ne)),
+         params.ctypes.data_as(type_float_p),
+         ct.byref(ct.c_int(len(params))),
+         ct.byref(ct.c_int(nj)),
+         ijac.ctypes.data_as(type_int_p),
+         ct.byref(ct.c_int(1)),
+         photar.ctypes.data_as(type_float_p),
+         jac.ctypes.data_as(type_float_p))
+
+    return photar, jac
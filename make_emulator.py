@@ -0,0 +1,148 @@
+'''
+Trains an emulator (a fast surrogate) of one reltrans model
+
+    python3 make_emulator.py rtdist params.dat emulator.bin \
+            --free 1:2:20 --free 2:0:0.998 --free 8:1.5:3 \
+            --egrid 0.1 100 300 --nsample 2000 --nproc 8
+
+params.dat holds all the parameters of the model (as for the tdreltrans*
+wrappers); the ones given with --free index:lo:hi (1-based) are sampled in
+that box, the others are fixed. The model is evaluated with batch_wrap
+(see f2py_interface.py) on nproc local processes; the spectra are reduced
+to their principal components (of log(photar) if they are all positive)
+and each component is fitted with a quadratic polynomial of the free
+parameters. 20% of the points are held out to measure the error of the
+surrogate, then it is refitted on all of them.
+
+Set RELTRANS_EMU=emulator.bin to use it: the wrappers then return the
+surrogate whenever the energy grid, the response (RMF_SET, ARF_SET), the
+settings in env_names and the fixed parameters are the ones used here, the
+free ones are inside the box and the largest validation error in any
+energy bin is within RELTRANS_EMU_TOL (default 0.01; see also
+f2py_interface.set_emulator_tolerance and the emu_tol argument of the
+wrappers). The energy grid must be exactly
+the one of the fit: use --egrid-file with the grid as a column of ne+1
+bounds if it is not logarithmic.
+'''
+import argparse
+import os
+import numpy as np
+from multiprocessing import Pool
+
+magic = b'RTEMU003'
+
+# settings that change the model besides the parameters and the response,
+# in the order of emu_envnm (amodules.f90)
+env_names = ('ION_ZONES', 'MU_ZONES', 'A_DENSITY', 'ION_VAR', 'REF_VAR', 'EMIN_REF', 'EMAX_REF',
+             'EMIN_REF2', 'EMAX_REF2', 'RELTRANS_XILLVER_NATIVE', 'BACKSCL')
+
+
+def evaluate(job):
+    # one library per process: the model is not reentrant
+    import f2py_interface as ib
+    model, ear, params = job
+    return ib.batch_wrap(ear, params, model)
+
+
+def features(x):
+    # 1, x_k, x_k*x_l (k<=l): the same order as emulate in emulator.f90
+    n, d = x.shape
+    cols = [np.ones(n)] + [x[:, k] for k in range(d)]
+    cols += [x[:, k] * x[:, l] for k in range(d) for l in range(k, d)]
+    return np.stack(cols, axis = 1)
+
+
+def fit(x, z, npc):
+    mean = z.mean(axis = 0)
+    _, s, vt = np.linalg.svd(z - mean, full_matrices = False)
+    if npc is None:
+        frac = np.cumsum(s**2) / np.sum(s**2)
+        npc  = min(int(np.searchsorted(frac, 1.0 - 1e-8)) + 1, 20, len(s))
+    basis = vt[:npc]
+    coef, *_ = np.linalg.lstsq(features(x), (z - mean) @ basis.T, rcond = None)
+    return mean, basis, coef
+
+
+def predict(x, mean, basis, coef, uselog):
+    z = mean + features(x) @ coef @ basis
+    return np.exp(z) if uselog else z
+
+
+def main():
+    import f2py_interface as ib
+
+    parser = argparse.ArgumentParser(description = 'Train a reltrans emulator')
+    parser.add_argument('model', choices = list(ib.batch_models))
+    parser.add_argument('params', help = 'file with all the parameters of the model')
+    parser.add_argument('out', help = 'emulator file (RELTRANS_EMU)')
+    parser.add_argument('--free', action = 'append', required = True, help = 'index:lo:hi')
+    parser.add_argument('--egrid', nargs = 3, type = float, metavar = ('EMIN', 'EMAX', 'NE'),
+                        default = [0.1, 100.0, 300])
+    parser.add_argument('--egrid-file', help = 'energy bounds, one per line (ne+1)')
+    parser.add_argument('--nsample', type = int, default = 2000)
+    parser.add_argument('--npc', type = int, default = None)
+    parser.add_argument('--nproc', type = int, default = 1)
+    parser.add_argument('--seed', type = int, default = 1)
+    args = parser.parse_args()
+
+    params = np.loadtxt(args.params, dtype = np.float32).ravel()
+    free   = np.array([int(f.split(':')[0]) - 1 for f in args.free])
+    lo     = np.array([float(f.split(':')[1]) for f in args.free])
+    hi     = np.array([float(f.split(':')[2]) for f in args.free])
+    if args.egrid_file:
+        ear = np.loadtxt(args.egrid_file, dtype = np.float32).ravel()
+    else:
+        emin, emax, ne = args.egrid
+        ear = np.logspace(np.log10(emin), np.log10(emax), int(ne) + 1, dtype = np.float32)
+
+    # Latin hypercube over the box, scaled to [-1,1]
+    rng = np.random.default_rng(args.seed)
+    d   = len(free)
+    x   = (np.argsort(rng.random((args.nsample, d)), axis = 0) + rng.random((args.nsample, d))) / args.nsample
+    x   = 2.0 * x - 1.0
+    pars = np.tile(params, (args.nsample, 1))
+    pars[:, free] = lo + 0.5 * (x + 1.0) * (hi - lo)
+
+    chunks = np.array_split(np.arange(args.nsample), max(args.nproc, 1))
+    jobs   = [(args.model, ear, pars[c]) for c in chunks if len(c) > 0]
+    with Pool(args.nproc) as pool:
+        y = np.concatenate(pool.map(evaluate, jobs)).astype(np.float64)
+
+    uselog = bool(np.all(y > 0.0))
+    z = np.log(y) if uselog else y
+
+    # hold out 20% to measure the error, then refit on everything
+    order = rng.permutation(args.nsample)
+    nval  = max(args.nsample // 5, 1)
+    val, train = order[:nval], order[nval:]
+    mean, basis, coef = fit(x[train], z[train], args.npc)
+    yp  = predict(x[val], mean, basis, coef, uselog)
+    # relative L2 error of each spectrum, and the largest error in any bin
+    # relative to that bin (floored at 1e-3 of the spectrum peak)
+    err  = np.linalg.norm(yp - y[val], axis = 1) / np.maximum(np.linalg.norm(y[val], axis = 1), 1e-30)
+    ref  = np.maximum(np.abs(y[val]), np.maximum(1e-3 * np.abs(y[val]).max(axis = 1, keepdims = True), 1e-30))
+    errs = np.array([np.sqrt(np.mean(err**2)), np.max(err), np.max(np.abs(yp - y[val]) / ref)])
+    mean, basis, coef = fit(x, z, basis.shape[0])
+    npc = basis.shape[0]
+    print(f'{npc} components, validation error rms {errs[0]:.3g}, max {errs[1]:.3g}, '
+          f'max per bin {errs[2]:.3g}')
+
+    with open(args.out, 'wb') as f:
+        f.write(magic)
+        np.array([ib.batch_models[args.model], len(params), d, len(ear) - 1, npc, coef.shape[0],
+                  int(uselog)], dtype = np.int32).tofile(f)
+        # the response the spectra were folded with, as strenv reads it
+        for env in ('RMF_SET', 'ARF_SET'):
+            f.write((os.environ.get(env) or 'none').encode().ljust(500)[:500])
+        for env in env_names:
+            f.write((os.environ.get(env) or 'none').encode().ljust(64)[:64])
+        ear.astype(np.float32).tofile(f)
+        params.astype(np.float32).tofile(f)
+        (free + 1).astype(np.int32).tofile(f)
+        # column major basis(ne,npc) and coef(nt,npc)
+        for a in (lo, hi, errs, mean, basis, coef.T):
+            np.ascontiguousarray(a, dtype = np.float64).tofile(f)
+
+
+if __name__ == '__main__':
+    main()
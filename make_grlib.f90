@@ -0,0 +1,76 @@
+program make_grlib
+! Builds a GR camera library for RELTRANS_GRLIB (see subroutines/grlibrary.f90):
+!   ./make_grlib file amin amax na incmin incmax ninc [rout] [honr]
+! traces the camera on na spins in amin..amax times ninc inclinations (degrees)
+! in incmin..incmax, for the given outer disk radius (default 1000 Rg) and
+! disk scale height h/r (default 0). Both grids need at least two nodes. The
+! centre of every cell is traced too, to store its interpolation error (see
+! RELTRANS_GRLIB_TOL).
+!   ./make_grlib check spin inc [rout] [honr]
+! compares the camera interpolated at (spin, inc) from the library named by
+! RELTRANS_GRLIB with a direct trace (see grlib_check).
+    implicit none
+    integer, parameter :: nro = 200, nphi = 200           !as in genreltrans
+    double precision, parameter :: rnmax = 300.d0         !as in genreltrans
+    character (len=500) fname
+    character (len=100) arg
+    integer :: na, ninc
+    double precision :: amin, amax, incmin, incmax, rout, honr
+
+    call get_command_argument(1,fname)
+    if( trim(fname) .eq. 'check' .and. command_argument_count() .ge. 3 )then
+        call get_command_argument(2,arg)
+        read(arg,*) amin
+        call get_command_argument(3,arg)
+        read(arg,*) incmin
+        rout = 1.d3
+        honr = 0.d0
+        if( command_argument_count() .ge. 4 )then
+            call get_command_argument(4,arg)
+            read(arg,*) rout
+        end if
+        if( command_argument_count() .ge. 5 )then
+            call get_command_argument(5,arg)
+            read(arg,*) honr
+        end if
+        call grlib_check(nro,nphi,rnmax,amin,incmin,rout,honr)
+        stop
+    end if
+    if( command_argument_count() .lt. 7 )then
+        print *,"usage: make_grlib file amin amax na incmin incmax ninc [rout] [honr]"
+        print *,"       make_grlib check spin inc [rout] [honr]"
+        stop
+    end if
+    call get_command_argument(2,arg)
+    read(arg,*) amin
+    call get_command_argument(3,arg)
+    read(arg,*) amax
+    call get_command_argument(4,arg)
+    read(arg,*) na
+    call get_command_argument(5,arg)
+    read(arg,*) incmin
+    call get_command_argument(6,arg)
+    read(arg,*) incmax
+    call get_command_argument(7,arg)
+    read(arg,*) ninc
+    rout = 1.d3
+    honr = 0.d0
+    if( command_argument_count() .ge. 8 )then
+        call get_command_argument(8,arg)
+        read(arg,*) rout
+    end if
+    if( command_argument_count() .ge. 9 )then
+        call get_command_argument(9,arg)
+        read(arg,*) honr
+    end if
+    if( na .lt. 2 .or. ninc .lt. 2 )then
+        print *,"make_grlib: na and ninc must be at least 2"
+        stop
+    end if
+    !the model caps the spin at 0.999 (see genreltrans)
+    amin = max( amin , -0.999d0 )
+    amax = min( amax ,  0.999d0 )
+
+    call grlib_build(fname,nro,nphi,rnmax,na,amin,amax,ninc,incmin,incmax,rout,honr)
+    print *,"Written ",trim(fname)
+end program make_grlib
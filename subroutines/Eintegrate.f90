@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function Eintegrate(Elo,Ehi,nex,earx,photarx,dlogE)
+recursive function Eintegrate(Elo,Ehi,nex,earx,photarx,dlogE)
 ! Integrates specific flux from Elo to Ehi
 ! Photarx is specific photon flux, therefore integral is
 ! sum_i E(i) * photarx(i)
@@ -37,7 +37,7 @@
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-      function dareafac(r,a)
+      recursive function dareafac(r,a)
 ! Calculates dA/dr, where A is the surface area of a disk ring
 ! *ADJUSTED FOR ORBITAL MOTION* BY MULTIPLYING BY THE LORENTZ FACTOR
       implicit none
@@ -91,7 +91,7 @@
 
 
 !-----------------------------------------------------------------------
-function dglpfacthick(r,a,h,mu)
+recursive function dglpfacthick(r,a,h,mu)
 ! Calculates blue shift expreienced by a photon travelling from
 ! an on-axis point source to a point on a Keplerian disk with constant
 ! scaleheight (h/r=0 is mu=0)
@@ -115,7 +115,7 @@ end function dglpfacthick
 
 
 !-----------------------------------------------------------------------
-function dlgfacthick(a,mu0,alpha,r,mu)
+recursive function dlgfacthick(a,mu0,alpha,r,mu)
 ! Calculates g-factor for a photon travelling from disc to observer.
 ! Disc has constant mu.
   implicit none
@@ -150,7 +150,7 @@ end function dlgfacthick
 
 
 !-----------------------------------------------------------------------
-      function dgsofac(a,h)
+      recursive function dgsofac(a,h)
 ! Calculates blue shift expreienced by a photon travelling from
 ! an on-axis point source to a distant, stationary observer.
 ! Works for pro- and retrograde spins.
@@ -182,7 +182,7 @@ end function dlgfacthick
 
       
 !-----------------------------------------------------------------------
-      function dlorfac(r,a)
+      recursive function dlorfac(r,a)
 ! Calculates Lorentz factor for rotating disk element
       implicit none
       double precision dlorfac,r,a
@@ -1,37 +1,73 @@
 
 module telematrix
-  !Module containing definitions needs to fold around the telescope
-  !response matrix
-  logical              :: needchans, needresp, arf, needbkg
-  integer              :: nenerg, numchn, Ilo, Ihi, needEs
-  real                 :: Elo, Ehi
-  real,    allocatable :: En(:), resp(:,:), ECHN(:)
-  integer, allocatable :: NGRP(:), FCHAN(:,:), LCHAN(:,:), NCHAN(:,:)
+  !Registry of the telescope responses, indexed by the RESP parameter.
+  !Each RESP id has its own reference band; its matrix is one of the
+  !slots rsp(1:nrsp), shared by all the ids that name the same rmf and arf
+  !(see loadresp), so every matrix is read and stored only once.
+  integer, parameter   :: nrespmax = 10
+  type response
+     character (len=500)  :: respname, arfname
+     logical              :: arf
+     integer              :: nenerg, numchn
+     real,    allocatable :: En(:), ECHN(:)
+     !Response in compressed sparse column format (one column per energy J):
+     !the non-zero elements of column J are respval(n), in channel respchn(n),
+     !for n = respcol(J), ..., respcol(J+1)-1
+     integer              :: respnnz
+     integer, allocatable :: respcol(:), respchn(:)
+     real,    allocatable :: respval(:)
+  end type response
+  type refband
+     !Reference band weight of each response energy bin (sum of the column over channels Ilo..Ihi)
+     real,    allocatable :: w(:)
+  end type refband
+  type(response)       :: rsp(nrespmax)
+  integer              :: nrsp
+  !Per RESP id: matrix slot (0 until loaded) and reference band
+  integer              :: respslot(nrespmax)
+  logical              :: needchans(nrespmax)
+  integer              :: Ilo(nrespmax), Ihi(nrespmax)
+  real                 :: Elo(nrespmax), Ehi(nrespmax)
+  type(refband)        :: refw(nrespmax)
+  !Background of the simulations (channels of RESP id 1)
+  logical              :: needbkg
   integer, allocatable :: bkgcounts(:)
   real, allocatable    :: bkgrate(:)
-  character (len=500) respname, arfname, bkgname
-  data needresp/.true./
-  data needchans/.true./
+  character (len=500) bkgname
+  !on-disk cache of the processed matrices (see rspcache.f90): bump the version if the file layout changes
+  character (len=8), parameter :: rspcache_magic = 'RTRSPCCH'
+  integer          , parameter :: rspcache_version = 1
+  data nrsp/0/
+  data respslot/nrespmax*0/
+  data needchans/nrespmax*.true./
   data needbkg/.true./
 end module telematrix
 
-module telematrix2
-  !Module containing definitions needs to fold around the telescope
-  !response matrix
-  logical              :: needchans2, needresp2, arf2
-  integer              :: nenerg2, numchn2, Ilo2, Ihi2, needEs2
-  real                 :: Elo2, Ehi2
-  real,    allocatable :: En2(:), resp2(:,:), ECHN2(:)
-  integer, allocatable :: NGRP2(:), FCHAN2(:,:), LCHAN2(:,:), NCHAN2(:,:)
-  character (len=500) respname2, arfname2
-
-  data needresp2/.true./
-  data needchans2/.true./
-end module telematrix2
+module rebin_plans
+  !Sparse weights of rebinE for the last few (source grid, target grid) pairs
+  !(see getplan): output bin j of plan ip is the sum of w(n) * px(col(n))
+  !for n = row(j), ..., row(j+1)-1. fpx and fpe are the fingerprints of
+  !the two grids (see gridfp), stored when the plan is built. The plans are
+  !threadprivate and go with the model context (see model_contexts)
+  implicit none
+  integer, parameter   :: nplanmax = 16
+  type rebinplan
+     integer              :: nex, ne
+     double precision     :: fpx(3), fpe(3)
+     real,    allocatable :: earx(:), ear(:)
+     integer, allocatable :: row(:), col(:)
+     real,    allocatable :: w(:)
+  end type rebinplan
+  type(rebinplan), allocatable :: plans(:)      !nplanmax slots, allocated by getplan
+  integer       , allocatable :: planused(:)
+  integer                     :: planclock = 0
+  !$omp threadprivate(plans, planused, planclock)
+end module rebin_plans
 
 module env_variables
   implicit none
   integer :: adensity, idum
+  integer :: nsimreal, simseed   !batch realisations in simrtdist and their seed
   save idum
 end module env_variables
   
@@ -39,16 +75,87 @@ MODULE dyn_gr
 !---------------------------------------------------------------------
 !  Module containing definitions needed to dynamically allocate 
 !  the values of an array 
+!  The camera (re1, taudo1, pem1, traced for spinsav, musav, routsav,
+!  mudsav) and the lamppost arrays belong to the model context of the
+!  call (see model_contexts): they are threadprivate pointers, so the
+!  parallel regions that work on them pass them on with copyin
 !---------------------------------------------------------------------
     implicit none
     logical :: status_re_tau  
     integer, parameter :: ndelta = 1000
-    integer         , dimension(:)  , allocatable :: npts
-    double precision, dimension(:,:), allocatable :: re1,taudo1,pem1
-    double precision, dimension(:,:), allocatable :: dcosdr, cosd, rlp, tlp
+    integer         , dimension(:)  , pointer, contiguous :: npts => null()
+    double precision, dimension(:,:), pointer, contiguous :: re1 => null(), taudo1 => null(), pem1 => null()
+    double precision, dimension(:,:), pointer, contiguous :: dcosdr => null(), cosd => null()
+    double precision, dimension(:,:), pointer, contiguous :: rlp => null(), tlp => null()
+    double precision :: spinsav = 2.d0, musav = 2.d0, routsav = 0.d0, mudsav = 0.d0
+    !on-disk cache of re1/taudo1/pem1 (see grcache.f90): bump the version if the file layout changes
+    character (len=8), parameter :: grcache_magic = 'RTGRTRCE'
+    integer         , parameter :: grcache_version = 1
+    !camera library over (spin, inclination) (see grlibrary.f90): grlib_state is 0 before
+    !RELTRANS_GRLIB has been looked at, 1 if the library is loaded and -1 if there is none.
+    !grlib_err is the interpolation error measured at the centre of each cell (see
+    !grlib_compare); cells whose error is above grlib_tol are traced instead
+    character (len=8), parameter :: grlib_magic = 'RTGRLIB3'
+    integer                       :: grlib_state = 0, grlib_na, grlib_ni
+    double precision              :: grlib_key(4)          !rout, mudisk, d, rnmax
+    double precision              :: grlib_tol = -1.d0     !< 0: not set yet (RELTRANS_GRLIB_TOL)
+    double precision, allocatable :: grlib_a(:), grlib_inc(:), grlib_err(:,:)
+    real            , allocatable :: grlib_re(:,:,:,:), grlib_tau(:,:,:,:)
     save status_re_tau
+    !$omp threadprivate(status_re_tau, npts, re1, taudo1, pem1, dcosdr, cosd, rlp, tlp)
+    !$omp threadprivate(spinsav, musav, routsav, mudsav)
 END MODULE dyn_gr
 
+module kernel_pixels
+  !Pixel list of the last rtrans call: bins, time lags and kernel weights of every
+  !camera pixel that hits the disk. Kept so that kernel_chunk can build the kernels
+  !for any subset of frequencies without tracing the camera again. Part of the
+  !model context, like the camera (threadprivate pointers, see dyn_gr)
+  implicit none
+  integer                                   :: npix = 0
+  logical         , pointer, contiguous     :: pixhit(:) => null()
+  integer         , pointer, contiguous     :: pixg(:) => null(), pixr(:) => null(), pixmu(:) => null()
+  double precision, pointer, contiguous     :: pixtau(:,:) => null()
+  real            , pointer, contiguous     :: pixw(:,:,:) => null()
+  real                                      :: pixparam(32) = 0.0   !parameters of that rtrans call
+  !$omp threadprivate(npix, pixhit, pixg, pixr, pixmu, pixtau, pixw, pixparam)
+end module kernel_pixels
+
+module sim_products
+  !Extra outputs of genreltrans for the simulation wrappers (see simspectra): while
+  !nsim > 0, a lag-energy call also returns its real and imaginary parts rebinned
+  !onto earsim(0:nsim), from the same cross spectrum as the requested output
+  implicit none
+  integer           :: nsim = 0
+  real, allocatable :: earsim(:), resim(:), imsim(:)
+  !$omp threadprivate(nsim, earsim, resim, imsim)
+end module sim_products
+
+module emulator
+  !Surrogate of one wrapper made by make_emulator.py (see emulator.f90): the model is
+  !mean + basis * coefficients (of log(photar) if emu_log), the coefficients being
+  !quadratic polynomials of the free parameters scaled to [-1,1]. emu_state is 0 before
+  !RELTRANS_EMU has been looked at, 1 if loaded and -1 if there is none. emutol is the
+  !largest validation error (relative, on the held-out training points) accepted.
+  !emu_envnm are the settings besides the response that change the model: their
+  !values during the training (emu_env, as strenv reads them) must be the current ones
+  implicit none
+  character (len=8), parameter  :: emu_magic = 'RTEMU003'
+  integer          , parameter  :: emu_nenv = 11
+  character (len=24), parameter :: emu_envnm(emu_nenv) = [character(len=24) :: &
+       'ION_ZONES', 'MU_ZONES', 'A_DENSITY', 'ION_VAR', 'REF_VAR', 'EMIN_REF', 'EMAX_REF', &
+       'EMIN_REF2', 'EMAX_REF2', 'RELTRANS_XILLVER_NATIVE', 'BACKSCL']
+  character (len=64)            :: emu_env(emu_nenv)
+  integer                       :: emu_state = 0
+  integer                       :: emu_imod, emu_npar, emu_nfree, emu_ne, emu_npc, emu_nt, emu_log
+  real            , allocatable :: emu_ear(:), emu_par(:)
+  integer         , allocatable :: emu_free(:)
+  double precision, allocatable :: emu_lo(:), emu_hi(:), emu_mean(:), emu_basis(:,:), emu_coef(:,:)
+  character (len=500)           :: emu_rmf, emu_arf       !response it was trained with
+  double precision              :: emu_err(3)            !rms and largest L2 error, largest per bin
+  double precision              :: emutol = -1.d0        !< 0: not set yet (RELTRANS_EMU_TOL)
+end module emulator
+
 module xillver_tables
     implicit none 
     character (len=50), parameter ::  xillver = 'xillver-a-Ec5.fits'
@@ -59,19 +166,63 @@ module xillver_tables
     character (len=200) ::  pathname_xillverD 
     character (len=200) ::  pathname_xillverDCp
     character (len=500) ::  path_name_reflionx_table
+    ! In-memory copies of the xillver tables (see xillver_grid.f90), each read on the first call
+    ! that needs it and kept, shared by all threads, for the rest of the session. A table that
+    ! cannot be read stays in the list with ok=.false., so its calls go to xsatbl.
+    integer                       :: xillver_native = 1      !0: interpolate with xsatbl instead
+    integer, parameter            :: nxtabmax = 3
+    type xtable
+       character (len=200)        :: name = ' '
+       logical                    :: ok = .false.
+       integer                    :: npar = 0, nen = 0, nspec = 0
+       logical                    :: zpar = .false.          !table has a redshift parameter
+       integer      , allocatable :: nval(:), method(:), stride(:)
+       real         , allocatable :: val(:,:)                !parameter values (max nval, npar)
+       real         , allocatable :: elo(:), ehi(:)
+       real         , allocatable :: spec(:,:)               !spectra (nen, nspec), first parameter fastest
+    end type xtable
+    type(xtable)                  :: xtab(nxtabmax)
+    integer                       :: nxtab = 0
+    ! Rebinning weights from the energies of table xgrid_it onto the last output grid used
+    ! (threadprivate, part of the model context)
+    integer                       :: xgrid_it = 0, xgrid_ne = -1
+    real            , allocatable :: xgrid_ear(:)
+    integer         , allocatable :: xgrid_woff(:), xgrid_wk(:)
+    real            , allocatable :: xgrid_w(:)
+    !$omp threadprivate(xgrid_it, xgrid_ne, xgrid_ear, xgrid_woff, xgrid_wk, xgrid_w)
 end module xillver_tables
 
+module rf_cache
+    ! Least recently used cache of rest frame spectra (see rest_frame_cached),
+    ! threadprivate and part of the model context
+    implicit none
+    integer                       :: rfc_size = -1            !number of slots, 0 = no cache (-1: not set up yet)
+    integer                       :: rfc_ne = -1
+    real                          :: rfc_elo, rfc_ehi         !grid the cached spectra refer to
+    integer(kind=8), allocatable  :: rfc_key(:,:)             !quantised (Cp,Gamma,Afe,logne,Ecut,logxi,thetae)
+    integer(kind=8), allocatable  :: rfc_used(:)              !last access (0 = empty slot)
+    real           , allocatable  :: rfc_spec(:,:)
+    integer(kind=8)               :: rfc_clock = 0, rfc_hits = 0, rfc_misses = 0
+    integer        , parameter    :: rfc_nkey = 7
+    double precision, parameter   :: rfc_quantum = 1.d-6     !parameters closer than this share a slot
+    !$omp threadprivate(rfc_size, rfc_ne, rfc_elo, rfc_ehi, rfc_key, rfc_used, rfc_spec, rfc_clock, rfc_hits, rfc_misses)
+end module rf_cache
+
 module gr_continuum
+  !part of the model context, like the camera (threadprivate pointers, see dyn_gr)
   implicit none
-  double precision, dimension(:), allocatable :: tauso, gso, lens, cosdelta_obs
-  save lens
+  double precision, dimension(:), pointer, contiguous :: tauso => null(), gso => null()
+  double precision, dimension(:), pointer, contiguous :: lens => null(), cosdelta_obs => null()
+  !$omp threadprivate(tauso, gso, lens, cosdelta_obs)
 end module gr_continuum
 
 module radial_grids
+  !part of the model context (threadprivate)
   implicit none
   double precision , dimension(:), allocatable :: logxir, logner, gsdr, dfer_arr
   double precision :: pnorm
   save logxir, gsdr, logner
+  !$omp threadprivate(logxir, logner, gsdr, dfer_arr, pnorm)
 end module radial_grids
 
 module conv_mod
@@ -86,41 +237,157 @@ module conv_mod
   
   double precision, parameter :: nexm1 = 1. / real(nex_conv, kind(8))
 
+  ! The plans are made once and shared; they are only ever run with the new-array execute
+  ! interface, on the buffers of the calling thread. The buffers (a1..a6 and the arrays
+  ! pointing to them) are threadprivate and belong to the model context (see conv_buffers).
   type(C_ptr) :: plan1, plan2
-  real(   c_double), pointer, dimension(:) :: in,  out_conv
-  complex(c_double), pointer, dimension(:) :: out, in_conv
-  type(C_ptr) :: a1, a2, a3, a4
-
+  real(   c_double), pointer, dimension(:) :: in => null(),  out_conv => null()
+  complex(c_double), pointer, dimension(:) :: out => null(), in_conv => null()
+  type(C_ptr) :: a1 = c_null_ptr, a2 = c_null_ptr, a3 = c_null_ptr, a4 = c_null_ptr
+
+  ! batched convolutions (conv_zone_FFTw): nbatch padded lines are transformed in one go
+  ! (8 = Re/Im of W0..W3 for one frequency and lamppost)
+  integer, parameter :: nbatch = 8
+  type(C_ptr) :: plan3, plan4
+  real(   c_double), pointer, dimension(:,:) :: inb => null()
+  complex(c_double), pointer, dimension(:,:) :: outb => null()
+  type(C_ptr) :: a5 = c_null_ptr, a6 = c_null_ptr
+  !$omp threadprivate(in, out_conv, out, in_conv, inb, outb, a1, a2, a3, a4, a5, a6)
 
 contains
   
-  subroutine init_fftw_allconv()
+  recursive subroutine init_fftw_allconv()
+    ! Sets up the FFTW buffers and plans used by the convolutions.
+    ! Planning is slow, so FFTW wisdom can be kept on disk: if RELTRANS_FFTW_WISDOM is set to a
+    ! file name, the wisdom is imported from it before planning, each plan is first looked up in
+    ! it (FFTW_WISDOM_ONLY) and, if any plan had to be made, the wisdom is exported to the file
+    ! after planning, so a missing, partial or stale file gains what this run measured. RELTRANS_FFTW_PLAN (ESTIMATE, MEASURE
+    ! or PATIENT, default PATIENT) sets how hard FFTW searches for plans that are not in the wisdom;
+    ! the batched plans stop at MEASURE, since patient planning of them takes tens of seconds.
+    ! The plans are made on buffers of this thread, which are freed again afterwards.
     implicit none
-    integer(c_int) :: flags, i
+    integer(c_int) :: flags, flags_batch, i
     integer, external :: omp_get_max_threads
     INTEGER FFTW_PATIENT
     PARAMETER (FFTW_PATIENT=32)
+    character (len=500) :: wisdomfile, planlevel
+    character (len=500), external :: strenv
+    character (len=200) :: envnm
+    logical :: newplans
     !i = fftw_init_threads()
     !call fftw_plan_with_nthreads(omp_get_max_threads())
     !print*, "Using threads num:", omp_get_max_threads()
 
     ! allocate
-    a1 = fftw_alloc_real(   int(nex_conv, c_size_t))
-    a2 = fftw_alloc_real(   int(nex_conv, c_size_t))
-    a3 = fftw_alloc_complex(int(nec     , c_size_t))
-    a4 = fftw_alloc_complex(int(nec     , c_size_t))
+    call conv_buffers(.true.)
+
+    ! planning effort for whatever is not in the wisdom
+    envnm     = 'RELTRANS_FFTW_PLAN'
+    planlevel = strenv(envnm)
+    if( trim(planlevel) .eq. 'ESTIMATE' )then
+       flags = 0 + FFTW_ESTIMATE
+    else if( trim(planlevel) .eq. 'MEASURE' )then
+       flags = 0 + FFTW_MEASURE
+    else
+       if( trim(planlevel) .ne. 'none' .and. trim(planlevel) .ne. 'PATIENT' ) &
+            write(*,*)"Warning! RELTRANS_FFTW_PLAN=",trim(planlevel)," not recognised, using PATIENT"
+       flags = 0 + FFTW_PATIENT
+    end if
+    flags_batch = flags
+    if( flags .eq. FFTW_PATIENT ) flags_batch = FFTW_MEASURE
+    ! wisdom from previous sessions
+    envnm      = 'RELTRANS_FFTW_WISDOM'
+    wisdomfile = strenv(envnm)
+    !a missing or unreadable file is not an error: the plans are then all made here
+    if( trim(wisdomfile) .ne. 'none' ) i = fftw_import_wisdom_from_filename(trim(wisdomfile)//C_NULL_CHAR)
+    newplans = .false.
+
+    ! note: these two are what kill the runtime of this subroutine (unless they come from the wisdom)
+    plan1 = fftw_plan_dft_r2c_1d(nex_conv,  in, out, ior(flags,FFTW_WISDOM_ONLY))
+    if( .not. c_associated(plan1) )then
+       plan1 = fftw_plan_dft_r2c_1d(nex_conv,  in, out, flags)
+       newplans = .true.
+    end if
+    plan2 = fftw_plan_dft_c2r_1d(nex_conv, in_conv, out_conv, ior(flags,FFTW_WISDOM_ONLY))
+    if( .not. c_associated(plan2) )then
+       plan2 = fftw_plan_dft_c2r_1d(nex_conv, in_conv, out_conv, flags)
+       newplans = .true.
+    end if
+
+    ! batched plans: nbatch contiguous lines, the c2r transform goes back from outb to inb
+    plan3 = fftw_plan_many_dft_r2c(1, [nex_conv], nbatch, inb , [nex_conv], 1, nex_conv, &
+                                   outb, [nec     ], 1, nec     , ior(flags_batch,FFTW_WISDOM_ONLY))
+    if( .not. c_associated(plan3) )then
+       plan3 = fftw_plan_many_dft_r2c(1, [nex_conv], nbatch, inb , [nex_conv], 1, nex_conv, &
+                                                             outb, [nec     ], 1, nec     , flags_batch)
+       newplans = .true.
+    end if
+    plan4 = fftw_plan_many_dft_c2r(1, [nex_conv], nbatch, outb, [nec     ], 1, nec     , &
+                                   inb , [nex_conv], 1, nex_conv, ior(flags_batch,FFTW_WISDOM_ONLY))
+    if( .not. c_associated(plan4) )then
+       plan4 = fftw_plan_many_dft_c2r(1, [nex_conv], nbatch, outb, [nec     ], 1, nec     , &
+                                                             inb , [nex_conv], 1, nex_conv, flags_batch)
+       newplans = .true.
+    end if
+
+    if( trim(wisdomfile) .ne. 'none' .and. newplans ) call export_fftw_wisdom(wisdomfile)
+    call conv_buffers(.false.)
+    call fftw_free(a1)
+    call fftw_free(a2)
+    call fftw_free(a3)
+    call fftw_free(a4)
+    call fftw_free(a5)
+    call fftw_free(a6)
+    a1 = c_null_ptr
+    a2 = c_null_ptr
+    a3 = c_null_ptr
+    a4 = c_null_ptr
+    a5 = c_null_ptr
+    a6 = c_null_ptr
+  end subroutine init_fftw_allconv
 
+  recursive subroutine conv_buffers(alloc)
+    ! Points in, out_conv, out, in_conv, inb and outb at the FFTW buffers a1..a6 of the
+    ! current thread, allocating those that are not there yet if alloc is set. With alloc
+    ! unset the pointers are only nullified (the buffers stay with a1..a6: genreltrans
+    ! swaps them in and out with the model context).
+    implicit none
+    logical, intent(in) :: alloc
+    if( .not. alloc )then
+       nullify(in, out_conv, out, in_conv, inb, outb)
+       return
+    end if
+    if( .not. c_associated(a1) ) a1 = fftw_alloc_real(   int(nex_conv, c_size_t))
+    if( .not. c_associated(a2) ) a2 = fftw_alloc_real(   int(nex_conv, c_size_t))
+    if( .not. c_associated(a3) ) a3 = fftw_alloc_complex(int(nec     , c_size_t))
+    if( .not. c_associated(a4) ) a4 = fftw_alloc_complex(int(nec     , c_size_t))
+    if( .not. c_associated(a5) ) a5 = fftw_alloc_real(   int(nex_conv * nbatch, c_size_t))
+    if( .not. c_associated(a6) ) a6 = fftw_alloc_complex(int(nec      * nbatch, c_size_t))
     call c_f_pointer(a1, in      , [nex_conv])
     call c_f_pointer(a2, out_conv, [nex_conv])
     call c_f_pointer(a3, out     , [nec     ])
     call c_f_pointer(a4, in_conv , [nec     ])
-    !   flags = 0 + FFTW_ESTIMATE
-    flags = 0 + FFTW_PATIENT
+    call c_f_pointer(a5, inb , [nex_conv, nbatch])
+    call c_f_pointer(a6, outb, [nec     , nbatch])
+  end subroutine conv_buffers
+
+  recursive subroutine export_fftw_wisdom(wisdomfile)
+    ! Writes the accumulated FFTW wisdom to wisdomfile. FFTW writes the file itself, so it goes
+    ! to a per-process temporary name first; another session importing wisdomfile while the plans
+    ! are exported then finds either no wisdom (and plans for itself) or the whole of it.
+    implicit none
+    character (len=500), intent(in) :: wisdomfile
+    character (len=520) :: tmpname
+    integer :: getpid
 
-    ! note: these two are what kill the runtime of this subroutine
-    plan1 = fftw_plan_dft_r2c_1d(nex_conv,  in, out, flags)
-    plan2 = fftw_plan_dft_c2r_1d(nex_conv, in_conv, out_conv, flags)
-  end subroutine init_fftw_allconv
+    write(tmpname,'(A,A,I0)') trim(wisdomfile),'.tmp',getpid()
+    if( fftw_export_wisdom_to_filename(trim(tmpname)//C_NULL_CHAR) .eq. 0 )then
+       write(*,*)"Warning! Cannot write FFTW wisdom file ",trim(tmpname)
+       return
+    end if
+    call rename(trim(tmpname),trim(wisdomfile))
+
+  end subroutine export_fftw_wisdom
 
   subroutine conv_one_FFTw(dyn,photarx,reline,imline,ReW_conv,ImW_conv,DC,nlp)
     implicit none
@@ -129,37 +396,268 @@ contains
     real, intent(in)    :: photarx(nex)
     real, intent(in)    :: reline(nlp,nex), imline(nlp,nex)
     real, intent(inout) :: ReW_conv(nlp,nex), ImW_conv(nlp,nex)
-    complex :: conv(nec),padFT_photarx(nec)
-    complex :: padFT_reline(nec),  padFT_imline(nec)            
-    integer :: m, i
-    real    :: photmax, depad_conv(nex)
+    complex :: padFT_photarx(nec)
 
-    do m=1,nlp  
-       if (DC .eq. 1 ) then
-          ! call padding4FT(photarx,padFT_photarx)
-          call padding4FT_xillver(photarx,padFT_photarx)
-
-          call padding4FT(reline(m,:),padFT_reline)                        
+    call padding4FT_spectrum(photarx,padFT_photarx,DC)
+    call conv_one_FFTw_FT(dyn,padFT_photarx,reline,imline,ReW_conv,ImW_conv,DC,nlp)
 
-          conv = (padFT_photarx * padFT_reline) * nexm1
-          call de_paddingFT(dyn, conv, depad_conv)
-          ReW_conv(m,:) = ReW_conv(m,:) + depad_conv
-       else 
-          call padding4FT(photarx       , padFT_photarx)        
-          call padding4FT(reline(m,:),padFT_reline)
-          call padding4FT(imline(m,:),padFT_imline)
+  end subroutine conv_one_FFTw
 
-          conv = (padFT_photarx * padFT_reline) * nexm1
-          call de_paddingFT(dyn, conv, depad_conv)
-          ReW_conv(m,:) = ReW_conv(m,:) + depad_conv
+  subroutine conv_one_FFTw_FT(dyn,padFT_photarx,reline,imline,ReW_conv,ImW_conv,DC,nlp)
+    ! Same as conv_one_FFTw, but takes the padded FT of the rest frame spectrum
+    ! (from padding4FT_spectrum) instead of the spectrum itself, so that the caller
+    ! can transform each spectrum once and reuse it for all frequencies and lampposts.
+    ! Only the kernel lines are transformed here.
+    implicit none
+    integer, intent(in) :: DC, nlp 
+    real                :: dyn
+    complex, intent(in) :: padFT_photarx(nec)
+    real, intent(in)    :: reline(nlp,nex), imline(nlp,nex)
+    real, intent(inout) :: ReW_conv(nlp,nex), ImW_conv(nlp,nex)
+    complex :: conv(nec)
+    complex :: padFT_reline(nec),  padFT_imline(nec)            
+    integer :: m
+    real    :: depad_conv(nex)
 
+    do m=1,nlp  
+       call padding4FT(reline(m,:),padFT_reline)                        
+       conv = (padFT_photarx * padFT_reline) * nexm1
+       call de_paddingFT(dyn, conv, depad_conv)
+       ReW_conv(m,:) = ReW_conv(m,:) + depad_conv
+       if (DC .ne. 1 ) then
+          call padding4FT(imline(m,:),padFT_imline)
           conv = (padFT_photarx * padFT_imline) * nexm1
           call de_paddingFT(dyn, conv, depad_conv)
           ImW_conv(m,:) = ImW_conv(m,:) + depad_conv           
        endif
     end do
 
-  end subroutine conv_one_FFTw
+  end subroutine conv_one_FFTw_FT
+
+  recursive subroutine conv_zone_FFTw(dyn,padFT_photarx,padFT_photarx_delta,padFT_photarx_dlogxi,ker_W0,ker_W1,ker_W2,ker_W3,&
+       ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,DC,refvar,ionvar,nlp,nf)
+    ! Batched version of the conv_one_FFTw_FT calls for one (mubin,rbin) zone: convolves the
+    ! Re and Im parts of ker_W0..3, for every lamppost and frequency, with the padded FT of the
+    ! corresponding rest frame spectrum (W0,W1: photarx, W2: photarx_delta, W3: photarx_dlogxi).
+    ! Same selection as the single calls: only W0 for the DC, W1/W2 if refvar=1, W3 if ionvar=1.
+    ! The kernel lines are padded straight into inb and transformed nbatch at a time with the
+    ! advanced plans plan3/plan4; the last, incomplete batch goes through plan1/plan2.
+    implicit none
+    integer, intent(in) :: DC, refvar, ionvar, nlp, nf
+    real                :: dyn
+    complex, intent(in) :: padFT_photarx(nec), padFT_photarx_delta(nec), padFT_photarx_dlogxi(nec)
+    complex, intent(in) :: ker_W0(nlp,nex,nf), ker_W1(nlp,nex,nf), ker_W2(nlp,nex,nf), ker_W3(nlp,nex,nf)
+    real, intent(inout) :: ReW0(nlp,nex,nf), ImW0(nlp,nex,nf), ReW1(nlp,nex,nf), ImW1(nlp,nex,nf)
+    real, intent(inout) :: ReW2(nlp,nex,nf), ImW2(nlp,nex,nf), ReW3(nlp,nex,nf), ImW3(nlp,nex,nf)
+    integer :: nb, j, m, k, ipart, i
+    integer :: vk(nbatch), vpart(nbatch), vm(nbatch), vj(nbatch)
+    logical :: dok(0:3)
+
+    dok(0) = .true.
+    dok(1) = DC .eq. 0 .and. refvar .eq. 1
+    dok(2) = dok(1)
+    dok(3) = DC .eq. 0 .and. ionvar .eq. 1
+    nb = 0
+    do j = 1,nf
+       do m = 1,nlp
+          do k = 0,3
+             if (.not. dok(k)) cycle
+             do ipart = 0,1
+                if (ipart .eq. 1 .and. DC .eq. 1) cycle
+                nb = nb + 1
+                vk(nb)    = k
+                vpart(nb) = ipart
+                vm(nb)    = m
+                vj(nb)    = j
+                !same padding as padding4FT
+                inb(1,nb) = 0.0
+                select case (k)
+                case (0)
+                   call pad_line(ker_W0(m,:,j))
+                case (1)
+                   call pad_line(ker_W1(m,:,j))
+                case (2)
+                   call pad_line(ker_W2(m,:,j))
+                case (3)
+                   call pad_line(ker_W3(m,:,j))
+                end select
+                do i = nex+2, nex_conv
+                   inb(i,nb) = 0.0
+                end do
+                if (nb .eq. nbatch) call flush_batch()
+             end do
+          end do
+       end do
+    end do
+    if (nb .gt. 0) call flush_batch()
+
+  contains
+
+    recursive subroutine pad_line(kline)
+      complex, intent(in) :: kline(nex)
+      if (ipart .eq. 0) then
+         inb(2:nex+1,nb) = real( kline )
+      else
+         inb(2:nex+1,nb) = aimag( kline )
+      end if
+    end subroutine pad_line
+
+    recursive subroutine flush_batch()
+      ! convolves the nb lines in the batch and adds them to the ReW/ImW arrays
+      integer :: ib, i, mm, jj
+      complex :: conv(nec), padFT_line(nec)
+      real    :: depad_conv(nex), photmax
+      if (nb .eq. nbatch) then
+         call fftw_execute_dft_r2c(plan3, inb, outb)
+      else
+         do ib = 1,nb
+            in = inb(:,ib)
+            call fftw_execute_dft_r2c(plan1, in, out)
+            outb(:,ib) = out
+         end do
+      end if
+      do ib = 1,nb
+         padFT_line = cmplx( outb(:,ib) )
+         if (vk(ib) .eq. 2) then
+            conv = cmplx( (padFT_photarx_delta * padFT_line) * nexm1 )
+         else if (vk(ib) .eq. 3) then
+            conv = cmplx( (padFT_photarx_dlogxi * padFT_line) * nexm1 )
+         else
+            conv = cmplx( (padFT_photarx * padFT_line) * nexm1 )
+         end if
+         outb(:,ib) = conv
+      end do
+      if (nb .eq. nbatch) then
+         call fftw_execute_dft_c2r(plan4, outb, inb)
+      else
+         do ib = 1,nb
+            in_conv = outb(:,ib)
+            call fftw_execute_dft_c2r(plan2, in_conv, out_conv)
+            inb(:,ib) = out_conv
+         end do
+      end if
+      do ib = 1,nb
+         !same de-padding and cleaning as de_paddingFT
+         photmax = 0.0
+         do i = 1, nex
+            depad_conv(i) = real( inb(i + nex/2 + 1, ib) )
+            photmax = max( photmax , depad_conv(i) )
+         end do
+         do i = 1, nex
+            if( abs(depad_conv(i)) .lt. abs(dyn * photmax) ) depad_conv(i) = 0.0
+         end do
+         mm = vm(ib)
+         jj = vj(ib)
+         select case (2*vk(ib)+vpart(ib))
+         case (0)
+            ReW0(mm,:,jj) = ReW0(mm,:,jj) + depad_conv
+         case (1)
+            ImW0(mm,:,jj) = ImW0(mm,:,jj) + depad_conv
+         case (2)
+            ReW1(mm,:,jj) = ReW1(mm,:,jj) + depad_conv
+         case (3)
+            ImW1(mm,:,jj) = ImW1(mm,:,jj) + depad_conv
+         case (4)
+            ReW2(mm,:,jj) = ReW2(mm,:,jj) + depad_conv
+         case (5)
+            ImW2(mm,:,jj) = ImW2(mm,:,jj) + depad_conv
+         case (6)
+            ReW3(mm,:,jj) = ReW3(mm,:,jj) + depad_conv
+         case (7)
+            ImW3(mm,:,jj) = ImW3(mm,:,jj) + depad_conv
+         end select
+      end do
+      nb = 0
+    end subroutine flush_batch
+
+  end subroutine conv_zone_FFTw
+
+  recursive subroutine conv_zone_bands(padFT_photarx,padFT_photarx_delta,padFT_photarx_dlogxi,padFT_band,&
+       ker_W0,ker_W1,ker_W2,ker_W3,BW,DC,refvar,ionvar,nlp,nf)
+    ! Band-restricted version of conv_zone_FFTw, for when only the band sums
+    ! BW(m,j,k,ib) = sum_i wband(i,ib) * Wk(m,i,j) are needed (lag-frequency spectra).
+    ! The band sum of a convolution is the dot product of the kernel with the correlation
+    ! of the rest frame spectrum and the band weights (proj below). That depends on the zone
+    ! but not on the frequency, so it takes one inverse FFT per spectrum and band, and every
+    ! frequency and lamppost then costs a dot product instead of a pair of FFTs.
+    ! padFT_band(:,ib) is the padding4FT of the weights wband(:,ib).
+    ! Unlike conv_zone_FFTw, the full W(E) is never formed, so the dyn cleaning is not applied.
+    implicit none
+    integer, intent(in) :: DC, refvar, ionvar, nlp, nf
+    complex, intent(in) :: padFT_photarx(nec), padFT_photarx_delta(nec), padFT_photarx_dlogxi(nec)
+    complex, intent(in) :: padFT_band(nec,2)
+    complex, intent(in) :: ker_W0(nlp,nex,nf), ker_W1(nlp,nex,nf), ker_W2(nlp,nex,nf), ker_W3(nlp,nex,nf)
+    complex, intent(inout) :: BW(nlp,nf,0:3,2)
+    real    :: proj(nex,0:3,2)
+    integer :: ib, j, m, i
+    logical :: dok(0:3)
+
+    dok(0) = .true.
+    dok(1) = DC .eq. 0 .and. refvar .eq. 1
+    dok(2) = dok(1)
+    dok(3) = DC .eq. 0 .and. ionvar .eq. 1
+    do ib = 1,2
+       call band_projector(padFT_photarx,padFT_band(:,ib),proj(:,0,ib))
+       proj(:,1,ib) = proj(:,0,ib)
+       if (dok(2)) call band_projector(padFT_photarx_delta,padFT_band(:,ib),proj(:,2,ib))
+       if (dok(3)) call band_projector(padFT_photarx_dlogxi,padFT_band(:,ib),proj(:,3,ib))
+    end do
+    do ib = 1,2
+       do j = 1,nf
+          do m = 1,nlp
+             do i = 1,nex
+                BW(m,j,0,ib) = BW(m,j,0,ib) + ker_W0(m,i,j) * proj(i,0,ib)
+             end do
+             if (dok(1)) then
+                do i = 1,nex
+                   BW(m,j,1,ib) = BW(m,j,1,ib) + ker_W1(m,i,j) * proj(i,1,ib)
+                   BW(m,j,2,ib) = BW(m,j,2,ib) + ker_W2(m,i,j) * proj(i,2,ib)
+                end do
+             end if
+             if (dok(3)) then
+                do i = 1,nex
+                   BW(m,j,3,ib) = BW(m,j,3,ib) + ker_W3(m,i,j) * proj(i,3,ib)
+                end do
+             end if
+          end do
+       end do
+    end do
+
+  end subroutine conv_zone_bands
+
+  recursive subroutine band_projector(padFT_photarx,padFT_wband,proj)
+    ! proj(l) = sum_i wband(i) * photarx(i+nex/2-l): the weight of kernel bin l in the band
+    ! sum of the de-padded convolution of photarx with the kernel (see de_paddingFT).
+    ! This is the cross-correlation of the two padded arrays, at lag l-nex/2.
+    implicit none
+    complex, intent(in)  :: padFT_photarx(nec), padFT_wband(nec)
+    real   , intent(out) :: proj(nex)
+    integer :: l
+
+    in_conv = conjg(padFT_photarx) * padFT_wband * nexm1
+    call fftw_execute_dft_c2r(plan2, in_conv, out_conv)
+    do l = 1, nex
+       proj(l) = real( out_conv( modulo( l - nex/2 , nex_conv ) + 1 ) )
+    end do
+
+  end subroutine band_projector
+
+  recursive subroutine padding4FT_spectrum(photarx, padFT_photarx, DC)
+    ! Padded FT of a rest frame spectrum, as used by conv_one_FFTw:
+    ! the DC spectrum is extrapolated at low energies (padding4FT_xillver),
+    ! the spectra used for the lags are zero padded (padding4FT)
+    implicit none
+    integer, intent(in)  :: DC
+    real   , intent(in)  :: photarx(nex)
+    complex, intent(out) :: padFT_photarx(nec)
+
+    if (DC .eq. 1 ) then
+       call padding4FT_xillver(photarx,padFT_photarx)
+    else
+       call padding4FT(photarx,padFT_photarx)
+    endif
+
+  end subroutine padding4FT_spectrum
 
   subroutine conv_all_FFTw(dyn,photarx,photarx_delta,photarx_dlogxi,reline_w0,imline_w0,reline_w1,imline_w1,& 
        reline_w2,imline_w2,reline_w3,imline_w3,ReW0_conv,ImW0_conv,ReW1_conv,ImW1_conv,&
@@ -243,7 +741,7 @@ contains
 
   end subroutine conv_all_FFTw
 
-  subroutine padding4FT(line, padFT_line)
+  recursive subroutine padding4FT(line, padFT_line)
     implicit none 
     real           , intent(in)  :: line(nex)
     complex        , intent(out) :: padFT_line(nec)
@@ -271,7 +769,7 @@ contains
 
   end subroutine padding4FT
 
-  subroutine padding4FT_xillver(line, padFT_line)
+  recursive subroutine padding4FT_xillver(line, padFT_line)
     implicit none 
     real           , intent(in)  :: line(nex)
     complex        , intent(out) :: padFT_line(nec)
@@ -340,6 +838,477 @@ contains
 
 end module conv_mod
 
+module model_contexts
+  !Caches of genreltrans: kernels, convolved transfer functions, raw spectra and the
+  !parameters they were made for. Each context holds one full set, so evaluations that
+  !alternate between modes (e.g. a joint fit of the time-averaged spectrum and of lag
+  !spectra) or between parameter sets (walkers) stop throwing away each other's work.
+  !genreltrans swaps its context in at the start and out at the end (move_alloc and
+  !pointer swaps, no copies). The context is picked by ctx_select: the one set with
+  !tdsetctx (ctxpin>0, per thread), otherwise a free one last used for the same flavour
+  !and mode, else the least recently used free one of RELTRANS_NCTX (default 1).
+  !Besides the caches of genreltrans, a context holds the threadprivate module state
+  !that depends on the calls made before: the FFTW buffers of conv_mod, the ray-tracing
+  !products (dyn_gr camera and lamppost arrays, gr_continuum, kernel_pixels with
+  !pixparam), radial_grids, rf_cache, rebin_plans and the xillver rebinning weights.
+  !Each context has a lock, held from ctx_select to ctx_release, so evaluations on
+  !different threads run at the same time as long as they use different contexts, and
+  !give the same numbers as serial ones. What stays shared is read-only once loaded
+  !(FFTW plans, telematrix, xillver spectra, GR library), and is loaded under a named
+  !critical section.
+  use, intrinsic   :: iso_c_binding, only: c_ptr, c_null_ptr
+  use conv_mod      , only: nex
+  use dyn_gr        , only: dg_status => status_re_tau, dg_npts => npts, dg_re1 => re1, dg_taudo1 => taudo1, &
+                            dg_pem1 => pem1, dg_dcosdr => dcosdr, dg_cosd => cosd, dg_rlp => rlp, dg_tlp => tlp, &
+                            dg_spin => spinsav, dg_mu => musav, dg_rout => routsav, dg_mud => mudsav
+  use kernel_pixels , only: kp_npix => npix, kp_hit => pixhit, kp_g => pixg, kp_r => pixr, kp_mu => pixmu, &
+                            kp_tau => pixtau, kp_w => pixw, kp_param => pixparam
+  use gr_continuum  , only: gc_tauso => tauso, gc_gso => gso, gc_lens => lens, gc_cosd => cosdelta_obs
+  use radial_grids  , only: rg_logxir => logxir, rg_logner => logner, rg_gsdr => gsdr, rg_dfer => dfer_arr, &
+                            rg_pnorm => pnorm
+  use rf_cache      , only: rfc_size, rfc_ne, rfc_elo, rfc_ehi, rfc_key, rfc_used, rfc_spec, rfc_clock, &
+                            rfc_hits, rfc_misses
+  use rebin_plans   , only: rebinplan, plans, planused, planclock
+  use xillver_tables, only: xgrid_it, xgrid_ne, xgrid_ear, xgrid_woff, xgrid_wk, xgrid_w
+  use conv_mod      , only: a1, a2, a3, a4, a5, a6
+  !$ use omp_lib    , only: omp_lock_kind
+  implicit none
+  type ctx_state
+     !threadprivate module state of the context (see ctx_state_swap); defaults as in the modules
+     logical                                   :: status = .false.
+     integer         , pointer, contiguous     :: npts(:) => null()
+     double precision, pointer, contiguous     :: re1(:,:) => null(), taudo1(:,:) => null(), pem1(:,:) => null()
+     double precision, pointer, contiguous     :: dcosdr(:,:) => null(), cosd(:,:) => null()
+     double precision, pointer, contiguous     :: rlp(:,:) => null(), tlp(:,:) => null()
+     double precision                          :: spin = 2.d0, mu = 2.d0, rout = 0.d0, mud = 0.d0
+     integer                                   :: npix = 0
+     logical         , pointer, contiguous     :: pixhit(:) => null()
+     integer         , pointer, contiguous     :: pixg(:) => null(), pixr(:) => null(), pixmu(:) => null()
+     double precision, pointer, contiguous     :: pixtau(:,:) => null()
+     real            , pointer, contiguous     :: pixw(:,:,:) => null()
+     real                                      :: pixparam(32) = 0.0
+     double precision, pointer, contiguous     :: tauso(:) => null(), gso(:) => null()
+     double precision, pointer, contiguous     :: lens(:) => null(), cosdelta_obs(:) => null()
+     double precision, allocatable             :: logxir(:), logner(:), gsdr(:), dfer_arr(:)
+     double precision                          :: pnorm = 0.d0
+     integer                                   :: rfc_size = -1, rfc_ne = -1
+     real                                      :: rfc_elo = 0.0, rfc_ehi = 0.0
+     integer(kind=8) , allocatable             :: rfc_key(:,:), rfc_used(:)
+     real            , allocatable             :: rfc_spec(:,:)
+     integer(kind=8)                           :: rfc_clock = 0, rfc_hits = 0, rfc_misses = 0
+     type(rebinplan) , allocatable             :: plans(:)
+     integer         , allocatable             :: planused(:)
+     integer                                   :: planclock = 0
+     integer                                   :: xgrid_it = 0, xgrid_ne = -1
+     real            , allocatable             :: xgrid_ear(:), xgrid_w(:)
+     integer         , allocatable             :: xgrid_woff(:), xgrid_wk(:)
+     type(c_ptr)                               :: a(6) = c_null_ptr
+  end type ctx_state
+  type reltrans_ctx
+     real                 :: key(6) = 0.0
+     complex, allocatable :: ker_W0(:,:,:,:,:), ker_W1(:,:,:,:,:), ker_W2(:,:,:,:,:), ker_W3(:,:,:,:,:)
+     real   , allocatable :: ReW0(:,:,:), ImW0(:,:,:), ReW1(:,:,:), ImW1(:,:,:)
+     real   , allocatable :: ReW2(:,:,:), ImW2(:,:,:), ReW3(:,:,:), ImW3(:,:,:)
+     real   , allocatable :: ReSraw(:,:), ImSraw(:,:), ReSrawa(:,:), ImSrawa(:,:)
+     real   , allocatable :: ReGrawa(:,:), ImGrawa(:,:), ReG(:,:), ImG(:,:)
+     complex, allocatable :: BW(:,:,:,:)
+     real                 :: paramsave(32) = 0.0, wbandsave(nex,2) = 0.0
+     double precision     :: fhisave = 0.d0, flosave = 0.d0
+     integer              :: nfsave = -1, nfasave = -1, Cpsave = 2
+     logical              :: bandsave = .false.
+     double precision, allocatable :: frobs(:), frrel(:)   !reflection fractions of the last rtrans call
+     type(ctx_state)      :: st
+  end type reltrans_ctx
+  type(reltrans_ctx), allocatable :: ctx(:)
+  integer(kind=8)   , allocatable :: ctxused(:)
+  integer           , allocatable :: ctxbusy(:)      !evaluations holding or waiting for the context
+  !$ integer(omp_lock_kind), allocatable :: ctxlock(:)
+  integer(kind=8)                 :: ctxclock = 0
+  integer                         :: nctx = -1, ctxpin = 0
+  !$omp threadprivate(ctxpin)
+
+contains
+
+  recursive subroutine ctx_select(Cp,dset,nlp,param,ic)
+    !Index ic of the context to use for this call (see the module header). The context
+    !is locked on return: the caller must hand it back with ctx_release
+    !$ use omp_lib
+    implicit none
+    integer, intent(in)  :: Cp, dset, nlp
+    real   , intent(in)  :: param(32)
+    integer, intent(out) :: ic
+    real                 :: key(6)
+    integer              :: k
+    key = (/ real(Cp), real(dset), real(nlp), param(23), param(24), param(25) /)
+    call ctx_init()
+    !$omp critical (reltrans_ctx)
+    ctxclock = ctxclock + 1
+    if( ctxpin .gt. 0 )then
+       ic = ctxpin
+    else
+       !free context with the same key, else the least recently used free one,
+       !else (all busy) the least recently used one, waiting for it below
+       ic = 0
+       do k = 1, nctx
+          if( ctxbusy(k) .eq. 0 .and. ctxused(k) .gt. 0 .and. all( ctx(k)%key .eq. key ) )then
+             ic = k
+             exit
+          end if
+       end do
+       if( ic .eq. 0 .and. any( ctxbusy .eq. 0 ) ) ic = minloc( ctxused, 1, mask = ctxbusy .eq. 0 )
+       if( ic .eq. 0 ) ic = minloc( ctxused, 1 )
+    end if
+    ctx(ic)%key = key
+    ctxused(ic) = ctxclock
+    ctxbusy(ic) = ctxbusy(ic) + 1
+    !$omp end critical (reltrans_ctx)
+    !$ call omp_set_lock( ctxlock(ic) )
+    return
+  end subroutine ctx_select
+
+  recursive subroutine ctx_init()
+    !Sets up the RELTRANS_NCTX contexts and their locks, on the first call
+    !$ use omp_lib
+    implicit none
+    integer              :: k, get_env_int
+    !$omp critical (reltrans_ctx)
+    if( nctx .lt. 0 )then
+       nctx = max( get_env_int("RELTRANS_NCTX",1) , 1 )
+       allocate( ctx(nctx), ctxused(nctx), ctxbusy(nctx) )
+       ctxused = 0
+       ctxbusy = 0
+       !$ allocate( ctxlock(nctx) )
+       !$ do k = 1, nctx
+       !$    call omp_init_lock( ctxlock(k) )
+       !$ end do
+    end if
+    !$omp end critical (reltrans_ctx)
+    return
+  end subroutine ctx_init
+
+  recursive subroutine ctx_release(ic)
+    !Unlocks context ic, taken by ctx_select
+    !$ use omp_lib
+    implicit none
+    integer, intent(in) :: ic
+    !$omp critical (reltrans_ctx)
+    ctxbusy(ic) = ctxbusy(ic) - 1
+    !$omp end critical (reltrans_ctx)
+    !$ call omp_unset_lock( ctxlock(ic) )
+    return
+  end subroutine ctx_release
+
+  recursive subroutine ctx_swap(ic,ker_W0,ker_W1,ker_W2,ker_W3,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
+                      ReSraw,ImSraw,ReSrawa,ImSrawa,ReGrawa,ImGrawa,ReG,ImG,BW,&
+                      paramsave,fhisave,flosave,nfsave,nfasave,Cpsave,bandsave,wbandsave,frobs,frrel)
+    !Exchanges the state of genreltrans, and the threadprivate module state of the calling
+    !thread, with that of context ic. Called once to bring the context in and once more to
+    !put it back, so the caches only ever live in a context
+    implicit none
+    integer, intent(in)    :: ic
+    complex, allocatable   :: ker_W0(:,:,:,:,:), ker_W1(:,:,:,:,:), ker_W2(:,:,:,:,:), ker_W3(:,:,:,:,:)
+    real   , allocatable   :: ReW0(:,:,:), ImW0(:,:,:), ReW1(:,:,:), ImW1(:,:,:)
+    real   , allocatable   :: ReW2(:,:,:), ImW2(:,:,:), ReW3(:,:,:), ImW3(:,:,:)
+    real   , allocatable   :: ReSraw(:,:), ImSraw(:,:), ReSrawa(:,:), ImSrawa(:,:)
+    real   , allocatable   :: ReGrawa(:,:), ImGrawa(:,:), ReG(:,:), ImG(:,:)
+    complex, allocatable   :: BW(:,:,:,:)
+    real   , intent(inout) :: paramsave(32), wbandsave(nex,2)
+    double precision, intent(inout) :: fhisave, flosave
+    integer, intent(inout) :: nfsave, nfasave, Cpsave
+    logical, intent(inout) :: bandsave
+    double precision, allocatable :: frobs(:), frrel(:)
+    real                   :: rtmp(32), wtmp(nex,2)
+    double precision       :: dtmp
+    integer                :: itmp
+    logical                :: ltmp
+    call swap_c5( ker_W0, ctx(ic)%ker_W0 )
+    call swap_c5( ker_W1, ctx(ic)%ker_W1 )
+    call swap_c5( ker_W2, ctx(ic)%ker_W2 )
+    call swap_c5( ker_W3, ctx(ic)%ker_W3 )
+    call swap_r3( ReW0, ctx(ic)%ReW0 )
+    call swap_r3( ImW0, ctx(ic)%ImW0 )
+    call swap_r3( ReW1, ctx(ic)%ReW1 )
+    call swap_r3( ImW1, ctx(ic)%ImW1 )
+    call swap_r3( ReW2, ctx(ic)%ReW2 )
+    call swap_r3( ImW2, ctx(ic)%ImW2 )
+    call swap_r3( ReW3, ctx(ic)%ReW3 )
+    call swap_r3( ImW3, ctx(ic)%ImW3 )
+    call swap_r2( ReSraw , ctx(ic)%ReSraw  )
+    call swap_r2( ImSraw , ctx(ic)%ImSraw  )
+    call swap_r2( ReSrawa, ctx(ic)%ReSrawa )
+    call swap_r2( ImSrawa, ctx(ic)%ImSrawa )
+    call swap_r2( ReGrawa, ctx(ic)%ReGrawa )
+    call swap_r2( ImGrawa, ctx(ic)%ImGrawa )
+    call swap_r2( ReG    , ctx(ic)%ReG     )
+    call swap_r2( ImG    , ctx(ic)%ImG     )
+    call swap_c4( BW, ctx(ic)%BW )
+    rtmp = paramsave
+    paramsave = ctx(ic)%paramsave
+    ctx(ic)%paramsave = rtmp
+    wtmp = wbandsave
+    wbandsave = ctx(ic)%wbandsave
+    ctx(ic)%wbandsave = wtmp
+    dtmp = fhisave
+    fhisave = ctx(ic)%fhisave
+    ctx(ic)%fhisave = dtmp
+    dtmp = flosave
+    flosave = ctx(ic)%flosave
+    ctx(ic)%flosave = dtmp
+    itmp = nfsave
+    nfsave = ctx(ic)%nfsave
+    ctx(ic)%nfsave = itmp
+    itmp = nfasave
+    nfasave = ctx(ic)%nfasave
+    ctx(ic)%nfasave = itmp
+    itmp = Cpsave
+    Cpsave = ctx(ic)%Cpsave
+    ctx(ic)%Cpsave = itmp
+    ltmp = bandsave
+    bandsave = ctx(ic)%bandsave
+    ctx(ic)%bandsave = ltmp
+    call swap_d1( frobs, ctx(ic)%frobs )
+    call swap_d1( frrel, ctx(ic)%frrel )
+    call ctx_state_swap( ctx(ic)%st )
+    return
+  end subroutine ctx_swap
+
+  recursive subroutine ctx_state_swap(st)
+    !Exchanges the threadprivate module state of the calling thread with st
+    implicit none
+    type(ctx_state), intent(inout) :: st
+    integer                        :: k
+    call swap_l( dg_status, st%status )
+    call swap_pi1( dg_npts, st%npts )
+    call swap_pd2( dg_re1   , st%re1    )
+    call swap_pd2( dg_taudo1, st%taudo1 )
+    call swap_pd2( dg_pem1  , st%pem1   )
+    call swap_pd2( dg_dcosdr, st%dcosdr )
+    call swap_pd2( dg_cosd  , st%cosd   )
+    call swap_pd2( dg_rlp   , st%rlp    )
+    call swap_pd2( dg_tlp   , st%tlp    )
+    call swap_d( dg_spin, st%spin )
+    call swap_d( dg_mu  , st%mu   )
+    call swap_d( dg_rout, st%rout )
+    call swap_d( dg_mud , st%mud  )
+    call swap_i( kp_npix, st%npix )
+    call swap_pl1( kp_hit, st%pixhit )
+    call swap_pi1( kp_g  , st%pixg   )
+    call swap_pi1( kp_r  , st%pixr   )
+    call swap_pi1( kp_mu , st%pixmu  )
+    call swap_pd2( kp_tau, st%pixtau )
+    call swap_pr3( kp_w  , st%pixw   )
+    do k = 1, 32
+       call swap_r( kp_param(k), st%pixparam(k) )
+    end do
+    call swap_pd1( gc_tauso, st%tauso )
+    call swap_pd1( gc_gso  , st%gso   )
+    call swap_pd1( gc_lens , st%lens  )
+    call swap_pd1( gc_cosd , st%cosdelta_obs )
+    call swap_d1( rg_logxir, st%logxir )
+    call swap_d1( rg_logner, st%logner )
+    call swap_d1( rg_gsdr  , st%gsdr   )
+    call swap_d1( rg_dfer  , st%dfer_arr )
+    call swap_d( rg_pnorm, st%pnorm )
+    call swap_i( rfc_size, st%rfc_size )
+    call swap_i( rfc_ne  , st%rfc_ne   )
+    call swap_r( rfc_elo , st%rfc_elo  )
+    call swap_r( rfc_ehi , st%rfc_ehi  )
+    call swap_k2( rfc_key , st%rfc_key  )
+    call swap_k1( rfc_used, st%rfc_used )
+    call swap_r2( rfc_spec, st%rfc_spec )
+    call swap_k( rfc_clock , st%rfc_clock  )
+    call swap_k( rfc_hits  , st%rfc_hits   )
+    call swap_k( rfc_misses, st%rfc_misses )
+    call swap_plans( plans, st%plans )
+    call swap_i1( planused, st%planused )
+    call swap_i( planclock, st%planclock )
+    call swap_i( xgrid_it, st%xgrid_it )
+    call swap_i( xgrid_ne, st%xgrid_ne )
+    call swap_r1( xgrid_ear , st%xgrid_ear  )
+    call swap_i1( xgrid_woff, st%xgrid_woff )
+    call swap_i1( xgrid_wk  , st%xgrid_wk   )
+    call swap_r1( xgrid_w   , st%xgrid_w    )
+    call swap_cp( a1, st%a(1) )
+    call swap_cp( a2, st%a(2) )
+    call swap_cp( a3, st%a(3) )
+    call swap_cp( a4, st%a(4) )
+    call swap_cp( a5, st%a(5) )
+    call swap_cp( a6, st%a(6) )
+    return
+  end subroutine ctx_state_swap
+
+  recursive subroutine swap_c5(a,b)
+    implicit none
+    complex, allocatable :: a(:,:,:,:,:), b(:,:,:,:,:), t(:,:,:,:,:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_c5
+
+  recursive subroutine swap_c4(a,b)
+    implicit none
+    complex, allocatable :: a(:,:,:,:), b(:,:,:,:), t(:,:,:,:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_c4
+
+  recursive subroutine swap_r3(a,b)
+    implicit none
+    real, allocatable :: a(:,:,:), b(:,:,:), t(:,:,:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_r3
+
+  recursive subroutine swap_r2(a,b)
+    implicit none
+    real, allocatable :: a(:,:), b(:,:), t(:,:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_r2
+
+  recursive subroutine swap_r1(a,b)
+    implicit none
+    real, allocatable :: a(:), b(:), t(:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_r1
+
+  recursive subroutine swap_d1(a,b)
+    implicit none
+    double precision, allocatable :: a(:), b(:), t(:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_d1
+
+  recursive subroutine swap_i1(a,b)
+    implicit none
+    integer, allocatable :: a(:), b(:), t(:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_i1
+
+  recursive subroutine swap_k1(a,b)
+    implicit none
+    integer(kind=8), allocatable :: a(:), b(:), t(:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_k1
+
+  recursive subroutine swap_k2(a,b)
+    implicit none
+    integer(kind=8), allocatable :: a(:,:), b(:,:), t(:,:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_k2
+
+  recursive subroutine swap_plans(a,b)
+    implicit none
+    type(rebinplan), allocatable :: a(:), b(:), t(:)
+    call move_alloc( a, t )
+    call move_alloc( b, a )
+    call move_alloc( t, b )
+  end subroutine swap_plans
+
+  !the pointer versions: the arrays stay where they are, only the pointers change hands
+  recursive subroutine swap_pd2(a,b)
+    implicit none
+    double precision, pointer, contiguous :: a(:,:), b(:,:), t(:,:)
+    t => a
+    a => b
+    b => t
+  end subroutine swap_pd2
+
+  recursive subroutine swap_pd1(a,b)
+    implicit none
+    double precision, pointer, contiguous :: a(:), b(:), t(:)
+    t => a
+    a => b
+    b => t
+  end subroutine swap_pd1
+
+  recursive subroutine swap_pi1(a,b)
+    implicit none
+    integer, pointer, contiguous :: a(:), b(:), t(:)
+    t => a
+    a => b
+    b => t
+  end subroutine swap_pi1
+
+  recursive subroutine swap_pl1(a,b)
+    implicit none
+    logical, pointer, contiguous :: a(:), b(:), t(:)
+    t => a
+    a => b
+    b => t
+  end subroutine swap_pl1
+
+  recursive subroutine swap_pr3(a,b)
+    implicit none
+    real, pointer, contiguous :: a(:,:,:), b(:,:,:), t(:,:,:)
+    t => a
+    a => b
+    b => t
+  end subroutine swap_pr3
+
+  !and the scalars
+  recursive subroutine swap_i(a,b)
+    implicit none
+    integer :: a, b, t
+    t = a
+    a = b
+    b = t
+  end subroutine swap_i
+
+  recursive subroutine swap_k(a,b)
+    implicit none
+    integer(kind=8) :: a, b, t
+    t = a
+    a = b
+    b = t
+  end subroutine swap_k
+
+  recursive subroutine swap_r(a,b)
+    implicit none
+    real :: a, b, t
+    t = a
+    a = b
+    b = t
+  end subroutine swap_r
+
+  recursive subroutine swap_d(a,b)
+    implicit none
+    double precision :: a, b, t
+    t = a
+    a = b
+    b = t
+  end subroutine swap_d
+
+  recursive subroutine swap_l(a,b)
+    implicit none
+    logical :: a, b, t
+    t = a
+    a = b
+    b = t
+  end subroutine swap_l
+
+  recursive subroutine swap_cp(a,b)
+    implicit none
+    type(c_ptr) :: a, b, t
+    t = a
+    a = b
+    b = t
+  end subroutine swap_cp
+
+end module model_contexts
+
 
 
 
@@ -380,7 +1349,7 @@ end module conv_mod
 
       contains
 !*********************************************************************************************
-      subroutine root3(b,c,d,r1,r2,r3,del)
+      recursive subroutine root3(b,c,d,r1,r2,r3,del)
 !********************************************************************
 !* PURPOSE:  This subroutine aim on solving cubic equations: x^3+b*x^2+c*x+d=0.
 !* INPUTS:    b, c, d-----they are the coefficients of equation. 
@@ -424,6 +1393,8 @@ end module conv_mod
           y1  = u + v
           y2r = -(u+v)/two
           y2i =  (u-v)*sqrt(3.D0)/two
+          y2  = 0.D0
+          y3  = 0.D0
       endif
 ! Step 4: Final transformation -----------------------------------------
       temp1 = b/a/3.D0
@@ -453,7 +1424,7 @@ end module conv_mod
       return
       end subroutine root3       
 !*********************************************************************************************
-      subroutine root4(b,c,d,e,r1,r2,r3,r4,reals)
+      recursive subroutine root4(b,c,d,e,r1,r2,r3,r4,reals)
 !********************************************************************************************* 
       !* PURPOSE:  This subroutine aim on solving quartic equations: x^4+b*x^3+c*x^2+d*x+e=0.
       !* INPUTS:    b, c, d, e-----they are the coefficients of equation. 
@@ -525,7 +1496,7 @@ end module conv_mod
       return
       end subroutine root4
 !*********************************************************************************************
-      subroutine sort(a1,a2,a3,s1,s2,s3)
+      recursive subroutine sort(a1,a2,a3,s1,s2,s3)
 !********************************************************************
 !* PURPOSE:  This subroutine aim on sorting a1, a2, a3 by decreasing way.
 !* INPUTS:    a1,a2,a3----they are the number list required to bo sorted. 
@@ -575,7 +1546,7 @@ end module conv_mod
 
       contains
 !***************************************************************************
-      Double precision function weierstrassP(z,g2,g3,r1,del)
+      recursive Double precision function weierstrassP(z,g2,g3,r1,del)
 !***************************************************************************
 !*    PURPOSE:   to compute Weierstrass' elliptical function \wp(z;g_2,g_3) and all of 
 !*               this function involved are real numbers.   
@@ -629,7 +1600,7 @@ end module conv_mod
       return
       end function weierstrassP
 !*************************************************************************************************
-      Function halfperiodwp(r1,del)
+      recursive Function halfperiodwp(r1,del)
 !************************************************************************************************* 
 !*    PURPOSE:   to compute the semi period of Weierstrass' elliptical function \wp(z;g_2,g_3) and all of 
 !*               this function involved are real numbers.   
@@ -703,7 +1674,7 @@ end module conv_mod
 !       return
 !       End Function halfperiodwp
 !*************************************************************************************************
-      subroutine sncndn(uu,emmc,sn,cn,dn)
+      recursive subroutine sncndn(uu,emmc,sn,cn,dn)
 !************************************************************************************************* 
 !*    PURPOSE:   Returns the Jacobian elliptic functions sn(u|k^2), cn(u|k^2), 
 !*            and dn(u|k^2). Here uu=u, while emmc=1-k^2. 
@@ -720,6 +1691,7 @@ end module conv_mod
 
       emc=emmc
       u=uu
+      d=1.D0
       if(emc.ne.0.D0)then
           bo=(emc.lt.0.D0)        
           if(bo)then
@@ -777,7 +1749,7 @@ end module conv_mod
       end if
       end subroutine sncndn
 !*************************************************************************************************
-      Double precision FUNCTION rf(x,y,z) 
+      recursive Double precision FUNCTION rf(x,y,z) 
 !*************************************************************************************************
 !*     PURPOSE: Compute Carlson fundamental integral RF
 !*              R_F=1/2 \int_0^\infty dt (t+x)^(-1/2) (t+y)^(-1/2) (t+z)^(-1/2)
@@ -837,7 +1809,7 @@ end module conv_mod
       return      
       end Function rf
 !************************************************************************ 
-      Double precision FUNCTION rj(x,y,z,p) 
+      recursive Double precision FUNCTION rj(x,y,z,p) 
 !************************************************************************ 
 !*     PURPOSE: Compute Carlson fundamental integral RJ
 !*     RJ(x,y,z,p) = 3/2 \int_0^\infty dt
@@ -935,7 +1907,7 @@ end module conv_mod
       return
       end Function rj
 !************************************************************************ 
-      FUNCTION rc(x,y)
+      recursive FUNCTION rc(x,y)
 !************************************************************************
 !*     PURPOSE: Compute Carlson degenerate integral RC
 !*              R_C(x,y)=1/2 \int_0^\infty dt (t+x)^(-1/2) (t+y)^(-1)
@@ -985,7 +1957,7 @@ end module conv_mod
       return
       END FUNCTION rc
 !**********************************************************************
-      FUNCTION rd(x,y,z)
+      recursive FUNCTION rd(x,y,z)
 !**********************************************************************
 !*     PURPOSE: Compute Carlson degenerate integral RD
 !*              R_D(x,y,z)=3/2 \int_0^\infty dt (t+x)^(-1/2) (t+y)^(-1/2) (t+z)^(-3/2)
@@ -1054,7 +2026,7 @@ end module conv_mod
             return
       END function rd
 !******************************************************************* 
-      Function EllipticF(t,k2)
+      recursive Function EllipticF(t,k2)
 !******************************************************************* 
 !*     PURPOSE: calculate Legendre's first kind elliptic integral: 
 !*              F(t,k2)=\int_0^t dt/sqrt{(1-t^2)*(1-k2*t^2)}.  
@@ -1075,7 +2047,7 @@ end module conv_mod
       return
       end function EllipticF       
 !********************************************************************* 
-      Function EllipticE(t,k2)
+      recursive Function EllipticE(t,k2)
 !********************************************************************* 
 !*     PURPOSE: calculate Legendre's second kind elliptic integrals: 
 !*              E(t,k2)=\int_0^t sqrt{1-k2*t^2}/sqrt{(1-t^2)}dt.
@@ -1096,7 +2068,7 @@ end module conv_mod
       return
       end function EllipticE
 !*********************************************************************** 
-      Function EllipticPI(t,n,k2)
+      recursive Function EllipticPI(t,n,k2)
 !*********************************************************************** 
 !*     PURPOSE: calculate Legendre's third kind elliptic integrals: 
 !*              PI(t,n,k2)=\int_0^t /(1+nt^2)/sqrt{(1-k2*t^2)(1-t^2)}dt. 
@@ -1118,7 +2090,7 @@ end module conv_mod
       return
       end function EllipticPI
 !*************************************************************************************************
-      subroutine weierstrass_int_J3(y,x,bb,del,a4,b4,p4,rff_p,integ,cases)
+      recursive subroutine weierstrass_int_J3(y,x,bb,del,a4,b4,p4,rff_p,integ,cases)
 !*************************************************************************************************
 !*     PURPOSE: Computes integrals: J_k(h)=\int^x_y (b4*t+a4)^(k/2)*(4*t^3-g_2*t-g_3)^(-1/2)dt.
 !*              Where integer index k can be 0, -2, -4 and 2. (75) and (76) of Yang & Wang (2012).   
@@ -1213,7 +2185,7 @@ end module conv_mod
       return
       end subroutine weierstrass_int_J3
 !**********************************************************************************************
-      subroutine carlson_doublecomplex5(y,x,f1,g1,h1,f2,g2,h2,a5,b5,p5,rff_p,integ,cases)
+      recursive subroutine carlson_doublecomplex5(y,x,f1,g1,h1,f2,g2,h2,a5,b5,p5,rff_p,integ,cases)
 !**********************************************************************************************    
 !*     PURPOSE: Computes integrals: J_k(h)=\int^x_y (b5*r+a5)^(k/2)*[(h1*r^2+g1*r+f1)(h2*r^2+g2*r+f2)]^(-1/2)dr.
 !*              Where integer index k can be 0, -2, -4, 2 and 4. (77) of Yang & Wang (2012).   
@@ -1277,7 +2249,7 @@ end module conv_mod
       return
       end subroutine carlson_doublecomplex5
 !*******************************************************************************
-      subroutine ellcubicreals(index_p4,a1,b1,a2,b2,a3,b3,a4,b4,y,x,rff_p,integ,cases)
+      recursive subroutine ellcubicreals(index_p4,a1,b1,a2,b2,a3,b3,a4,b4,y,x,rff_p,integ,cases)
 !*******************************************************************************
 !*     PURPOSE: Computes J_k(h)=\int_y^x dt (b4*t+a4)^(k/2)[(b1*t+a1)*(b2*t+a2)*(b3*t+a3)]^{-1/2}. 
 !*              It is the case of equation W(t)=4*t^3-g_2*t-g_3=0 has three real roots. 
@@ -1393,7 +2365,7 @@ end module conv_mod
       return
       end  subroutine ellcubicreals
 !*******************************************************************************
-      subroutine ellcubiccomplexs(index_p4,a1,b1,a4,b4,f,g,h,y,x,rff_p,integ,cases)
+      recursive subroutine ellcubiccomplexs(index_p4,a1,b1,a4,b4,f,g,h,y,x,rff_p,integ,cases)
 !*******************************************************************************
 !*     PURPOSE: Computes J_k(h)=\int_y^x dt (b4*t+a4)^(k/2)[(b1*t+a1)*(h*t^2+g*t+f)]^{-1/2}. 
 !*              It is the case of equation W(t)=4*t^3-g_2*t-g_3=0 has one real root. 
@@ -1515,7 +2487,7 @@ end module conv_mod
       return
       end  subroutine ellcubiccomplexs
 !********************************************************************************************
-      subroutine  elldoublecomplexs(index_p5,f1,g1,h1,f2,g2,h2,a5,b5,y,x,rff_p,integ,cases)
+      recursive subroutine  elldoublecomplexs(index_p5,f1,g1,h1,f2,g2,h2,a5,b5,y,x,rff_p,integ,cases)
 !*******************************************************************************
 !*     PURPOSE: Computes J_k(h)=\int_y^x dt (f_1+g_1t+h_1t^2)^{p_1/2} 
 !*                       (f_2+g_2t+h_2t^2)^{p_2/2} (a_5+b_5t)^{p_5/2}. 
@@ -1544,6 +2516,7 @@ end module conv_mod
       three=3.D0
       four=4.D0
       six=6.D0
+      ellquartic=0.D0
       !c (2.1) Carlson (1992)
       If(x.lt.infinity)then
           xi1=sqrt(f1+g1*x+h1*x**two)
@@ -1750,7 +2723,7 @@ end module conv_mod
 
       contains
 !******************************************************************************************** 
-      SUBROUTINE YNOGK(p,f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,&
+      recursive SUBROUTINE YNOGK(p,f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,&
                         radi,mu,phi,time,sigma) 
 !********************************************************************************************
 !*     PURPOSE:  Computes four Boyer-Lindquist coordinates (r,\mu,\phi,t) and affine parameter 
@@ -1855,7 +2828,7 @@ end module conv_mod
       END SUBROUTINE YNOGK
 
 !============================================================================================
-      Function mucos(p,f12343,f12342,lambda,q,sinobs,muobs,a_spin,scal)
+      recursive Function mucos(p,f12343,f12342,lambda,q,sinobs,muobs,a_spin,scal)
 !============================================================================================
 !*     PURPOSE:  Computes function \mu(p) defined by equation (32) in Yang & Wang (2012). That is
 !*               \mu(p)=b0/(4*\wp(p+PI0;g_2,g_3)-b1)+\mu_tp1. \wp(p+PI0;g_2,g_3) is the Weierstrass'
@@ -1885,6 +2858,9 @@ end module conv_mod
       logical :: mobseqmtp
       save  f12343_1,f12342_1,lambda_1,q_1,sinobs_1,muobs_1,a_spin_1,scal_1,&
                 mu_tp,b0,b1,b2,b3,g2,g3,dd,fzero,count_num,AA,BB,del
+      !$omp threadprivate(f12343_1,f12342_1,lambda_1,q_1,sinobs_1,muobs_1,a_spin_1,scal_1,&
+      !$omp& mu_tp,b0,b1,b2,b3,g2,g3,dd,&
+      !$omp& fzero,count_num,AA,BB,del)
       parameter (zero=0.D0,two=2.0D0,four=4.D0,one=1.D0,three=3.D0)
 
 10    continue
@@ -2002,7 +2978,7 @@ end module conv_mod
       end Function mucos
 
 !********************************************************************************************
-      Function radius(p,f1234r,lambda,q,a_spin,robs,scal)
+      recursive Function radius(p,f1234r,lambda,q,a_spin,robs,scal)
 !============================================================================================
 !*     PURPOSE:  Computes function r(p) defined by equation (41) and (49) in Yang & Wang (2012). That is
 !*               r(p)=b0/(4*\wp(p+PIr;g_2,g_3)-b1)+r_tp1. \wp(p+PIr;g_2,g_3) is the Weierstrass'
@@ -2034,6 +3010,12 @@ end module conv_mod
                 robs_eq_rtp,indrhorizon,cases,bb,rhorizon,b0,b1,b2,b3,g2,g3,dd,del,cc,tinf,tp2,&
                 thorizon,tinf1,PI0,u,w,v,L1,L2,m2,t_inf,pinf,a4,b4,PI0_total,PI0_inf_obs,PI0_obs_hori,&
                 PI0_total_2
+      !$omp threadprivate(f1234r_1,lambda_1,q_1,a_spin_1,robs_1,scal_1,r_tp1,r_tp2,&
+      !$omp& reals,robs_eq_rtp,indrhorizon,cases,bb,rhorizon,b0,b1,&
+      !$omp& b2,b3,g2,g3,dd,del,cc,tinf,&
+      !$omp& tp2,thorizon,tinf1,PI0,u,w,v,L1,&
+      !$omp& L2,m2,t_inf,pinf,a4,b4,PI0_total,PI0_inf_obs,&
+      !$omp& PI0_obs_hori,PI0_total_2,count_num)
 
  20   continue
       If(count_num.eq.1)then
@@ -2397,7 +3379,7 @@ end module conv_mod
       End function radius
 
 !********************************************************************************************
-      Function phi(p,f1234,lambda,q,sinobs,muobs,a_spin,robs,scal)
+      recursive Function phi(p,f1234,lambda,q,sinobs,muobs,a_spin,robs,scal)
 !********************************************************************************************
 !*     PURPOSE:  Computes function \phi(p). 
 !*     INPUTS:   p--------------independent variable, which must be nonnegative.  
@@ -2488,7 +3470,7 @@ end module conv_mod
       End Function phi
 
 !********************************************************************************************
-     SUBROUTINE GEOKERR(p_int,rp,mup,varble,f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,&
+     recursive SUBROUTINE GEOKERR(p_int,rp,mup,varble,f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,&
                         tr1,tr2,tm1,tm2,radi,mu,time,phi,sigma) 
 !********************************************************************************************
 !*     PURPOSE:  Computes four Boyer-Lindquist coordinates (r,\mu,\phi,t) and affine parameter 
@@ -2612,7 +3594,7 @@ end module conv_mod
       END SUBROUTINE GEOKERR
 
 !**************************************************
-      Function rms(a_spin)                       
+      recursive Function rms(a_spin)                       
 !**************************************************
 !*     PURPOSE: Computes inner most stable circular orbit r_{ms}. 
 !*     INPUTS:   a_spin ---- Spin of black hole, on interval [-1,1].
@@ -2645,7 +3627,7 @@ end module conv_mod
       end function rms
 
 !*********************************************************** 
-      Function rph(a_spin)
+      recursive Function rph(a_spin)
 !***********************************************************
 !*     PURPOSE: Computes photon orbit of circluar orbits: r_{ph}. 
 !*     INPUTS:   a_spin ---- Spin of black hole, on interval [-1,1].
@@ -2662,7 +3644,7 @@ end module conv_mod
       End function  rph      
 
 !************************************************************* 
-      Function rmb(a_spin)
+      recursive Function rmb(a_spin)
 !*************************************************************
 !*     PURPOSE: Computes marginally bound orbit of circluar orbits: r_{mb}. 
 !*     INPUTS:   a_spin ---- Spin of black hole, on interval [-1,1].
@@ -2679,7 +3661,7 @@ end module conv_mod
       End function  rmb      
 
 !********************************************************************************************
-      subroutine mutp(f12342,f12343,sinobs,muobs,a_spin,lambda,q,mu_tp1,mu_tp2,reals,mobseqmtp)
+      recursive subroutine mutp(f12342,f12343,sinobs,muobs,a_spin,lambda,q,mu_tp1,mu_tp2,reals,mobseqmtp)
 !********************************************************************************************
 !*     PURPOSE: Returns the coordinates of turning points \mu_tp1 and \mu_tp2 of poloidal motion, judges
 !*                whether the initial poloidal angle \theta_{obs} is one of turning points, if 
@@ -2779,7 +3761,7 @@ end module conv_mod
       end subroutine mutp      
 
 !============================================================================================
-      Subroutine radiustp(f12341,a_spin,robs,lambda,q,r_tp1,&
+      recursive Subroutine radiustp(f12341,a_spin,robs,lambda,q,r_tp1,&
                         r_tp2,reals,robs_eq_rtp,indrhorizon,cases,bb)
 !********************************************************************************************
 !*     PURPOSE: Returns the coordinates of turning points r_tp1 and r_tp2 of radial motion, judges
@@ -2911,7 +3893,7 @@ end module conv_mod
       End Subroutine radiustp
 
 !********************************************************************************************  
-      Function mu2p(f12343,f12342,lambda,q,mu,sinobs,muobs,a_spin,t1,t2,scal)
+      recursive Function mu2p(f12343,f12342,lambda,q,mu,sinobs,muobs,a_spin,t1,t2,scal)
 !********************************************************************************************
 !*     PURPOSE:  Computes the value of parameter p from \mu coordinate. In other words, to compute 
 !*               the \mu part of integral of equation (24), using formula (54) in Yang & Wang (2012).
@@ -3028,7 +4010,7 @@ end module conv_mod
       end Function mu2p
 
 !============================================================================================
-      subroutine mu2p_schwartz(f12343,f12342,lambda,q,mu,sinobs,muobs,t1,t2,mu2p,scal)
+      recursive subroutine mu2p_schwartz(f12343,f12342,lambda,q,mu,sinobs,muobs,t1,t2,mu2p,scal)
 !********************************************************************************************
 !*     PURPOSE:  Computes the value of parameter p from \mu coordinate. In other words, to compute 
 !*               the \mu part of integral of equation (24), using formula (54) in Yang & Wang (2012).
@@ -3101,7 +4083,7 @@ end module conv_mod
       return
       end subroutine mu2p_schwartz
 !********************************************************************************************
-      Function r2p(f1234r,rend,lambda,q,a_spin,robs,scal,t1,t2)
+      recursive Function r2p(f1234r,rend,lambda,q,a_spin,robs,scal,t1,t2)
 !============================================================================================
 !*     PURPOSE:  Computes the value of parameter p from radial coordinate. In other words, to compute 
 !*               the r part of integral of equation (24), using formula (58) in Yang & Wang (2012).
@@ -3210,9 +4192,11 @@ end module conv_mod
                     else
                         If(rend.lt.infinity)then
                             call weierstrass_int_J3(tinf,tp,dd,del,a4,b4,index_p4,rff_p,integ04,cases_int)        
+                            pp=integ04(1)
                             r2p=-pp
                         else
                             call weierstrass_int_J3(tinf,tinf1,dd,del,a4,b4,index_p4,rff_p,integ04,cases_int)        
+                            pp=integ04(1)
                             r2p=-pp        
                         endif
                     endif                 
@@ -3361,7 +4345,7 @@ end module conv_mod
       End function r2p 
 
 !********************************************************************************************
-      SUBROUTINE INTTPART(p,f12343,f12342,lambda,q,sinobs,muobs,a_spin,scal,phyt,timet,mucos,t1,t2)    
+      recursive SUBROUTINE INTTPART(p,f12343,f12342,lambda,q,sinobs,muobs,a_spin,scal,phyt,timet,mucos,t1,t2)    
 !********************************************************************************************
 !*     PURPOSE:  Computes \mu part of integrals in coordinates \phi, t and affine parameter \sigma,
 !*               expressed by equation (71) and (72) in Yang & Wang (2012).    
@@ -3403,6 +4387,11 @@ end module conv_mod
       save  f12343_1,f12342_1,lambda_1,q_1,sinobs_1,muobs_1,a_spin_1,scal_1,a4,b4,mu_tp1,mu_tp2,reals,&
                 mobseqmtp,b0,b1,b2,b3,g2,g3,dd,del,PI0,Wmup,Wmum,tplus,tminus,tp2,tinf,h,p_mt1_mt2,&
                 PI1_phi,PI2_phi,PI1_time,PI2_time,PI2_p,PI01
+      !$omp threadprivate(f12343_1,f12342_1,lambda_1,q_1,sinobs_1,muobs_1,a_spin_1,scal_1,&
+      !$omp& a4,b4,mu_tp1,mu_tp2,reals,mobseqmtp,b0,b1,&
+      !$omp& b2,b3,g2,g3,dd,del,PI0,Wmup,&
+      !$omp& Wmum,tplus,tminus,tp2,tinf,h,p_mt1_mt2,PI1_phi,&
+      !$omp& PI2_phi,PI1_time,PI2_time,PI2_p,PI01,count_num)
 
 30      continue
         IF(count_num.eq.1)then        
@@ -3501,6 +4490,7 @@ end module conv_mod
                 PI2_phi=zero
                 PI1_time=zero
                 PI2_time=zero 
+                mu2p=zero
                 Do j=0,10
                     Do i=j,j+1 
                         If(mobseqmtp)then
@@ -3673,6 +4663,7 @@ end module conv_mod
                         p2=p_mt1_mt2-p1
                         !p1=zero
                         !p2=zero
+                        mu2p=zero
                         Do j=0,10 
                             Do i=j,j+1
                                 If(mobseqmtp)then
@@ -3808,7 +4799,7 @@ end module conv_mod
       END SUBROUTINE INTTPART
 
 !********************************************************************************************
-      SUBROUTINE phyt_schwatz(p,f3,f2,lambda,q,sinobs,muobs,scal,phyc_schwatz,mucos,t1,t2)
+      recursive SUBROUTINE phyt_schwatz(p,f3,f2,lambda,q,sinobs,muobs,scal,phyc_schwatz,mucos,t1,t2)
 !******************************************************************************************** 
 !*     PURPOSE:  Computes \mu part of integrals in coordinates \phi, expressed by equation (72) 
 !*               in Yang & Wang (2012) with zero spin of black hole.    
@@ -3844,6 +4835,9 @@ end module conv_mod
         save :: PI1,PI1_phi,PI2_phi,Pt,f3_1,f2_1,lambda_1,q_1,pp_phi,p1_phi,p2_phi,&
                 sinobs_1,muobs_1,scal_1,mobseqmtp,AA,BB,&
                 mu_tp1,mu_tp2 
+        !$omp threadprivate(PI1,PI1_phi,PI2_phi,Pt,f3_1,f2_1,lambda_1,q_1,&
+        !$omp& pp_phi,p1_phi,p2_phi,sinobs_1,muobs_1,scal_1,mobseqmtp,AA,&
+        !$omp& BB,mu_tp1,mu_tp2,count_num)
 
 60 continue 
       IF(count_num .EQ. 1)THEN
@@ -3897,6 +4891,7 @@ end module conv_mod
               p2=Pt-p1 
               PI1_phi=zero
               PI2_phi=zero
+              mu2p=zero
               Do j=0,100 
                   Do i=j,j+1
                       If(mobseqmtp)then
@@ -3998,6 +4993,7 @@ end module conv_mod
                   pp=(asin(mu/mu_tp1)-asin(muobs/mu_tp1))*mu_tp1/BB        
                   p1=PI1-pp
                   p2=Pt-p1  
+                  mu2p=zero
                   Do j=0,100 
                       Do i=j,j+1
                       If(mobseqmtp)then
@@ -4080,7 +5076,7 @@ end module conv_mod
       return
       End SUBROUTINE phyt_schwatz 
 !************************************************************************* 
-      Function schwatz_int(y,x,AA) 
+      recursive Function schwatz_int(y,x,AA) 
 !************************************************************************* 
 !*     PURPOSE:  Computes \int^x_y dt/(1-t^2)/sqrt(1-AA^2*t^2) and AA .gt. 1  
 !*     INPUTS:   components of above integration.      
@@ -4122,7 +5118,7 @@ end module conv_mod
       End Function schwatz_int   
 
 !********************************************************************************************
-      SUBROUTINE INTRPART(p,f1234r,f1234t,lambda,q,sinobs,muobs,a_spin,&
+      recursive SUBROUTINE INTRPART(p,f1234r,f1234t,lambda,q,sinobs,muobs,a_spin,&
                             robs,scal,phyr,timer,affr,r_coord,t1,t2)
 !******************************************************************************************** 
 !*     PURPOSE:  Computes r part of integrals in coordinates \phi, t and affine parameter \sigma,
@@ -4175,6 +5171,16 @@ end module conv_mod
                 tp2,tinf,dd,E_add,E_m,D_add,D_m,PI0,PI0_obs_inf,PI0_total,PI0_obs_hori,PI0_obs_tp2,del,&
                 u,v,w,L1,L2,m2,t_inf,pinf,f1,g1,h1,f2,h2,b5,Ap,Am,h,wp,wm,wbarp,wbarm,hm,hp,a5,cc,&
                 PI1_phi,PI2_phi,PI1_time,PI2_time,PI1_aff,PI2_aff,PI2_p,PI1_p,p_tp1_tp2,sqt3          
+        !$omp threadprivate(f1234r_1,f1234t_1,lambda_1,q_1,sinobs_1,muobs_1,a_spin_1,robs_1,&
+        !$omp& scal_1,rhorizon,r_add,r_m,a4,b4,B_add,B_m,&
+        !$omp& robs_eq_rtp,indrhorizon,r_tp1,r_tp2,reals,cases,bb,b0,&
+        !$omp& b1,b2,b3,g2,g3,tobs,thorizon,tp2,&
+        !$omp& tinf,dd,E_add,E_m,D_add,D_m,PI0,PI0_obs_inf,&
+        !$omp& PI0_total,PI0_obs_hori,PI0_obs_tp2,del,u,v,w,L1,&
+        !$omp& L2,m2,t_inf,pinf,f1,g1,h1,f2,&
+        !$omp& h2,b5,Ap,Am,h,wp,wm,wbarp,&
+        !$omp& wbarm,hm,hp,a5,cc,PI1_phi,PI2_phi,PI1_time,&
+        !$omp& PI2_time,PI1_aff,PI2_aff,PI2_p,PI1_p,p_tp1_tp2,sqt3,count_num)
 
   40 continue        
         If(count_num.eq.1)then
@@ -4254,6 +5260,7 @@ end module conv_mod
                     call weierstrass_int_J3(tobs,infinity,dd,del,a4,b4,index_p4,rff_p,integ04,cases_int) 
 ! equation (42) in Yang & Wang (2012).
                     PI0=integ04(1)   
+                    pp=zero
                     select case(cases)
                     CASE(1)
                         If(f1234r .ge. zero)then !**photon will goto infinity.
@@ -4346,6 +5353,7 @@ end module conv_mod
                             !p2=zero
                         !*************************************************************************************
 ! equation (58) in Yang & Wang (2012).
+                            p_temp=zero
                             Do j=0,100
                                 Do i=j,j+1
                                     If(robs_eq_rtp)then        
@@ -4732,6 +5740,7 @@ end module conv_mod
                 !***********************************************************************
                 If(reals.ne.0)then  !** R(r)=0 has real roots and turning points exists in radial r. 
 !used in the geodesics I'm trying to understand March 6 2017
+                    pp=zero
                     select case(cases)
                     CASE(1)
                         If(f1234r .ge. zero)then !**photon will goto infinity. 
@@ -4805,6 +5814,7 @@ end module conv_mod
                             p2=p_tp1_tp2-p1  
                         !*************************************************************************************
 ! equation (58) in Yang & Wang (2012).       
+                            p_temp=zero
                             Do j=0,100
                                 Do i=j,j+1
                                     If(robs_eq_rtp)then        
@@ -5205,7 +6215,7 @@ end module conv_mod
      END SUBROUTINE INTRPART 
 
 !********************************************************************************************
-      Function  Pemdisk(f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,mu,rout,rin) 
+      recursive Function  Pemdisk(f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,mu,rout,rin) 
 !********************************************************************************************
 !*     PURPOSE:  Solves equation \mu(p)=mu, i.e. to search the value p_{em} of
 !*               parameter p, corresponding to the intersection point of geodesic with with 
@@ -5306,7 +6316,7 @@ end module conv_mod
         return
       End Function Pemdisk 
 !********************************************************************* 
-      Function  Pemdisk_all(f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,mu,rout,rin) 
+      recursive Function  Pemdisk_all(f1234,lambda,q,sinobs,muobs,a_spin,robs,scal,mu,rout,rin) 
 !********************************************************************* 
 !*     PURPOSE:  Solves equation \mu(p)=mu, where \mu(p)=\mu(p), i.e. to search the value p_{em} of
 !*               parameter p, corresponding to the intersection point of geodesic with 
@@ -5420,7 +6430,7 @@ end module conv_mod
         return
       End Function Pemdisk_all
 !*****************************************************************************************************
-      subroutine metricg(robs,sinobs,muobs,a_spin,somiga,expnu,exppsi,expmu1,expmu2)
+      recursive subroutine metricg(robs,sinobs,muobs,a_spin,somiga,expnu,exppsi,expmu1,expmu2)
 !*****************************************************************************************************
 !*     PURPOSE:  Computes Kerr metric, exp^\nu, exp^\psi, exp^mu1, exp^\mu2, and omiga at position:
 !*               r_obs, \theta_{obs}.     
@@ -5453,7 +6463,7 @@ end module conv_mod
       End subroutine metricg        
 
 !********************************************************************************************
-      Subroutine lambdaq_old(alpha,beta,robs,sinobs,muobs,a_spin,scal,velocity,f1234,lambda,q)
+      recursive Subroutine lambdaq_old(alpha,beta,robs,sinobs,muobs,a_spin,scal,velocity,f1234,lambda,q)
 !********************************************************************************************
 !*     PURPOSE:  Computes constants of motion from impact parameters alpha and beta by using 
 !*               formulae (110) and (112) in Yang & Wang (2012).    
@@ -5525,7 +6535,7 @@ end module conv_mod
        End subroutine lambdaq_old 
 
 !********************************************************************************************
-      Subroutine lambdaq(alpha,beta,robs,sinobs,muobs,a_spin,scal,velocity,f1234,lambda,q)
+      recursive Subroutine lambdaq(alpha,beta,robs,sinobs,muobs,a_spin,scal,velocity,f1234,lambda,q)
 !********************************************************************************************
 !*     PURPOSE:  Computes constants of motion from impact parameters alpha and beta by using 
 !*               formulae (86) and (87) in Yang & Wang (2012).    
@@ -5610,7 +6620,7 @@ end module conv_mod
        End subroutine lambdaq
 
 !********************************************************************************************
-      Subroutine initialdirection(pr,ptheta,pphi,sinobs,&
+      recursive Subroutine initialdirection(pr,ptheta,pphi,sinobs,&
                               muobs,a_spin,robs,velocity,lambda,q,f1234)
 !********************************************************************************************
 !*     PURPOSE:  Computes constants of motion from components of initial 4 momentum 
@@ -5692,7 +6702,7 @@ end module conv_mod
       End subroutine initialdirection
 
 !********************************************************************************************        
-      Subroutine center_of_image(robs,scal,velocity,alphac,betac)
+      recursive Subroutine center_of_image(robs,scal,velocity,alphac,betac)
 !********************************************************************************************
 !*     PURPOSE:  Solves equations f_3(alphac,betac)=0, f_2(alphac,betac)=0, of (100)  
 !*               and (101) in Yang & Wang (2012). alphac, betac are the coordinates of 
@@ -5930,7 +6940,7 @@ end module conv_mod
 !       End Subroutine center_of_image_old
 
 !********************************************************************************************
-      FUNCTION p_total(f1234r,lambda,q,sinobs,muobs,a_spin,robs,scal)
+      recursive FUNCTION p_total(f1234r,lambda,q,sinobs,muobs,a_spin,robs,scal)
 !******************************************************************************************** 
 !*     PURPOSE:  Computes the integral value of \int^r dr (R)^{-1/2}, from the starting position to
 !*               the termination----either the infinity or the event horizon.   
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      function dinang(a,r,h,mus)
+      recursive function dinang(a,r,h,mus)
 ! mus = \cos\delta
 ! Calculates cosine of angle of incidence for a photon hitting the
 ! disk mid-plane from a lamppost source
@@ -27,7 +27,7 @@
       
 
 !-----------------------------------------------------------------------
-      function demang(a,mu0,r,alpha,beta)
+      recursive function demang(a,mu0,r,alpha,beta)
 ! Calculates emission angle for the disk mid-plane
       implicit none
       double precision demang,a,mu0,r,alpha,beta,mue
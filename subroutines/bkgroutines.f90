@@ -1,13 +1,14 @@
 !-----------------------------------------------------------------------
 subroutine readinbkg
 ! Reads in the background spectrum
-! ***Must already know numchn***
+! ***Must already have loaded RESP id 1 (see loadresp)***
 ! ***Must have already initialised bkgcounts and bkgrate***  
   use telematrix
   implicit none
   integer status,U1,readwrite,blocksize,i,colnum,felem
-  integer nelem
-  real nullval,Texp,bcorr, get_env_real
+  integer nelem,numchn
+  integer :: inull = 0
+  real Texp,bcorr, get_env_real
   logical anynull
   character (len=500) strenv
   character (len=200) comment, bkgenv
@@ -27,6 +28,9 @@ subroutine readinbkg
      read(*,*)bcorr
   endif
   
+! Channels of RESP id 1
+  numchn = rsp(respslot(1))%numchn
+
 ! Open an unused unit
   status = 0
   call ftgiou(U1,status)
@@ -49,10 +53,9 @@ subroutine readinbkg
      colnum  = 2
      felem   = 1
      nelem   = 1
-     nullval = -1.0
      anynull = .false.
      status = 0
-     call FTGCVJ(U1,colnum,i,felem,nelem,nullval,bkgcounts(i),anynull,status)
+     call FTGCVJ(U1,colnum,i,felem,nelem,inull,bkgcounts(i),anynull,status)
      if( status .ne. 0 ) stop 'problem reading in counts column'
   end do
 
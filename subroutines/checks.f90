@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine need_check(Cp,Cpsave,param,paramsave,fhi,flo,fhisave,flosave,nf,nfsave,needtrans,needconv)
+recursive subroutine need_check(Cp,Cpsave,nlp,param,paramsave,fhi,flo,fhisave,flosave,nf,nfsave,needtrans,needconv)
 !
 ! Checks if reltrans needs to calculate the kernel
 !
@@ -15,11 +15,16 @@ subroutine need_check(Cp,Cpsave,param,paramsave,fhi,flo,fhisave,flosave,nf,nfsav
 ! Parameters the restframe spec is sensitive to
 ! (10):     Afe
 ! (12):    Ecut/kTe  
+! (14):     eta, only for nlp>1 (it weights the continuum of the second source,
+!           hence the ionisation profile and the dlogxi limits)
+! Everything else (Nh, boost, Mass, DelA, DelAB, g, ReIm, ...) only enters
+! after the convolutions, so the saved ReW0..ImW3 can be reused
   
 !!! Arg:
   ! INPUTS
   !   Cp:        defines which model
   !   Cpsave:    saved Cp
+  !   nlp:       number of lamp posts
   !   param:     parameter array
   !   paramsave: saved array
   !   fhi:       high frequency range
@@ -32,7 +37,7 @@ subroutine need_check(Cp,Cpsave,param,paramsave,fhi,flo,fhisave,flosave,nf,nfsav
   !   needtrans: if true, we must do the kernel calculation
   !   neecconv:  if true, we must do the convolution
   implicit none 
-  integer         , intent(in)  :: Cp, Cpsave, nf, nfsave
+  integer         , intent(in)  :: Cp, Cpsave, nlp, nf, nfsave
   real            , intent(in)  :: param(32), paramsave(32)
   real            , parameter   :: tol = 1e-7
   double precision, intent(in)  :: fhi, flo, fhisave, flosave
@@ -69,5 +74,8 @@ subroutine need_check(Cp,Cpsave,param,paramsave,fhi,flo,fhisave,flosave,nf,nfsav
   if( Cp .ne. Cpsave ) needconv = .true.
   if( abs( param(10) - paramsave(10) ) .gt. tol ) needconv = .true.
   if( abs( param(12) - paramsave(12) ) .gt. tol ) needconv = .true.
+  if( nlp .gt. 1 ) then
+     if( abs( param(14) - paramsave(14) ) .gt. tol ) needconv = .true.
+  end if
 end subroutine need_check
 !-----------------------------------------------------------------------
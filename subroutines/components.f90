@@ -1,5 +1,5 @@
-subroutine write_components(ne,ear,nex,earx,nf,flo,fhi,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
-                            h,z,Gamma,eta,beta_p,boost,floHz,fhiHz,ReIm,DelA,DelAB,g,ionvar,resp_matr)             
+recursive subroutine write_components(ne,ear,nex,earx,nf,flo,fhi,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,&
+                            ReW3,ImW3,h,z,Gamma,eta,beta_p,boost,floHz,fhiHz,ReIm,DelA,DelAB,g,ionvar,resp_matr)             
     !this subroutine separates the components from the model, calculates each cross spectrum including the effects of absorRTion,
     !folds the response matrix if desired, calls the phase correction, averages over frequnecy, and prints each different components
     !to a new file. This code repeats a lot and it's a bit of a monstrosity, mostly because it's annoying to separate the transfer
@@ -15,8 +15,8 @@ subroutine write_components(ne,ear,nex,earx,nf,flo,fhi,nlp,contx,absorbx,tauso,g
     real   , intent(IN) :: ear(0:ne),earx(0:nex),contx(nex,nlp),absorbx(nex)
     real   , intent(IN) :: g(nlp),DelA,DelAB(nlp),boost,z,Gamma,eta,h(nlp),beta_p
     real   , intent(IN) :: gso(nlp),tauso(nlp)
-    real   , intent(INOUT) :: ReW0(nlp,nex,nf),ImW0(nlp,nex,nf),ReW1(nlp,nex,nf),ImW1(nlp,nex,nf)
-    real   , intent(INOUT) :: ReW2(nlp,nex,nf),ImW2(nlp,nex,nf),ReW3(nlp,nex,nf),ImW3(nlp,nex,nf)
+    real   , intent(IN)    :: ReW0(nlp,nex,nf),ImW0(nlp,nex,nf),ReW1(nlp,nex,nf),ImW1(nlp,nex,nf)
+    real   , intent(IN)    :: ReW2(nlp,nex,nf),ImW2(nlp,nex,nf),ReW3(nlp,nex,nf),ImW3(nlp,nex,nf)
     real :: fac
     real :: tempRe,tempIm,dE, corr
     real :: f,flo,fhi,floHz,fhiHz
@@ -266,7 +266,7 @@ subroutine write_components(ne,ear,nex,earx,nf,flo,fhi,nlp,contx,absorbx,tauso,g
     return  
 end subroutine write_ComponentS
 
-subroutine components(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
+recursive subroutine components(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
                       h,z,Gamma,eta,beta_p,boost,g,DelAB,ionvar,ReScont,ImScont,ReSrev,ImSrev,&
                       ReSpiv,ImSpiv,ReSion,ImSion)
     ! Calculates the FT of the spectrum components before multiplying by the absorRTion model
@@ -282,11 +282,11 @@ subroutine components(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW
     integer, intent(IN) :: nex,nf,ionvar,nlp
     real   , intent(IN) :: earx(0:nex),contx(nex,nlp)
     real   , intent(IN) :: g(nlp),DelAB(nlp),boost,z,gso(nlp),Gamma,eta,h(nlp),tauso(nlp), beta_p, flo
-    real   , intent(INOUT) :: ReW0(nlp,nex,nf),ImW0(nlp,nex,nf),ReW1(nlp,nex,nf),ImW1(nlp,nex,nf)
-    real   , intent(INOUT) :: ReW2(nlp,nex,nf),ImW2(nlp,nex,nf),ReW3(nlp,nex,nf),ImW3(nlp,nex,nf)
+    real   , intent(IN)    :: ReW0(nlp,nex,nf),ImW0(nlp,nex,nf),ReW1(nlp,nex,nf),ImW1(nlp,nex,nf)
+    real   , intent(IN)    :: ReW2(nlp,nex,nf),ImW2(nlp,nex,nf),ReW3(nlp,nex,nf),ImW3(nlp,nex,nf)
     real   , intent(INOUT) :: ReScont(nex,nf),ImScont(nex,nf),ReSrev(nex,nf),ImSrev(nex,nf)
     real   , intent(INOUT) :: ReSpiv(nex,nf),ImSpiv(nex,nf),ReSion(nex,nf),ImSion(nex,nf)
-    real E,fac,fhi,beta,f,phase_d,phase_p,tau_d,tau_p
+    real E,fac,fhi,beta,f,phase_d,phase_p,tau_d,tau_p,etam
     real corr, contx_sum(nex)
     complex, dimension(:,:), allocatable :: Scont,Sreverb,Spivot,Sion
     ! complex Stemp,Scont(nex,nf),Sreverb(nex,nf),Spivot(nex,nf),Sion(nex,nf)
@@ -310,16 +310,11 @@ subroutine components(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW
     tau_p = 0.
     
     do m=1,nlp 
+        !weight of the second lamp post, applied on the fly (the W arrays are not modified)
+        etam = 1.0
         if( m .gt. 1 ) then
             !set up extra terms if second lamp post present
-            ReW0(m,:,:) = eta*ReW0(m,:,:)
-            ImW0(m,:,:) = eta*ImW0(m,:,:)
-            ReW1(m,:,:) = eta*ReW1(m,:,:)
-            ImW1(m,:,:) = eta*ImW1(m,:,:)
-            ReW2(m,:,:) = eta*ReW2(m,:,:)
-            ImW2(m,:,:) = eta*ImW2(m,:,:)
-            ReW3(m,:,:) = eta*ReW3(m,:,:)
-            ImW3(m,:,:) = eta*ImW3(m,:,:)
+            etam = eta
             tau_d = tauso(m)-tauso(1)
             tau_p = (h(m) - h(1))/(beta_p) !I think this is fine, but may need an extra factor c? double check the sign
         end if
@@ -337,10 +332,10 @@ subroutine components(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW
                 cexp_p = cmplx(cos(phase_p),sin(phase_p)) 
                 cexp_phi = cmplx(cos(DelAB(m)),sin(DelAB(m)))             
                 !set up transfer functions 
-                W0 = boost * cmplx(ReW0(m,i,j),ImW0(m,i,j))
-                W1 = boost * cmplx(ReW1(m,i,j),ImW1(m,i,j))
-                W2 = boost * cmplx(ReW2(m,i,j),ImW2(m,i,j))                       
-                W3 = ionvar * boost * cmplx(ReW3(m,i,j),ImW3(m,i,j))
+                W0 = boost * cmplx(etam*ReW0(m,i,j),etam*ImW0(m,i,j))
+                W1 = boost * cmplx(etam*ReW1(m,i,j),etam*ImW1(m,i,j))
+                W2 = boost * cmplx(etam*ReW2(m,i,j),etam*ImW2(m,i,j))                       
+                W3 = ionvar * boost * cmplx(etam*ReW3(m,i,j),etam*ImW3(m,i,j))
                 !calculate complex covariance
                 !note: the reason we use complex here is to ease the calculations 
                 !when we add all the extra phases from the double lamp post 
@@ -373,7 +368,7 @@ subroutine components(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW
     return
 end subroutine
 
-subroutine components_nocoh(nex,earx,nf,flo,fhi,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
+recursive subroutine components_nocoh(nex,earx,nf,flo,fhi,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
                             h,z,Gamma,eta,boost,g,DelAB,ionvar,ReIm,resp_matr,ReGcont,ImGcont,ReGrev,ImGrev,&
                             ReGpiv,ImGpiv,ReGion,ImGion)
     use constants
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      subroutine getcont(Cp, earx, nex, Gamma, Ecut_obs, logxi, logne, contx)
+      recursive subroutine getcont(Cp, earx, nex, Gamma, Ecut_obs, logxi, logne, contx)
 !!! Calculates continuum spectrum calling nthComp with the correct normalisation
 !!!based on the xillver spectrum 
 !!!  Arg:
@@ -37,7 +37,9 @@
          Ifl=1
 
       ! write(*,*) 'continuum parameters', nth_par
+         !$omp critical (reltrans_xspec)
          call donthcomp(earx, nex, nth_par, ifl, contx, photer)
+         !$omp end critical (reltrans_xspec)
 !the continuum needs to be renormalised according to the illuminating flux that was considered in xillver 
 ! Plus we divide by a factor that depends on ionisation and density to agree with the first versions of reltrans
 
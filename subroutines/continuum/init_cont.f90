@@ -1,4 +1,4 @@
-subroutine init_cont(nlp, a, h, zcos, Ecut_s, Ecut_obs, logxi, logne, &
+recursive subroutine init_cont(nlp, a, h, zcos, Ecut_s, Ecut_obs, logxi, logne, &
      muobs, Cp_cont, Cp, fcons, Gamma, Dkpc, Mass,&
     earx, Emin, Emax, contx, dlogE, verbose, dset, Anorm, contx_int, eta)
     !!!sets up the continuum arrays/quantities depending on model parameters/flavour 
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      subroutine drandphithick(alpha,beta,cosi,costheta,r,phi)
+      recursive subroutine drandphithick(alpha,beta,cosi,costheta,r,phi)
 !
 ! A disk with an arbitrary thickness
 ! The angle between the normal to the midplane and the disk surface is theta
@@ -14,8 +14,9 @@
       sini     = sqrt( 1.d0 - cosi**2 )
       x        = alpha / beta
       if( abs(alpha) .lt. abs(tiny(alpha)) .and. abs(beta) .lt. abs(tiny(beta))  )then
-        mu = 0.d0
-        r  = 0.d0
+        mu     = 0.d0
+        sinphi = 0.d0
+        r      = 0.d0
       else if( abs(beta) .lt. abs(tiny(beta)) )then
         mu     = sini*costheta/(cosi*sintheta)
         sinphi = sign( 1.d0 , alpha ) * sqrt( 1.d0 - mu**2 )
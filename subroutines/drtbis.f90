@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      FUNCTION drtbis(func,x1,x2,xacc,par)
+      recursive FUNCTION drtbis(func,x1,x2,xacc,par)
       implicit none
       INTEGER JMAX
       double precision drtbis,x1,x2,xacc,func,par(*)
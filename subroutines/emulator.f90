@@ -0,0 +1,158 @@
+!-----------------------------------------------------------------------
+      recursive subroutine emulate(imod,ear,ne,param,npar,photar,done)
+! Model imod (numbered as in tdbatch) from the emulator, if there is one
+! for this model, energy grid, response (RMF_SET, ARF_SET) and settings
+! (emu_envnm) whose largest per-bin validation error is within emutol, the
+! fixed parameters are the ones it was trained with and the free ones are
+! inside its box. done=.false. otherwise: the full model is then used.
+        use emulator
+      implicit none
+      integer imod,ne,npar
+      real ear(0:ne),param(npar),photar(ne)
+      logical done
+      integer i
+      character (len=500) strenv
+      character (len=200) envnm
+      real get_env_real
+      done = .false.
+! The emulator is read once and then shared, read-only, by all threads
+!$omp critical (reltrans_emu)
+      if( emu_state .eq. 0 ) call emu_load
+      if( emutol .lt. 0.d0 ) emutol = dble( get_env_real("RELTRANS_EMU_TOL",0.01) )
+!$omp end critical (reltrans_emu)
+      if( emu_state .ne. 1 ) return
+      if( emu_err(3) .gt. emutol ) return
+      if( imod .ne. emu_imod .or. npar .ne. emu_npar .or. ne .ne. emu_ne ) return
+      if( any( ear .ne. emu_ear ) ) return
+      do i = 1,npar
+        if( any( emu_free .eq. i ) ) cycle
+        if( abs(param(i)-emu_par(i)) .gt. 1e-6*max(1.0,abs(emu_par(i))) ) return
+      end do
+      envnm = 'RMF_SET'
+      if( strenv(envnm) .ne. emu_rmf ) return
+      envnm = 'ARF_SET'
+      if( strenv(envnm) .ne. emu_arf ) return
+      do i = 1,emu_nenv
+        envnm = emu_envnm(i)
+        if( strenv(envnm) .ne. emu_env(i) ) return
+      end do
+      call emu_eval(ne,param,npar,photar,emu_nfree,emu_nt,done)
+      return
+      end subroutine emulate
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine emu_eval(ne,param,npar,photar,nfree,nt,done)
+! The surrogate itself (see emulate). The scaled parameters x and the
+! features f are local, so nothing is shared between calls; done=.false.
+! if a free parameter is outside the box
+        use emulator
+      implicit none
+      integer ne,npar,nfree,nt
+      real param(npar),photar(ne)
+      logical done
+      double precision x(nfree),f(nt),c
+      integer i,j,k,l
+      done = .false.
+      do k = 1,nfree
+        x(k) = 2.d0 * ( param(emu_free(k)) - emu_lo(k) ) / ( emu_hi(k) - emu_lo(k) ) - 1.d0
+        if( abs(x(k)) .gt. 1.d0 ) return
+      end do
+! Features: 1, x_k, x_k*x_l (k<=l), in the order of make_emulator.py
+      f(1) = 1.d0
+      l = 1
+      do k = 1,nfree
+        l = l + 1
+        f(l) = x(k)
+      end do
+      do k = 1,nfree
+        do j = k,nfree
+          l = l + 1
+          f(l) = x(k) * x(j)
+        end do
+      end do
+      do i = 1,ne
+        photar(i) = 0.0
+      end do
+      do j = 1,emu_npc
+        c = 0.d0
+        do l = 1,nt
+          c = c + f(l) * emu_coef(l,j)
+        end do
+        do i = 1,ne
+          photar(i) = photar(i) + real( c * emu_basis(i,j) )
+        end do
+      end do
+      do i = 1,ne
+        photar(i) = photar(i) + real( emu_mean(i) )
+        if( emu_log .eq. 1 ) photar(i) = exp( photar(i) )
+      end do
+      done = .true.
+      return
+      end subroutine emu_eval
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine emu_load
+! Reads the emulator named by RELTRANS_EMU (emu_state=1), or sets
+! emu_state=-1 if the variable is not set or the file cannot be used.
+! Layout (unformatted stream, written by make_emulator.py): magic, imod,
+! npar, nfree, ne, npc, nt, log flag (4-byte integers), RMF_SET and ARF_SET
+! of the training (500 characters each, blank padded, 'none' if not set),
+! the emu_envnm settings (64 characters each, likewise), ear(0:ne), the
+! training values of all parameters (4-byte reals), the free parameter
+! indices, then lo, hi, the three validation errors, mean(ne),
+! basis(ne,npc) and coef(nt,npc) (8-byte reals, column major)
+        use emulator
+      implicit none
+      character (len=500) fname,strenv
+      character (len=200) envnm
+      character (len=8) magic
+      integer unit,ios
+      emu_state = -1
+      envnm = 'RELTRANS_EMU'
+      fname = strenv(envnm)
+      if( trim(fname) .eq. 'none' ) return
+      open(newunit=unit,file=trim(fname),access='stream',form='unformatted',&
+           status='old',action='read',iostat=ios)
+      if( ios .ne. 0 )then
+        write(*,*)"Warning! Cannot open emulator ",trim(fname)
+        return
+      end if
+      read(unit,iostat=ios) magic,emu_imod,emu_npar,emu_nfree,emu_ne,emu_npc,emu_nt,emu_log
+      if( ios .ne. 0 .or. magic .ne. emu_magic .or. emu_nt .ne. (emu_nfree+1)*(emu_nfree+2)/2 )then
+        write(*,*)"Warning! ",trim(fname)," is not a reltrans emulator"
+        close(unit)
+        return
+      end if
+      allocate( emu_ear(0:emu_ne), emu_par(emu_npar), emu_free(emu_nfree) )
+      allocate( emu_lo(emu_nfree), emu_hi(emu_nfree), emu_mean(emu_ne) )
+      allocate( emu_basis(emu_ne,emu_npc), emu_coef(emu_nt,emu_npc) )
+      read(unit,iostat=ios) emu_rmf,emu_arf,emu_env,emu_ear,emu_par,emu_free
+      if( ios .eq. 0 ) read(unit,iostat=ios) emu_lo,emu_hi,emu_err,emu_mean,emu_basis,emu_coef
+      close(unit)
+      if( ios .ne. 0 )then
+        write(*,*)"Warning! Cannot read emulator ",trim(fname)
+        deallocate( emu_ear, emu_par, emu_free, emu_lo, emu_hi, emu_mean, emu_basis, emu_coef )
+        return
+      end if
+      emu_state = 1
+      write(*,*)"Emulator for model",emu_imod,":",emu_npc," components,",emu_nfree,&
+                " free parameters, validation error (rms, max, max per bin)",emu_err
+      return
+      end subroutine emu_load
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      subroutine setemutol(tol)
+! Sets the accuracy required from the emulator for the following calls:
+! it is only used if its largest per-bin validation error is <= tol (so
+! tol=0 always runs the full model, and tol<0 goes back to RELTRANS_EMU_TOL).
+! Meant for library callers (f2py_interface)
+        use emulator
+      implicit none
+      double precision tol
+      emutol = tol
+      return
+      end subroutine setemutol
+!-----------------------------------------------------------------------
@@ -1,14 +1,14 @@
 
 !-----------------------------------------------------------------------
-subroutine fold(nex, earx, photarx, spec)
-! Initmatrix must have alreadt been called
+subroutine fold(m, nex, earx, photarx, spec)
+! Folds around the matrix in slot m of the response registry (see loadresp)
 ! Input: photarx(1:nex); i.e. (dN/dE)*dE
 ! Output: spec(1:numchn); in count rate vs channel number
   use telematrix
   implicit none
-  integer nex,i,j,k
-  real earx(0:nex),photarx(nex),spec(numchn)
-  real Si(nenerg),E,dE,E2Sx(nex)
+  integer m,nex,i,j,k
+  real earx(0:nex),photarx(nex),spec(rsp(m)%numchn)
+  real Si(rsp(m)%nenerg),E,dE,E2Sx(nex)
   
   !Convert to E^2*dN/dE for better accuracy
   do i = 1,nex
@@ -18,22 +18,21 @@ subroutine fold(nex, earx, photarx, spec)
   end do
   
   !Rebin input arrays onto internal telescope energy grid
-  call rebinE(earx,E2Sx,nex,En,Si,nenerg)
+  call rebinE(earx,E2Sx,nex,rsp(m)%En,Si,rsp(m)%nenerg)
   
   !Convert back to (dN/dE)*dE
-  do i = 1,nenerg
-     E  = 0.5 * ( En(i) + En(i-1) )
-     dE = En(i) - En(i-1)
+  do i = 1,rsp(m)%nenerg
+     E  = 0.5 * ( rsp(m)%En(i) + rsp(m)%En(i-1) )
+     dE = rsp(m)%En(i) - rsp(m)%En(i-1)
      Si(i) = Si(i) / E**2 * dE
   end do
 
-  !Fold around response
+  !Fold around response (compressed sparse columns, see telematrix)
   spec = 0.0
-  do J = 1, NENERG
-     do K = 1,NGRP(J)
-        do I = FCHAN(J,K) + 1, LCHAN(J,K)
-           spec(I) = spec(I) + Si(J) * RESP(I,J)
-        end do
+  do J = 1, rsp(m)%nenerg
+     !$omp simd
+     do K = rsp(m)%respcol(J), rsp(m)%respcol(J+1) - 1
+        spec(rsp(m)%respchn(K)) = spec(rsp(m)%respchn(K)) + Si(J) * rsp(m)%respval(K)
      end do
   end do
   
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      SUBROUTINE ourfour1(data,nn,isign)
+      recursive SUBROUTINE ourfour1(data,nn,isign)
       INTEGER isign,nn
       REAL data(2*nn)
       INTEGER i,istep,j,m,mmax,n
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
+recursive subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
 ! All reltrans flavours are calculated in this subroutine.
 ! Cp and dset are the settings:
 ! |Cp|=1 means use cut-off power-law, |Cp|=2 means use nthcomp
@@ -27,6 +27,10 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
     use conv_mod
     use radial_grids
     use gr_continuum
+    use rf_cache
+    use kernel_pixels
+    use sim_products
+    use model_contexts
     implicit none
     !Constants
     integer         , parameter :: nphi = 200, nro = 200!, ionvar! = 1 
@@ -71,6 +75,16 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
     real   , dimension(:,:,:)    , allocatable :: ReW0,ImW0,ReW1,ImW1
     real   , dimension(:,:,:)    , allocatable :: ReW2,ImW2,ReW3,ImW3
     real   , dimension(:,:)      , allocatable :: ReSraw,ImSraw,ReSrawa,ImSrawa,ReGrawa,ImGrawa,ReG,ImG                                                
+    !lag-frequency mode in chunks of nfa frequencies (RELTRANS_FCHUNK)
+    integer          :: nfa, nfk, nfchunk, j1, nfc, fbands
+    logical          :: stream
+    real             :: ReGc(nex), ImGc(nex)
+    double precision :: flo_c, fhi_c
+    !lag-frequency mode: transfer functions summed over the two energy bands (see conv_zone_bands)
+    logical          :: bands, bandsave
+    complex, allocatable :: BW(:,:,:,:)
+    complex          :: padFT_band(nec,2)
+    real             :: wband(nex,2), wbandsave(nex,2)
     !double precision :: frobs(nlp), frrel(nlp)  !reflection fraction variables (verbose)
     !Radial and angle profile 
     integer                       :: mubin, rbin, ibin
@@ -81,12 +95,14 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
     !variable for non linear effects
     integer ::  DC, ionvariation
     real    :: photarx_1(nex), photarx_2(nex), photarx_delta(nex), photarx_dlogxi(nex)
+    complex :: padFT_photarx(nec), padFT_photarx_delta(nec), padFT_photarx_dlogxi(nec)
     real    :: reline_w1(nlp,nex),imline_w1(nlp,nex),reline_w2(nlp,nex),imline_w2(nlp,nex)
     real    :: reline_w3(nlp,nex),imline_w3(nlp,nex)
     real    :: dlogxi1, dlogxi2, Gamma1, Gamma2, DeltaGamma  
-    !SAVE 
-    integer          :: nfsave, Cpsave
+    !SAVE (in a context, see model_contexts)
+    integer          :: nfsave, Cpsave, nfasave, ic
     real             :: paramsave(32)
+    logical          :: needgr, needgrconv
     double precision :: fhisave, flosave
     !Functions
     integer          :: i, j
@@ -100,24 +116,32 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
     integer get_env_int
  
     data firstcall /.true./
-    data Cpsave/2/
-    data nfsave /-1/  
-    !Save the first call variables
+    data nfchunk /-1/
+    data fbands /-1/
+    !Save the first call variables (set once, in the reltrans_init critical section below);
+    !everything that depends on the previous calls lives in a context
     save firstcall, dloge, earx, me, xe, d, verbose, test
-    save paramsave, fhisave, flosave, nfsave, refvar, ionvar
-    save frobs, frrel, Cpsave, needtrans
-    save ker_W0, ker_W1, ker_W2, ker_W3
-    save ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3
-    save ReSraw,ImSraw,ReSrawa,ImSrawa,ReGrawa,ImGrawa,ReG,ImG
+    save refvar, ionvar, nfchunk, fbands
 
     ifl = 1
+    !Bring in the caches of this flavour and mode (see model_contexts); they are put back at the end
+    call ctx_select(Cp,dset,nlp,param,ic)
+    call ctx_swap(ic,ker_W0,ker_W1,ker_W2,ker_W3,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
+                  ReSraw,ImSraw,ReSrawa,ImSrawa,ReGrawa,ImGrawa,ReG,ImG,BW,&
+                  paramsave,fhisave,flosave,nfsave,nfasave,Cpsave,bandsave,wbandsave,frobs,frrel)
     ! Initialise some parameters 
-    call initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,needtrans,me,xe,refvar,ionvar,nlp,verbose,test)
+    !$omp critical (reltrans_init)
+    call initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,me,xe,refvar,ionvar,nlp,verbose,test)
+    if( nfchunk .lt. 0 ) nfchunk = max( get_env_int("RELTRANS_FCHUNK",0) , 0 )
+    if( fbands .lt. 0 ) fbands = get_env_int("RELTRANS_FBANDS",0)
+    !$omp end critical (reltrans_init)
+    call conv_buffers(.true.)
  
-    !Allocate dynamically the array to calculate the trasfer function 
-    if (.not. allocated(re1)) allocate(re1(nphi,nro))
-    if (.not. allocated(taudo1)) allocate(taudo1(nphi,nro))
-    if (.not. allocated(pem1)) allocate(pem1(nphi,nro))
+    !Allocate dynamically the arrays to calculate the transfer function (in this context)
+    call init_gr_arrays(nlp,xe)
+    if (.not. associated(re1)) allocate(re1(nphi,nro))
+    if (.not. associated(taudo1)) allocate(taudo1(nphi,nro))
+    if (.not. associated(pem1)) allocate(pem1(nphi,nro))
     
     !Note: the two different calls are because for the double lP we set the temperature from the coronal frame(s), but for the single
     !LP we use the temperature in the observer frame
@@ -149,7 +173,7 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
         fhi   = dble(fhiHz) * 4.92695275718945d-06 * Mass
         flo   = dble(floHz) * 4.92695275718945d-06 * Mass
         !Note that the frequency grid is using a higher resolution since it's what we care about in this mode 
-        !TBD: find a way to reduce energy resolution since we don't need it, otherwise the runtime is insanely slow  
+        !(only the two energy bands are convolved in this mode, see conv_zone_bands)
         nf = ceiling( log10(fhiHz/floHz) / 0.01 )
         allocate(fix(0:nf))
         do fbinx = 0, nf 
@@ -203,18 +227,33 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
     end do
 
     !Determine if I need to calculate the kernel 
-    call need_check(Cp,Cpsave,param,paramsave,fhi,flo,fhisave,flosave,nf,nfsave,needtrans,needconv)
+    call need_check(Cp,Cpsave,nlp,param,paramsave,fhi,flo,fhisave,flosave,nf,nfsave,needtrans,needconv)
+
+    !With RELTRANS_FCHUNK=n>0 the lag-frequency spectrum is built n frequencies at a time: the kernels
+    !and W arrays only hold one chunk, at the price of redoing the kernels and convolutions every call
+    stream = ReIm .eq. 7 .and. nfchunk .gt. 0 .and. nfchunk .lt. nf
+    nfa    = nf
+    if( stream ) nfa = nfchunk
+    !Lag-frequency spectra only need the two energy bands: with RELTRANS_FBANDS=1 the transfer
+    !functions are only accumulated over them (BW) and the full W(E) arrays are not formed. This
+    !skips the dyn cleaning of the de-padded convolutions, so it is off by default
+    bands  = ReIm .eq. 7 .and. .not. test .and. fbands .eq. 1
+    if( bands .neqv. bandsave ) needconv = .true.
 
     ! Allocate arrays that depend on frequency
-    if( nf .ne. nfsave )then
+    if( nf .ne. nfsave .or. nfa .ne. nfasave )then
+        !the saved kernel and W arrays do not survive a change of size
+        needtrans = .true.
+        needconv  = .true.
+        nfasave   = nfa
         if( allocated(ker_W0 ) ) deallocate(ker_W0 )
         if( allocated(ker_W1) ) deallocate(ker_W1 )
         if( allocated(ker_W2 ) ) deallocate(ker_W2 )
         if( allocated(ker_W3 ) ) deallocate(ker_W3 )
-        allocate( ker_W0(nlp,nex,nf,me,xe) )
-        allocate( ker_W1(nlp,nex,nf,me,xe) )
-        allocate( ker_W2(nlp,nex,nf,me,xe) )
-        allocate( ker_W3(nlp,nex,nf,me,xe) )
+        allocate( ker_W0(nlp,nex,nfa,me,xe) )
+        allocate( ker_W1(nlp,nex,nfa,me,xe) )
+        allocate( ker_W2(nlp,nex,nfa,me,xe) )
+        allocate( ker_W3(nlp,nex,nfa,me,xe) )
         if( allocated(ReW0) ) deallocate(ReW0)
         if( allocated(ImW0) ) deallocate(ImW0)
         if( allocated(ReW1) ) deallocate(ReW1)
@@ -223,37 +262,58 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
         if( allocated(ImW2) ) deallocate(ImW2)
         if( allocated(ReW3) ) deallocate(ReW3)
         if( allocated(ImW3) ) deallocate(ImW3)
-        allocate( ReW0(nlp,nex,nf) )
-        allocate( ImW0(nlp,nex,nf) )
-        allocate( ReW1(nlp,nex,nf) )
-        allocate( ImW1(nlp,nex,nf) )
-        allocate( ReW2(nlp,nex,nf) )
-        allocate( ImW2(nlp,nex,nf) )
-        allocate( ReW3(nlp,nex,nf) )
-        allocate( ImW3(nlp,nex,nf) )
         if( allocated(ReSraw) ) deallocate(ReSraw)
         if( allocated(ImSraw) ) deallocate(ImSraw)
-        allocate( ReSraw(nex,nf) )
-        allocate( ImSraw(nex,nf) )
+        allocate( ReSraw(nex,nfa) )
+        allocate( ImSraw(nex,nfa) )
         if( allocated(ReSrawa) ) deallocate(ReSrawa)
         if( allocated(ImSrawa) ) deallocate(ImSrawa)
-        allocate( ReSrawa(nex,nf) )
-        allocate( ImSrawa(nex,nf) )
+        allocate( ReSrawa(nex,nfa) )
+        allocate( ImSrawa(nex,nfa) )
         if( allocated(ReGrawa) ) deallocate(ReGrawa)
         if( allocated(ImGrawa) ) deallocate(ImGrawa)
-        allocate( ReGrawa(nex,nf) )
-        allocate( ImGrawa(nex,nf) )
+        allocate( ReGrawa(nex,nfa) )
+        allocate( ImGrawa(nex,nfa) )
         if( allocated(ReG) ) deallocate(ReG)
         if( allocated(ImG) ) deallocate(ImG)
-        allocate( ReG(nex,nf) )
-        allocate( ImG(nex,nf) )
+        allocate( ReG(nex,nfa) )
+        allocate( ImG(nex,nfa) )
+        if( allocated(BW) ) deallocate(BW)
+        allocate( BW(nlp,nfa,0:3,2) )
+    end if
+    !The full W(E) arrays only exist outside the band-restricted path
+    if( bands )then
+        if( allocated(ReW0) ) deallocate(ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3)
+    else if( .not. allocated(ReW0) )then
+        allocate( ReW0(nlp,nex,nfa) )
+        allocate( ImW0(nlp,nex,nfa) )
+        allocate( ReW1(nlp,nex,nfa) )
+        allocate( ImW1(nlp,nex,nfa) )
+        allocate( ReW2(nlp,nex,nfa) )
+        allocate( ImW2(nlp,nex,nfa) )
+        allocate( ReW3(nlp,nex,nfa) )
+        allocate( ImW3(nlp,nex,nfa) )
+        needconv = .true.
     end if
   
 
     if (verbose .gt. 2) call CPU_TIME (time_start)
+    !The ray-tracing products (gso, tauso, lens, rlp, ..., pixel list) of this context belong to the
+    !geometry of its last rtrans call, pixparam. If that is another geometry, rtrans must run again
+    !even if the kernels are up to date (e.g. after a streamed call, which leaves no kernels)
+    needgr = .true.
+    if( associated(pixhit) ) call need_check(Cp,Cp,nlp,param,pixparam,fhi,flo,fhi,flo,nf,nf,needgr,needgrconv)
+    if( needgr ) needtrans = .true.
+    !If only the frequency grid changed since the last ray tracing (e.g. the DC call after a lag
+    !call with the same parameters, see simspectra), the kernels are rebuilt from the pixel list
+    !kept by rtrans instead of tracing the disk again
+    if( needtrans .and. .not. needgr .and. .not. stream .and. verbose .le. 1 )then
+        call kernel_chunk(nlp,nex,me,xe,nf,fhi,flo,1,nf,ker_W0,ker_W1,ker_W2,ker_W3)
+        needtrans = .false.
+    end if
     if( needtrans )then
        !allocate lensing/reflection fraction arrays if necessary
-       if( allocated(lens) ) deallocate( lens )
+       if( associated(lens) ) deallocate( lens )
        allocate (lens(nlp))
        if( allocated(frobs) ) deallocate( frobs )
        allocate (frobs(nlp))
@@ -261,8 +321,12 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
        allocate (frrel(nlp))
        !Calculate the Kernel for the given parameters
        status_re_tau = .true.       
+       !when streaming, rtrans only builds the pixel list; the kernels are made chunk by chunk below
+       nfk = nf
+       if( stream ) nfk = 0
        call rtrans(verbose,dset,nlp,a,h,muobs,Gamma,rin,rout,honr,d,rnmax,zcos,b1,b2,qboost,eta_0,&
-                    fcons,nro,nphi,nex,dloge,nf,fhi,flo,me,xe,ker_W0,ker_W1,ker_W2,ker_W3,frobs,frrel)
+                    fcons,nro,nphi,nex,dloge,nfk,fhi,flo,me,xe,ker_W0,ker_W1,ker_W2,ker_W3,frobs,frrel)
+       pixparam = param
        ! print *, 'gso ', gso(1)
     end if
     if( verbose .gt. 2 ) then
@@ -301,113 +365,162 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
     if( verbose .gt. 0) write(*,*)"Observer's reflection fraction for each source:",boost*frobs
     if( verbose .gt. 0) write(*,*)"Relxill reflection fraction for each source:",frrel    
     
+    ! Calculate absorption (XSPEC models are not thread safe)
+    !$omp critical (reltrans_xspec)
+    call tbabs(earx,nex,nh,Ifl,absorbx,photerx)
+    !$omp end critical (reltrans_xspec)
+    if( bands )then
+        !the absorption is part of the band weights, so a new Nh means new band sums
+        call band_weights(nex,Emin,Emax,absorbx,wband)
+        if( any( wband .ne. wbandsave ) ) needconv = .true.
+        wbandsave = wband
+        call padding4FT(wband(:,1),padFT_band(:,1))
+        call padding4FT(wband(:,2),padFT_band(:,2))
+    end if
+
     if( verbose .gt. 2) call CPU_TIME (time_start)  
-    ! if( needconv )then
-        !needtrans = .false.
-        !Initialize arrays for transfer functions
-        ReW0 = 0.0
-        ImW0 = 0.0
-        ReW1 = 0.0
-        ImW1 = 0.0
-        ReW2 = 0.0
-        ImW2 = 0.0
-        ReW3 = 0.0
-        ImW3 = 0.0
-        DeltaGamma = 0.01
-        Gamma1 = real(Gamma) - 0.5*DeltaGamma
-        Gamma2 = real(Gamma) + 0.5*DeltaGamma
-        !Get logxi values corresponding to Gamma1 and Gamma2
-        call xilimits(nex,earx,nlp,contx,DeltaGamma,real(gso),real(lens),real(zcos),dlogxi1,dlogxi2)
-        !Set the ion-variation to 1, there is an if inside the radial loop to check if either the ionvar is 0 or the logxi is 0 to
-        !set ionvariation to 0  it is important that ionvariation is different than ionvar because ionvar  is used also later in
-        !the rawS subroutine to calculate the cross-spectrum
-        ionvariation = 1
-        !Loop over radius, emission angle and frequency
-        do rbin = 1, xe  !Loop over radial zones
-            !Set parameters with radial dependence
-            Gamma0 = real(Gamma)
-            logne  = logner(rbin)
-            Ecut0  = real( gsdr(rbin) ) * Ecut_s
-            logxi0 = real( logxir(rbin) )
-            if( xe .eq. 1 )then
-                Ecut0  = Ecut_s
-                logne  = lognep
-                logxi0 = logxi
-            end if
-            !Avoid negative values of the ionisation parameter 
-            if (logxi0 .eq. 0.0 .or. ionvar .eq. 0) then
-                ionvariation = 0.0
+    !Redo the convolutions only if the rest frame spectra or the kernel changed; otherwise ReW0..ImW3 are
+    !reused from the previous call (the routines below never modify them, see need_check).
+    !Without streaming this loop has a single chunk of all nf frequencies. The last chunk may run past
+    !fhi: those extra frequencies are computed and dropped.
+    if( stream ) needconv = .true.
+    do j1 = 1, nf, nfa
+        nfc = min( nfa , nf - j1 + 1 )
+        if( stream ) call kernel_chunk(nlp,nex,me,xe,nf,fhi,flo,j1,nfa,ker_W0,ker_W1,ker_W2,ker_W3)
+        if( needconv )then
+            !Initialize arrays for transfer functions
+            if( bands )then
+                BW = 0.0
+            else
+                ReW0 = 0.0
+                ImW0 = 0.0
+                ReW1 = 0.0
+                ImW1 = 0.0
+                ReW2 = 0.0
+                ImW2 = 0.0
+                ReW3 = 0.0
+                ImW3 = 0.0
             end if
-            do mubin = 1, me      !loop over emission angle zones
-                !Calculate input emission angle
-                mue    = ( real(mubin) - 0.5 ) / real(me)
-                thetae = acos( mue ) * 180.0 / real(pi)
-                if( me .eq. 1 ) thetae = real(inc)
-                !Call restframe reflection model
-                call rest_frame(earx,nex,Gamma0,Afe,logne,Ecut0,logxi0,thetae,Cp,photarx)
-                !NON LINEAR EFFECTS
-                if (DC .eq. 0) then 
-                   !Gamma variations
-                   logxi1 = logxi0 + ionvariation * dlogxi1
-                   call rest_frame(earx,nex,Gamma1,Afe,logne,Ecut0,logxi1,thetae,Cp,photarx_1)
-                   logxi2 = logxi0 + ionvariation * dlogxi2
-                   call rest_frame(earx,nex,Gamma2,Afe,logne,Ecut0,logxi2,thetae,Cp,photarx_2)
-                   photarx_delta = (photarx_2 - photarx_1)/(Gamma2-Gamma1)
-                   !xi variations
-                   call rest_frame(earx,nex,Gamma0,Afe,logne,Ecut0,logxi1,thetae,Cp,photarx_1)
-                   call rest_frame(earx,nex,Gamma0,Afe,logne,Ecut0,logxi2,thetae,Cp,photarx_2)
-                   photarx_dlogxi = 0.434294481 * (photarx_2 - photarx_1) / (dlogxi2-dlogxi1) !pre-factor is 1/ln10
+            DeltaGamma = 0.01
+            Gamma1 = real(Gamma) - 0.5*DeltaGamma
+            Gamma2 = real(Gamma) + 0.5*DeltaGamma
+            !Get logxi values corresponding to Gamma1 and Gamma2
+            call xilimits(nex,earx,nlp,contx,DeltaGamma,real(gso),real(lens),real(zcos),dlogxi1,dlogxi2)
+            !Set the ion-variation to 1, there is an if inside the radial loop to check if either the ionvar is 0 or the logxi is 0 to
+            !set ionvariation to 0  it is important that ionvariation is different than ionvar because ionvar  is used also later in
+            !the rawS subroutine to calculate the cross-spectrum
+            ionvariation = 1
+            !Loop over radius, emission angle and frequency
+            do rbin = 1, xe  !Loop over radial zones
+                !Set parameters with radial dependence
+                Gamma0 = real(Gamma)
+                logne  = logner(rbin)
+                Ecut0  = real( gsdr(rbin) ) * Ecut_s
+                logxi0 = real( logxir(rbin) )
+                if( xe .eq. 1 )then
+                    Ecut0  = Ecut_s
+                    logne  = lognep
+                    logxi0 = logxi
+                end if
+                !Avoid negative values of the ionisation parameter 
+                if (logxi0 .eq. 0.0 .or. ionvar .eq. 0) then
+                    ionvariation = 0.0
                 end if
-                !Loop through frequencies and lamp posts
-                do j = 1,nf
-                    do i = 1,nex
-                        do m=1,nlp
-                            reline_w0(m,i) = real( ker_W0(m,i,j,mubin,rbin) )
-                            imline_w0(m,i) = aimag( ker_W0(m,i,j,mubin,rbin) )
-                            reline_w1(m,i) = real( ker_W1(m,i,j,mubin,rbin) )
-                            imline_w1(m,i) = aimag( ker_W1(m,i,j,mubin,rbin) )
-                            reline_w2(m,i) = real( ker_W2(m,i,j,mubin,rbin) )
-                            imline_w2(m,i) = aimag( ker_W2(m,i,j,mubin,rbin) )
-                            reline_w3(m,i) = real( ker_W3(m,i,j,mubin,rbin) )
-                            imline_w3(m,i) = aimag( ker_W3(m,i,j,mubin,rbin) )
-                        end do  
-                    end do
+                do mubin = 1, me      !loop over emission angle zones
+                    !Calculate input emission angle
+                    mue    = ( real(mubin) - 0.5 ) / real(me)
+                    thetae = acos( mue ) * 180.0 / real(pi)
+                    if( me .eq. 1 ) thetae = real(inc)
+                    !Call restframe reflection model
+                    call rest_frame_cached(earx,nex,Gamma0,Afe,logne,Ecut0,logxi0,thetae,Cp,photarx)
+                    !NON LINEAR EFFECTS
+                    if (DC .eq. 0) then 
+                       !Gamma variations
+                       logxi1 = logxi0 + ionvariation * dlogxi1
+                       call rest_frame_cached(earx,nex,Gamma1,Afe,logne,Ecut0,logxi1,thetae,Cp,photarx_1)
+                       logxi2 = logxi0 + ionvariation * dlogxi2
+                       call rest_frame_cached(earx,nex,Gamma2,Afe,logne,Ecut0,logxi2,thetae,Cp,photarx_2)
+                       photarx_delta = (photarx_2 - photarx_1)/(Gamma2-Gamma1)
+                       !xi variations
+                       call rest_frame_cached(earx,nex,Gamma0,Afe,logne,Ecut0,logxi1,thetae,Cp,photarx_1)
+                       call rest_frame_cached(earx,nex,Gamma0,Afe,logne,Ecut0,logxi2,thetae,Cp,photarx_2)
+                       photarx_dlogxi = 0.434294481 * (photarx_2 - photarx_1) / (dlogxi2-dlogxi1) !pre-factor is 1/ln10
+                    end if
+                    !Loop through frequencies and lamp posts
                     !always: convolution for reverberation/DC spectrum
                     !TBD: add flag here to do this convolution if no reflection time, or different convolution with complex
                     !xillver if tref > 0 or something.                    
-
                     if (test) then
-                       
-                       call conv_one_FFT(dyn,photarx,reline_w0,imline_w0,ReW0(:,:,j),ImW0(:,:,j),DC,nlp)
-                       if(DC .eq. 0 .and. refvar .eq. 1) then
-                          call conv_one_FFT(dyn,photarx,reline_w1,imline_w1,ReW1(:,:,j),ImW1(:,:,j),DC,nlp)
-                          call conv_one_FFT(dyn,photarx_delta,reline_w2,imline_w2,ReW2(:,:,j),ImW2(:,:,j),DC,nlp)
-                       end if
-                       if(DC .eq. 0 .and. ionvar .eq. 1) then
-                          call conv_one_FFT(dyn,photarx_dlogxi,reline_w3,imline_w3,ReW3(:,:,j),ImW3(:,:,j),DC,nlp)
-                       end if
+                       do j = 1,nfa
+                          do i = 1,nex
+                             do m=1,nlp
+                                reline_w0(m,i) = real( ker_W0(m,i,j,mubin,rbin) )
+                                imline_w0(m,i) = aimag( ker_W0(m,i,j,mubin,rbin) )
+                                reline_w1(m,i) = real( ker_W1(m,i,j,mubin,rbin) )
+                                imline_w1(m,i) = aimag( ker_W1(m,i,j,mubin,rbin) )
+                                reline_w2(m,i) = real( ker_W2(m,i,j,mubin,rbin) )
+                                imline_w2(m,i) = aimag( ker_W2(m,i,j,mubin,rbin) )
+                                reline_w3(m,i) = real( ker_W3(m,i,j,mubin,rbin) )
+                                imline_w3(m,i) = aimag( ker_W3(m,i,j,mubin,rbin) )
+                             end do  
+                          end do
+                          call conv_one_FFT(dyn,photarx,reline_w0,imline_w0,ReW0(:,:,j),ImW0(:,:,j),DC,nlp)
+                          if(DC .eq. 0 .and. refvar .eq. 1) then
+                             call conv_one_FFT(dyn,photarx,reline_w1,imline_w1,ReW1(:,:,j),ImW1(:,:,j),DC,nlp)
+                             call conv_one_FFT(dyn,photarx_delta,reline_w2,imline_w2,ReW2(:,:,j),ImW2(:,:,j),DC,nlp)
+                          end if
+                          if(DC .eq. 0 .and. ionvar .eq. 1) then
+                             call conv_one_FFT(dyn,photarx_dlogxi,reline_w3,imline_w3,ReW3(:,:,j),ImW3(:,:,j),DC,nlp)
+                          end if
+                       end do
                     else
-                       call conv_one_FFTw(dyn,photarx,reline_w0,imline_w0,ReW0(:,:,j),ImW0(:,:,j),DC,nlp)
-                       if(DC .eq. 0 .and. refvar .eq. 1) then
-
-                          call conv_one_FFTw(dyn,photarx,reline_w1,imline_w1,ReW1(:,:,j),ImW1(:,:,j),DC,nlp)
-                          call conv_one_FFTw(dyn,photarx_delta,reline_w2,imline_w2,ReW2(:,:,j),ImW2(:,:,j),DC,nlp)
-                       end if
-                       if(DC .eq. 0 .and. ionvar .eq. 1) then
-                          call conv_one_FFTw(dyn,photarx_dlogxi,reline_w3,imline_w3,ReW3(:,:,j),ImW3(:,:,j),DC,nlp)
+                       !FT the rest frame spectra once, then convolve all frequencies and lamp posts of this zone
+                       !in batches (the single-line equivalent is conv_one_FFTw_FT)
+                       call padding4FT_spectrum(photarx,padFT_photarx,DC)
+                       if(DC .eq. 0 .and. refvar .eq. 1) call padding4FT_spectrum(photarx_delta,padFT_photarx_delta,DC)
+                       if(DC .eq. 0 .and. ionvar .eq. 1) call padding4FT_spectrum(photarx_dlogxi,padFT_photarx_dlogxi,DC)
+                       if( bands )then
+                           call conv_zone_bands(padFT_photarx,padFT_photarx_delta,padFT_photarx_dlogxi,padFT_band,&
+                                ker_W0(:,:,:,mubin,rbin),ker_W1(:,:,:,mubin,rbin),ker_W2(:,:,:,mubin,rbin),&
+                                ker_W3(:,:,:,mubin,rbin),BW,DC,refvar,ionvar,nlp,nfa)
+                       else
+                           call conv_zone_FFTw(dyn,padFT_photarx,padFT_photarx_delta,padFT_photarx_dlogxi,&
+                                ker_W0(:,:,:,mubin,rbin),ker_W1(:,:,:,mubin,rbin),ker_W2(:,:,:,mubin,rbin),&
+                                ker_W3(:,:,:,mubin,rbin),ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,DC,refvar,ionvar,nlp,nfa)
                        end if
-                    endif                    
+                    end if
                     !old call: always convolve every single transfer function in one go
                     !call conv_all_FFTw(dyn,photarx,photarx_delta,photarx_dlogxi,reline_w0,imline_w0,reline_w1,imline_w1,&
                     !     reline_w2,imline_w2,reline_w3,imline_w3,ReW0(:,:,j),ImW0(:,:,j),ReW1(:,:,j),ImW1(:,:,j),&
                     !     ReW2(:,:,j),ImW2(:,:,j),ReW3(:,:,j),ImW3(:,:,j),DC,nlp)
-                 end do
+                end do
             end do
-        end do
-    ! end if
+        end if
+        if( stream .or. bands )then
+            !lag-frequency spectrum of this chunk, on the sub-grid of nfa bins that starts at bin j1
+            flo_c = flo * (fhi/flo)**( dble(j1-1) / dble(nf) )
+            fhi_c = flo * (fhi/flo)**( dble(j1-1+nfa) / dble(nf) )
+            if( bands )then
+                call lag_freq_bands(nex,earx,nfa,fix,real(flo_c),real(fhi_c),Emin,Emax,nlp,contx,absorbx,real(tauso),&
+                                    real(gso),BW,real(h),real(zcos),real(eta),beta_p,boost,g,DelAB,ionvar,&
+                                    ReGc,ImGc)
+            else if(nlp .gt. 1 .and. beta_p .eq. 0. ) then
+                call lag_freq_nocoh(nex,earx,nfa,fix,real(flo_c),real(fhi_c),Emin,Emax,nlp,contx,absorbx,real(tauso),&
+                                    real(gso),ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,real(h),real(zcos),real(Gamma),&
+                                    real(eta),boost,g,DelAB,ionvar,ReGc,ImGc)
+            else
+                call lag_freq(nex,earx,nfa,fix,real(flo_c),real(fhi_c),Emin,Emax,nlp,contx,absorbx,real(tauso),&
+                              real(gso),ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,real(h),real(zcos),real(Gamma),&
+                              real(eta),beta_p,boost,g,DelAB,ionvar,ReGc,ImGc)
+            end if
+            ReGbar(j1:j1+nfc-1) = ReGc(1:nfc)
+            ImGbar(j1:j1+nfc-1) = ImGc(1:nfc)
+        end if
+    end do
     if( verbose .gt. 2 ) then
         call CPU_TIME (time_end)
         print *, 'Convolutions runtime: ', time_end - time_start, ' seconds' 
+        print *, 'Rest frame cache hits/misses (total): ', rfc_hits, rfc_misses
     endif
 
     ! do i = 1, nex
@@ -423,11 +536,10 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
     !    write(18,*) E, photarx_dlogxi(i)
     ! enddo
     
-    ! Calculate absorption 
-    call tbabs(earx,nex,nh,Ifl,absorbx,photerx)
-
     !TBD coherence check - if zero coherence between lamp posts, call a different subroutine 
-    if( ReIm .eq. 7 ) then
+    if( stream .or. bands )then
+        !ReGbar and ImGbar were filled chunk by chunk above
+    else if( ReIm .eq. 7 ) then
         !tbd - implement zero cohernece in lag_freq
         if(nlp .gt. 1 .and. beta_p .eq. 0. ) then
             call lag_freq_nocoh(nex,earx,nf,fix,real(flo),real(fhi),Emin,Emax,nlp,contx,absorbx,real(tauso),real(gso),&
@@ -473,8 +585,7 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
         end do
     else if (ReIm .eq. 7) then     
         !if calculating the lag-frequency spectrum, just rebin the arrays 
-        call rebinE(fix, ReGbar, nf, ear, ReS, ne)
-        call rebinE(fix, ImGbar, nf, ear, ImS, ne)     
+        call rebinE2(fix, ReGbar, ImGbar, nf, ear, ReS, ImS, ne)
     else 
         !In this case, calculate the lag-energy spectrum
         !Calculate raw cross-spectrum from Sraw(E,\nu) and the reference band parameters
@@ -508,6 +619,8 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
         !note: the factor eta is to have the same normalization as the single LP model, it's 100% arbitrary
         ReGbar = ReGbar * fac * (Anorm/real(1.+eta))**2  
         ImGbar = ImGbar * fac * (Anorm/real(1.+eta))**2  
+        !Real and imaginary parts for the simulation wrappers, from the same cross spectrum
+        if( nsim .gt. 0 ) call crebin(nex,earx,ReGbar,ImGbar,nsim,earsim,resim,imsim)
     end if
 
     !Write output depending on ReIm parameter
@@ -551,6 +664,8 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
         end if
     end if
 
+    !the Output files are shared by all threads: one writer at a time
+    !$omp critical (reltrans_output)
     if (verbose .gt. 1 .and. abs(ReIm) .gt. 0 .and. ReIm .lt. 7) then
         if( DC .eq. 0 .and. beta_p .eq. 0) then
            call write_components(ne,ear,nex,earx,nf,real(flo),real(fhi),nlp,contx,absorbx,real(tauso),real(gso),&
@@ -591,12 +706,19 @@ subroutine genreltrans(Cp, dset, nlp, ear, ne, param, ifl, photar)
         end do 
         close(14)
     endif 
+    !$omp end critical (reltrans_output)
 
     fhisave   = fhi
     flosave   = flo
     nfsave    = nf
     paramsave = param
     Cpsave    = Cp
+    bandsave  = bands
+    call ctx_swap(ic,ker_W0,ker_W1,ker_W2,ker_W3,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
+                  ReSraw,ImSraw,ReSrawa,ImSrawa,ReGrawa,ImGrawa,ReG,ImG,BW,&
+                  paramsave,fhisave,flosave,nfsave,nfasave,Cpsave,bandsave,wbandsave,frobs,frrel)
+    call conv_buffers(.false.)
+    call ctx_release(ic)
   
 end subroutine genreltrans
 !-----------------------------------------------------------------------
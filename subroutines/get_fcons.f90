@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function get_fcons(h,spin,zcos,Gamma,Dkpc,Mass,Anorm,nex,earx,photarx,dlogE)
+recursive function get_fcons(h,spin,zcos,Gamma,Dkpc,Mass,Anorm,nex,earx,photarx,dlogE)
 ! Fx(r) = fcons * eps_bol(r)
 ! fcons is in units of erg cm^{-2} s^{-1}
   implicit none
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function get_lacc(h,spin,zcos,Gamma,Dkpc,Mass,Anorm,nex,earx,photarx,dlogE)
+recursive function get_lacc(h,spin,zcos,Gamma,Dkpc,Mass,Anorm,nex,earx,photarx,dlogE)
 ! Returns accretion luminosity as a fraction of Eddington
   implicit none
   double precision             :: get_lacc
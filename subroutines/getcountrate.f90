@@ -1,39 +1,112 @@
 !-----------------------------------------------------------------------
 function getcountrate(E1,E2,nex,earx,photarx)
+! Count rate of photarx in the channels of RESP id 1 between E1 and E2.
+! This folds the whole spectrum for one range: to get the rate in many
+! ranges of the same spectrum, fold it once with foldcumrate and use cumrate
   use telematrix
   implicit none
   integer :: nex
-  real :: getcountrate,E1,E2,earx(0:nex),photarx(nex)
-  real,    allocatable :: spec(:)
-  integer :: I1,I2,i
-  
-!Read from response file
-  if( needresp )then
-     call initmatrix
-  end if
+  real :: getcountrate,E1,E2,earx(0:nex),photarx(nex),cumrate
+  double precision, allocatable :: cum(:)
+  integer :: m
+
+!Read from response file (RESP id 1)
+  call loadresp(1)
+  m = respslot(1)
+
+  allocate(cum(0:rsp(m)%numchn))
+  call foldcumrate(nex,earx,photarx,cum)
+  getcountrate = cumrate(E1,E2,cum)
+  deallocate(cum)
+
+  return
+end function getcountrate
+!-----------------------------------------------------------------------
 
-!Allocate spectrum array
-  if( .not. allocated(spec) ) allocate(spec(numchn))
+!-----------------------------------------------------------------------
+subroutine foldcumrate(nex,earx,photarx,cum)
+! Folds photarx around the response of RESP id 1 and returns the running
+! sum of the count rate over channels, cum(0:numchn), with cum(0)=0.
+! Double precision so that the difference of two entries keeps the
+! accuracy of a direct sum over the channels in between
+  use telematrix
+  implicit none
+  integer :: nex
+  real :: earx(0:nex),photarx(nex)
+  double precision :: cum(0:*)
+  real, allocatable :: spec(:)
+  integer :: i,m
 
-!Convert energy range to channel range
-  I1 = 1
-  I2 = numchn
-  do i = 0, numchn
-     if( echn(i) .lt. E1 ) I1 = i
-     if( echn(i) .le. E2 ) I2 = i
+  call loadresp(1)
+  m = respslot(1)
+  allocate(spec(rsp(m)%numchn))
+  call fold(m, nex, earx, photarx, spec)
+  cum(0) = 0.d0
+  do i = 1,rsp(m)%numchn
+     cum(i) = cum(i-1) + dble(spec(i))
   end do
+  deallocate(spec)
+
+  return
+end subroutine foldcumrate
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+function cumrate(E1,E2,cum)
+! Count rate between E1 and E2 from the running sum made by foldcumrate.
+! Same channel range as getcountrate always used: from the channel after
+! the last edge below E1 to the last channel with upper edge <= E2.
+! The edges are sorted, so the channels are found by bisection.
+  use telematrix
+  implicit none
+  real :: cumrate,E1,E2
+  double precision :: cum(0:*)
+  integer :: I1,I2,m,nchn,lastedge
+
+  m    = respslot(1)
+  nchn = rsp(m)%numchn
+  I1 = lastedge(nchn,rsp(m)%echn,E1,.false.)
+  if( I1 .lt. 0 ) I1 = 1
+  I2 = lastedge(nchn,rsp(m)%echn,E2,.true.)
+  if( I2 .lt. 0 ) I2 = nchn
   I1 = I1 + 1
   if( I1 .gt. I2 ) I2 = I1
-  
-! Fold photarx spectrum around response matrix
-  call fold(nex, earx, photarx, spec)
-  
-! Calculate count rate from spec
-  getcountrate = 0.0
-  do i = I1,I2
-     getcountrate = getcountrate + spec(i)
+  if( I2 .gt. nchn )then
+     !only possible when E1 is above all the channels
+     cumrate = 0.0
+     return
+  end if
+  cumrate = real( cum(I2) - cum(I1-1) )
+
+  return
+end function cumrate
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+function lastedge(nchn,echn,E,orequal)
+! Largest i in 0..nchn with echn(i) < E (echn(i) <= E if orequal),
+! or -1 if there is none. echn must be increasing.
+  implicit none
+  integer :: lastedge,nchn,lo,hi,mid
+  real :: echn(0:nchn),E
+  logical :: orequal,below
+  lo = -1
+  hi = nchn + 1
+  !invariant: echn(lo) is below E, echn(hi) is not
+  do while( hi - lo .gt. 1 )
+     mid = ( lo + hi ) / 2
+     if( orequal )then
+        below = echn(mid) .le. E
+     else
+        below = echn(mid) .lt. E
+     end if
+     if( below )then
+        lo = mid
+     else
+        hi = mid
+     end if
   end do
-  
+  lastedge = lo
   return
-end function getcountrate
+end function lastedge
 !-----------------------------------------------------------------------
@@ -1,5 +1,5 @@
 !*****************************************************************************************************
-subroutine getdcos(a_spin,h,mudisk,n,nlp,rout,npts,r1,dcosdr,tc,cosd1,cosdout)
+recursive subroutine getdcos(a_spin,h,mudisk,n,nlp,rout,npts,r1,dcosdr,tc,cosd1,cosdout)
     ! INPUTS
     ! a_spin       Dimensionless spin parameter
     ! h            Height of on-axis, isotropically emitting source
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      subroutine getrgrid(rnmin,rnmax,mueff,nro,nphi,rn,domega)
+      recursive subroutine getrgrid(rnmin,rnmax,mueff,nro,nphi,rn,domega)
 ! Calculates an r-grid that will be used to define impact parameters
       implicit none
       integer nro,nphi,i
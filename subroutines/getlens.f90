@@ -1,5 +1,5 @@
 !*****************************************************************************************************
-      subroutine getlens(a_spin,h,muobs,lens,delt,cosdelta1)
+      recursive subroutine getlens(a_spin,h,muobs,lens,delt,cosdelta1)
 ! Routine to calculate the lensing factor l=d\cos\delta/d\cos(i)
 ! and the source to observer time lag.
 ! Both calculations need us to know the delta value for the geodesic
@@ -68,7 +68,7 @@
 
 
 !-----------------------------------------------------------------------
-      subroutine getlimits(sins,mus,a_spin,h,velocity,muobs,x1,x2)
+      recursive subroutine getlimits(sins,mus,a_spin,h,velocity,muobs,x1,x2)
 ! Minimisation routine will numerically calculate cosdelta for a given cosi.
 ! To do that, we need limits that bracket only one root. 
 ! This routine works out sensible limits
@@ -97,7 +97,7 @@
 
       
 !-----------------------------------------------------------------------
-      function cosidel(cosdelta,sins,mus,a_spin,h,velocity)
+      recursive function cosidel(cosdelta,sins,mus,a_spin,h,velocity)
 ! Inputs:
 ! cosdelta,sins,mus,a_spin,h,velocity
         
@@ -0,0 +1,118 @@
+!-----------------------------------------------------------------------
+      recursive subroutine GRtrace_cached(nro,nphi,rn,mueff,mu0,spin,rmin,rout,mudisk,d)
+! Wrapper around GRtrace that keeps the traced camera (re1, taudo1, pem1
+! in dyn_gr) on disk. Tracing takes seconds per geometry and every fit
+! worker repeats it, so a geometry traced once is read back instead.
+! The cache is only used if the environment variable RELTRANS_GRCACHE
+! is set to a (writable) directory. One file per (spin,mu0,rout,mudisk,nro,nphi)
+! is written there; the header stores the full key plus the camera grid and
+! it is checked exactly on load, so a stale or mismatched file is simply re-traced.
+! If a camera library covers the geometry (RELTRANS_GRLIB, see grlibrary.f90)
+! the camera is interpolated from it instead and nothing is traced.
+        use dyn_gr
+      implicit none
+      integer nro,nphi
+      double precision rn(nro),mueff,mu0,spin,rmin,rout,mudisk,d
+      character (len=500) cachedir,strenv,fname
+      character (len=200) envnm
+      logical loaded
+      call grlib_interp(nro,nphi,rn,mu0,spin,rout,mudisk,d,loaded)
+      if( loaded ) return
+      envnm    = 'RELTRANS_GRCACHE'
+      cachedir = strenv(envnm)
+      if( trim(cachedir) .eq. 'none' )then
+        call GRtrace(nro,nphi,rn,mueff,mu0,spin,rmin,rout,mudisk,d)
+        return
+      end if
+      call grcache_name(cachedir,nro,nphi,mu0,spin,rout,mudisk,fname)
+      call grcache_read(fname,nro,nphi,rn,mu0,spin,rout,mudisk,d,loaded)
+      if( .not. loaded )then
+        call GRtrace(nro,nphi,rn,mueff,mu0,spin,rmin,rout,mudisk,d)
+        call grcache_write(fname,nro,nphi,rn,mu0,spin,rout,mudisk,d)
+      end if
+      return
+      end subroutine GRtrace_cached
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine grcache_name(cachedir,nro,nphi,mu0,spin,rout,mudisk,fname)
+! Builds the cache file name from the key. The name is only a readable
+! label: the exact key is stored in (and checked against) the file header.
+      implicit none
+      integer nro,nphi
+      double precision mu0,spin,rout,mudisk
+      character (len=500) cachedir,fname
+      character (len=16) sa,smu,sr,smd
+      write(sa ,'(F9.6)' ) spin
+      write(smu,'(F9.7)' ) mu0
+      write(sr ,'(ES12.5)') rout
+      write(smd,'(F9.7)' ) mudisk
+      write(fname,'(A,A,A,A,A,A,A,A,A,A,I0,A,I0,A)') trim(cachedir),'/grtrace_a',trim(adjustl(sa)),&
+           '_mu',trim(adjustl(smu)),'_rout',trim(adjustl(sr)),'_mud',trim(adjustl(smd)),'_',nro,'x',nphi,'.bin'
+      return
+      end subroutine grcache_name
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine grcache_read(fname,nro,nphi,rn,mu0,spin,rout,mudisk,d,loaded)
+! Reads re1, taudo1 and pem1 from the cache file fname. The camera size,
+! the geometry (spin, mu0, rout, mudisk, d) and the impact parameters rn
+! must all match exactly, otherwise loaded=.false. and the camera is
+! traced again.
+        use dyn_gr
+      implicit none
+      integer nro,nphi
+      double precision rn(nro),mu0,spin,rout,mudisk,d
+      character (len=500) fname
+      logical loaded
+      integer unit,ios,nrof,nphif
+      double precision keyf(5),rnf(nro)
+      loaded = .false.
+      call cachefile_openr(fname,grcache_magic,grcache_version,unit,loaded)
+      if( .not. loaded ) return
+      loaded = .false.
+      read(unit,iostat=ios) nrof,nphif
+      if( ios .ne. 0 .or. nrof .ne. nro .or. nphif .ne. nphi )then
+        close(unit)
+        return
+      end if
+      read(unit,iostat=ios) keyf,rnf
+      if( ios .ne. 0 .or. keyf(1) .ne. spin .or. keyf(2) .ne. mu0 .or. keyf(3) .ne. rout &
+           .or. keyf(4) .ne. mudisk .or. keyf(5) .ne. d .or. any( rnf .ne. rn ) )then
+        close(unit)
+        return
+      end if
+      read(unit,iostat=ios) pem1,re1,taudo1
+      close(unit)
+      if( ios .ne. 0 ) return
+      loaded = .true.
+      return
+      end subroutine grcache_read
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine grcache_write(fname,nro,nphi,rn,mu0,spin,rout,mudisk,d)
+! Stores the camera just traced for this geometry in fname, with the key
+! that grcache_read checks. If the directory is not writable the camera
+! is simply traced again next time. The temporary file is named after the
+! process, so threads write one at a time.
+        use dyn_gr
+      implicit none
+      integer nro,nphi
+      double precision rn(nro),mu0,spin,rout,mudisk,d
+      character (len=500) fname
+      character (len=520) tmpname
+      integer unit,ios
+      logical ok
+!$omp critical (reltrans_cachefile)
+      call cachefile_openw(fname,grcache_magic,grcache_version,tmpname,unit,ok)
+      if( ok )then
+        write(unit,iostat=ios) nro,nphi
+        if( ios .eq. 0 ) write(unit,iostat=ios) spin,mu0,rout,mudisk,d,rn
+        if( ios .eq. 0 ) write(unit,iostat=ios) pem1,re1,taudo1
+        call cachefile_close(unit,tmpname,fname,ios)
+      end if
+!$omp end critical (reltrans_cachefile)
+      return
+      end subroutine grcache_write
+!-----------------------------------------------------------------------
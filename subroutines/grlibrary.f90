@@ -0,0 +1,375 @@
+!-----------------------------------------------------------------------
+      recursive subroutine grlib_interp(nro,nphi,rn,mu0,spin,rout,mudisk,d,loaded)
+! Fills re1, taudo1 and pem1 on the camera rn(nro) x nphi by bilinear
+! interpolation in (spin, inclination) between the four nodes of the
+! camera library around (spin, mu0). Each node was traced on its own
+! camera, since rnmin=rfunc(spin,mu0) and mueff=max(mu0,0.3) depend on the
+! geometry, so every node is first resampled onto rn: pixels have the same
+! phin and scaled radius rn (alpha = rn sin(phin), beta = -mueff rn
+! cos(phin)), linearly interpolated in rn between the two node pixels
+! around it, or the nearest one where only one of them hits the disk.
+! Below the rnmin of a node the node sees no disk. Where the four nodes do
+! not agree on whether the pixel hits the disk the nearest node is used.
+! loaded=.false. if there is no library, or if it was made for another
+! rout, h/r, camera size, rnmax or distance, if rn is not the camera of
+! rtrans for (spin, mu0), if the library does not cover (spin, mu0) or if
+! the error measured at the centre of the cell is above RELTRANS_GRLIB_TOL:
+! the camera is then traced as usual. Only the camera is interpolated: the
+! kernels are still computed by rtrans for the actual source.
+        use dyn_gr
+      implicit none
+      integer nro,nphi
+      double precision rn(nro),mu0,spin,rout,mudisk,d
+      logical loaded
+      integer ia,ii,i,j,k,kmax,ka(4),ki(4),il(nro,4)
+      double precision inc,ta,ti,w(4),tl(nro,4),rnk(nro),domega(nro)
+      double precision mun,rfunc
+      real re(4),tau(4),rea,reb,get_env_real
+      double precision, parameter :: rtol = 1.d-6, pi = acos(-1.d0)
+      loaded = .false.
+! The library is read once and then shared, read-only, by all threads
+!$omp critical (reltrans_grlib)
+      if( grlib_state .eq. 0 ) call grlib_load(nro,nphi)
+      if( grlib_tol .lt. 0.d0 ) grlib_tol = dble( get_env_real("RELTRANS_GRLIB_TOL",0.01) )
+!$omp end critical (reltrans_grlib)
+      if( grlib_state .ne. 1 ) return
+      if( abs(rout-grlib_key(1)) .gt. rtol*rout ) return
+      if( abs(mudisk-grlib_key(2)) .gt. rtol ) return
+      if( abs(d-grlib_key(3)) .gt. rtol*d ) return
+      call getrgrid(rfunc(spin,mu0),grlib_key(4),max(mu0,0.3d0),nro,nphi,rnk,domega)
+      if( any( abs(rn-rnk) .gt. rtol*rnk ) ) return
+      inc = acos(mu0) * 180.d0 / pi
+      if( spin .lt. grlib_a(1)   .or. spin .gt. grlib_a(grlib_na)   ) return
+      if( inc  .lt. grlib_inc(1) .or. inc  .gt. grlib_inc(grlib_ni) ) return
+      ia = 1
+      do while( ia .lt. grlib_na-1 .and. grlib_a(ia+1) .lt. spin )
+        ia = ia + 1
+      end do
+      ii = 1
+      do while( ii .lt. grlib_ni-1 .and. grlib_inc(ii+1) .lt. inc )
+        ii = ii + 1
+      end do
+      if( grlib_err(ia,ii) .gt. grlib_tol ) return
+      ta = ( spin - grlib_a(ia)   ) / ( grlib_a(ia+1)   - grlib_a(ia)   )
+      ti = ( inc  - grlib_inc(ii) ) / ( grlib_inc(ii+1) - grlib_inc(ii) )
+      ka = (/ ia, ia+1, ia, ia+1 /)
+      ki = (/ ii, ii, ii+1, ii+1 /)
+      w  = (/ (1.d0-ta)*(1.d0-ti), ta*(1.d0-ti), (1.d0-ta)*ti, ta*ti /)
+      kmax = maxloc( w, 1 )
+! Position of rn on the camera of each node: between its pixels il and
+! il+1, at fraction tl (il=0: inside the rnmin of the node)
+      do k = 1,4
+        mun = cos( grlib_inc(ki(k)) * pi / 180.d0 )
+        call getrgrid(rfunc(grlib_a(ka(k)),mun),grlib_key(4),max(mun,0.3d0),nro,nphi,rnk,domega)
+        j = 1
+        do i = 1,nro
+          if( rn(i) .lt. rfunc(grlib_a(ka(k)),mun) )then
+            il(i,k) = 0
+            tl(i,k) = 0.d0
+          else if( rn(i) .le. rnk(1) )then
+            il(i,k) = 1
+            tl(i,k) = 0.d0
+          else if( rn(i) .ge. rnk(nro) )then
+            il(i,k) = nro - 1
+            tl(i,k) = 1.d0
+          else
+            do while( rnk(j+1) .lt. rn(i) )
+              j = j + 1
+            end do
+            il(i,k) = j
+            tl(i,k) = ( rn(i) - rnk(j) ) / ( rnk(j+1) - rnk(j) )
+          end if
+        end do
+      end do
+!$omp parallel do collapse(2) default(shared) private(i,j,k,re,tau,rea,reb) &
+!$omp copyin(re1,taudo1,pem1)
+      do i = 1,nro
+        do j = 1,nphi
+          do k = 1,4
+            re(k)  = 0.0
+            tau(k) = 0.0
+            if( il(i,k) .eq. 0 ) cycle
+            rea = grlib_re(j,il(i,k)  ,ka(k),ki(k))
+            reb = grlib_re(j,il(i,k)+1,ka(k),ki(k))
+            if( rea .gt. 0.0 .and. reb .gt. 0.0 )then
+              re(k)  = real( (1.d0-tl(i,k)) * rea + tl(i,k) * reb )
+              tau(k) = real( (1.d0-tl(i,k)) * grlib_tau(j,il(i,k),ka(k),ki(k)) &
+                           + tl(i,k) * grlib_tau(j,il(i,k)+1,ka(k),ki(k)) )
+            else if( tl(i,k) .lt. 0.5d0 )then
+              re(k)  = rea
+              tau(k) = grlib_tau(j,il(i,k),ka(k),ki(k))
+            else
+              re(k)  = reb
+              tau(k) = grlib_tau(j,il(i,k)+1,ka(k),ki(k))
+            end if
+          end do
+          if( all( re .gt. 0.0 .or. w .eq. 0.d0 ) )then
+            re1(j,i)    = sum( w * re  )
+            taudo1(j,i) = sum( w * tau )
+            pem1(j,i)   = 1.d0
+          else if( re(kmax) .gt. 0.0 )then
+            re1(j,i)    = re(kmax)
+            taudo1(j,i) = tau(kmax)
+            pem1(j,i)   = 1.d0
+          else
+            re1(j,i)    = 0.d0
+            taudo1(j,i) = 0.d0
+            pem1(j,i)   = -1.d0
+          end if
+        end do
+      end do
+!$omp end parallel do
+      loaded = .true.
+      return
+      end subroutine grlib_interp
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine grlib_load(nro,nphi)
+! Reads the whole camera library named by RELTRANS_GRLIB into dyn_gr
+! (grlib_state=1), or sets grlib_state=-1 if the variable is not set or the
+! file cannot be used. Layout (unformatted stream): magic, nro, nphi, na, ni,
+! rout, mudisk, d, rnmax, spins(na), inclinations(ni) in degrees, the error
+! of each cell (na-1,ni-1), then re and taudo (single precision, re=0 where
+! the pixel misses the disk) of every node, spin running fastest, each on
+! the camera rtrans uses for it.
+        use dyn_gr
+      implicit none
+      integer nro,nphi
+      character (len=500) fname,strenv
+      character (len=200) envnm
+      character (len=8) magic
+      integer unit,ios,nrof,nphif,ia,ii
+      grlib_state = -1
+      envnm = 'RELTRANS_GRLIB'
+      fname = strenv(envnm)
+      if( trim(fname) .eq. 'none' ) return
+      open(newunit=unit,file=trim(fname),access='stream',form='unformatted',&
+           status='old',action='read',iostat=ios)
+      if( ios .ne. 0 )then
+        write(*,*)"Warning! Cannot open GR camera library ",trim(fname)
+        return
+      end if
+      read(unit,iostat=ios) magic,nrof,nphif,grlib_na,grlib_ni
+      if( ios .ne. 0 .or. magic .ne. grlib_magic .or. nrof .ne. nro .or. nphif .ne. nphi &
+           .or. grlib_na .lt. 2 .or. grlib_ni .lt. 2 )then
+        write(*,*)"Warning! ",trim(fname)," is not a GR camera library for this camera"
+        close(unit)
+        return
+      end if
+      allocate( grlib_a(grlib_na), grlib_inc(grlib_ni), grlib_err(grlib_na-1,grlib_ni-1) )
+      allocate( grlib_re(nphi,nro,grlib_na,grlib_ni), grlib_tau(nphi,nro,grlib_na,grlib_ni) )
+      read(unit,iostat=ios) grlib_key,grlib_a,grlib_inc,grlib_err
+      do ii = 1,grlib_ni
+        do ia = 1,grlib_na
+          if( ios .eq. 0 ) read(unit,iostat=ios) grlib_re(:,:,ia,ii),grlib_tau(:,:,ia,ii)
+        end do
+      end do
+      close(unit)
+      if( ios .ne. 0 )then
+        write(*,*)"Warning! Cannot read GR camera library ",trim(fname)
+        deallocate( grlib_a, grlib_inc, grlib_err, grlib_re, grlib_tau )
+        return
+      end if
+      grlib_state = 1
+      write(*,*)"GR camera library: ",grlib_na," spins x",grlib_ni," inclinations,",&
+                " largest cell error",maxval(grlib_err)
+      return
+      end subroutine grlib_load
+!-----------------------------------------------------------------------
+
+
+!-----------------------------------------------------------------------
+      subroutine grlib_build(fname,nro,nphi,rnmax,na,amin,amax,ni,incmin,incmax,rout,honr)
+! Traces the camera of rtrans on na x ni nodes, evenly spaced in spin
+! (amin..amax) and inclination (incmin..incmax, degrees), then at the
+! centre of every cell, where it is compared with the camera interpolated
+! from the four nodes to give the error of the cell (see grlib_compare),
+! and writes the library fname (layout in grlib_load). rout and h/r are
+! fixed for the whole library. Geometries already in the GR cache
+! (RELTRANS_GRCACHE) are not traced again.
+        use dyn_gr
+      implicit none
+      integer nro,nphi,na,ni
+      double precision rnmax,amin,amax,incmin,incmax,rout,honr
+      character (len=500) fname
+      integer unit,ios,ia,ii,nhit,nbad
+      double precision d,mudisk,rn(nro),domega(nro),ac,incc,ere,etau
+      double precision ret(nphi,nro),taut(nphi,nro)
+      logical loaded
+      double precision, parameter :: pi = acos(-1.d0)
+      d      = max( 1.0d4 , 2.0d2 * rnmax**2 )      !as in initialiser
+      mudisk = honr / sqrt( honr**2 + 1.d0 )
+      if( allocated(grlib_a) ) deallocate( grlib_a, grlib_inc, grlib_err, grlib_re, grlib_tau )
+      allocate( grlib_a(na), grlib_inc(ni), grlib_err(na-1,ni-1) )
+      allocate( grlib_re(nphi,nro,na,ni), grlib_tau(nphi,nro,na,ni) )
+      grlib_na  = na
+      grlib_ni  = ni
+      grlib_key = (/ rout, mudisk, d, rnmax /)
+      do ia = 1,na
+        grlib_a(ia) = amin + (amax-amin) * dble(ia-1) / dble(max(na-1,1))
+      end do
+      do ii = 1,ni
+        grlib_inc(ii) = incmin + (incmax-incmin) * dble(ii-1) / dble(max(ni-1,1))
+      end do
+      if( associated(re1) ) deallocate( re1, taudo1, pem1 )
+      allocate( re1(nphi,nro), taudo1(nphi,nro), pem1(nphi,nro) )
+      grlib_state = -1      !trace the nodes, do not interpolate them from another library
+      do ii = 1,ni
+        do ia = 1,na
+          write(*,*)"Tracing spin, inclination =",grlib_a(ia),grlib_inc(ii)
+          call grlib_trace(nro,nphi,rnmax,grlib_a(ia),grlib_inc(ii),rout,mudisk,d,rn,domega)
+          grlib_re(:,:,ia,ii)  = real( re1 )
+          grlib_tau(:,:,ia,ii) = real( taudo1 )
+        end do
+      end do
+! Error of each cell, interpolating from the nodes just traced
+      grlib_state = 1
+      grlib_tol   = huge(1.d0)
+      do ii = 1,ni-1
+        do ia = 1,na-1
+          ac   = 0.5d0 * ( grlib_a(ia) + grlib_a(ia+1) )
+          incc = 0.5d0 * ( grlib_inc(ii) + grlib_inc(ii+1) )
+          write(*,*)"Checking spin, inclination =",ac,incc
+          call grlib_trace(nro,nphi,rnmax,ac,incc,rout,mudisk,d,rn,domega)
+          ret  = re1
+          taut = taudo1
+          call grlib_interp(nro,nphi,rn,cos(incc*pi/180.d0),ac,rout,mudisk,d,loaded)
+          grlib_err(ia,ii) = huge(1.d0)
+          if( loaded ) call grlib_compare(nro,nphi,domega,ret,taut,nhit,nbad,ere,etau,grlib_err(ia,ii))
+        end do
+      end do
+      grlib_state = -1
+      grlib_tol   = -1.d0
+      open(newunit=unit,file=trim(fname),access='stream',form='unformatted',&
+           status='replace',action='write',iostat=ios)
+      if( ios .ne. 0 )then
+        write(*,*)"Cannot write ",trim(fname)
+        return
+      end if
+      write(unit) grlib_magic,nro,nphi,na,ni
+      write(unit) grlib_key,grlib_a,grlib_inc,grlib_err
+      do ii = 1,ni
+        do ia = 1,na
+          write(unit) grlib_re(:,:,ia,ii),grlib_tau(:,:,ia,ii)
+        end do
+      end do
+      close(unit)
+      write(*,*)"Largest cell error:",maxval(grlib_err)
+      return
+      end subroutine grlib_build
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      subroutine grlib_trace(nro,nphi,rnmax,spin,inc,rout,mudisk,d,rn,domega)
+! Traces the camera of rtrans for (spin, inc in degrees) into re1, taudo1
+! and pem1 (re1=0 where the pixel misses the disk), never interpolating it
+! from the library, and returns the camera rn, domega
+        use dyn_gr
+      implicit none
+      integer nro,nphi
+      double precision rnmax,spin,inc,rout,mudisk,d,rn(nro),domega(nro)
+      integer ist
+      double precision mu0,mueff,rfunc,disco
+      double precision, parameter :: pi = acos(-1.d0)
+      mu0   = cos( inc * pi / 180.d0 )
+      mueff = max( mu0 , 0.3d0 )
+      call getrgrid(rfunc(spin,mu0),rnmax,mueff,nro,nphi,rn,domega)
+      ist = grlib_state
+      grlib_state = -1
+      call GRtrace_cached(nro,nphi,rn,mueff,mu0,spin,disco(spin),rout,mudisk,d)
+      grlib_state = ist
+      where( pem1 .le. 0.d0 ) re1 = 0.d0
+      return
+      end subroutine grlib_trace
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      subroutine grlib_compare(nro,nphi,domega,ret,taut,nhit,nbad,ere,etau,err)
+! Compares the interpolated camera in re1, taudo1, pem1 with the traced one
+! ret, taut (ret=0 where it misses the disk). nhit pixels hit the disk in
+! both and nbad in only one; ere and etau are the means over the solid
+! angle of the nhit pixels of |re/re_traced-1| and |taudo-taudo_traced|/
+! re_traced. err, the error RELTRANS_GRLIB_TOL is compared with, is the
+! mean of |re/re_traced-1| (at most 1) over the solid angle of the pixels
+! on the disk in either camera, the nbad pixels counting as 1.
+        use dyn_gr
+      implicit none
+      integer nro,nphi,nhit,nbad
+      double precision domega(nro),ret(nphi,nro),taut(nphi,nro),ere,etau,err
+      integer i,j
+      double precision whit,wbad,e
+      nbad = 0
+      nhit = 0
+      ere  = 0.d0
+      etau = 0.d0
+      err  = 0.d0
+      whit = 0.d0
+      wbad = 0.d0
+      do i = 1,nro
+        do j = 1,nphi
+          if( ( ret(j,i) .gt. 0.d0 ) .neqv. ( pem1(j,i) .gt. 0.d0 ) )then
+            nbad = nbad + 1
+            wbad = wbad + domega(i)
+          else if( ret(j,i) .gt. 0.d0 )then
+            nhit = nhit + 1
+            e    = abs( re1(j,i) / ret(j,i) - 1.d0 )
+            ere  = ere  + domega(i) * e
+            err  = err  + domega(i) * min( e, 1.d0 )
+            etau = etau + domega(i) * abs( taudo1(j,i) - taut(j,i) ) / ret(j,i)
+            whit = whit + domega(i)
+          end if
+        end do
+      end do
+      err  = ( err + wbad ) / max( whit + wbad, tiny(whit) )
+      ere  = ere  / max( whit, tiny(whit) )
+      etau = etau / max( whit, tiny(whit) )
+      return
+      end subroutine grlib_compare
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      subroutine grlib_check(nro,nphi,rnmax,spin,inc,rout,honr)
+! Compares the camera interpolated from the library RELTRANS_GRLIB at
+! (spin, inc) with the one traced directly, on the camera of rtrans, and
+! prints the results of grlib_compare next to the error stored for the
+! cell. Meant for geometries between the nodes of the library; the
+! tolerance is ignored here.
+        use dyn_gr
+      implicit none
+      integer nro,nphi
+      double precision rnmax,spin,inc,rout,honr
+      integer ia,ii,nhit,nbad
+      double precision d,mudisk,rn(nro),domega(nro),ere,etau,err
+      double precision ret(nphi,nro),taut(nphi,nro)
+      logical loaded
+      double precision, parameter :: pi = acos(-1.d0)
+      d      = max( 1.0d4 , 2.0d2 * rnmax**2 )      !as in initialiser
+      mudisk = honr / sqrt( honr**2 + 1.d0 )
+      if( associated(re1) ) deallocate( re1, taudo1, pem1 )
+      allocate( re1(nphi,nro), taudo1(nphi,nro), pem1(nphi,nro) )
+      call grlib_trace(nro,nphi,rnmax,spin,inc,rout,mudisk,d,rn,domega)
+      ret  = re1
+      taut = taudo1
+      grlib_tol = huge(1.d0)
+      call grlib_interp(nro,nphi,rn,cos(inc*pi/180.d0),spin,rout,mudisk,d,loaded)
+      if( .not. loaded )then
+        write(*,*)"The library does not cover this geometry"
+        return
+      end if
+      call grlib_compare(nro,nphi,domega,ret,taut,nhit,nbad,ere,etau,err)
+      ia = 1
+      do while( ia .lt. grlib_na-1 .and. grlib_a(ia+1) .lt. spin )
+        ia = ia + 1
+      end do
+      ii = 1
+      do while( ii .lt. grlib_ni-1 .and. grlib_inc(ii+1) .lt. inc )
+        ii = ii + 1
+      end do
+      write(*,*)"Pixels on the disk:",nhit,", hit/miss disagreements:",nbad
+      write(*,*)"Mean |re/re_traced-1|:",ere
+      write(*,*)"Mean |taudo-taudo_traced|/re:",etau
+      write(*,*)"Error here:",err,", stored for the cell (centre):",grlib_err(ia,ii)
+      return
+      end subroutine grlib_check
+!-----------------------------------------------------------------------
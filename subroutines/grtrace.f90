@@ -1,7 +1,12 @@
 !-----------------------------------------------------------------------
-      subroutine GRtrace(nro,nphi,rn,mueff,mu0,spin,rmin,rout,mudisk,d)
+      recursive subroutine GRtrace(nro,nphi,rn,mueff,mu0,spin,rmin,rout,mudisk,d)
 ! Traces rays in full GR for the camera defined by rn(nro), nro, nphi
 ! to convert alpha and beta to r and tau_do (don't care about phi)
+! Every pixel is independent, so the camera is split over OpenMP threads.
+! The YNOGK routines are recursive (automatic locals) and keep their SAVE
+! caches threadprivate, so the result is identical to the serial trace.
+! The camera arrays are threadprivate pointers (see dyn_gr): copyin hands
+! those of the calling thread to the team.
         use dyn_gr
         use blcoordinate
       implicit none
@@ -15,6 +20,9 @@
       velocity = 0.d0
       taudo1   = 0.0
       re1      = 0.0      
+!$omp parallel do collapse(2) schedule(dynamic) default(shared) &
+!$omp private(i,j,phin,alpha,beta,f1234,lambda,q,pem,re,mucros,phie,taudo,sigmacros) &
+!$omp copyin(re1,taudo1,pem1)
       do i = 1,nro
         do j = 1,NPHI
           phin  = (j-0.5) * 2.d0 * pi / dble(nphi)
@@ -32,6 +40,7 @@
           end if
         end do
       end do
+!$omp end parallel do
       return
       end subroutine GRtrace
 !-----------------------------------------------------------------------
@@ -1,6 +1,7 @@
 include 'subroutines/continuum/getcont.f90'
 include 'subroutines/continuum/init_cont.f90'
 
+include 'subroutines/utils/cachefile.f90'
 include 'subroutines/utils/conv_one_FFT.f90'
 include 'subroutines/utils/crebin.f90'
 include 'subroutines/utils/four1.f90'
@@ -20,6 +21,8 @@ include 'subroutines/rest_frame_reflection/get_reflionx.f90'
 include 'subroutines/rest_frame_reflection/get_xillver.f90'
 include 'subroutines/rest_frame_reflection/normreflionx.f90'
 include 'subroutines/rest_frame_reflection/rest_frame.f90'
+include 'subroutines/rest_frame_reflection/rest_frame_cached.f90'
+include 'subroutines/rest_frame_reflection/xillver_grid.f90'
 
 include 'subroutines/radial_profiles/interper.f90'
 include 'subroutines/radial_profiles/logxiraw.f90'
@@ -44,6 +47,7 @@ include 'subroutines/dpolint.f90'
 include 'subroutines/drandphithick.f90'
 include 'subroutines/drtbis.f90'
 include 'subroutines/Eintegrate.f90'
+include 'subroutines/emulator.f90'
 include 'subroutines/fold.f90'
 include 'subroutines/four.f90'
 include 'subroutines/genreltrans.f90'
@@ -53,7 +57,9 @@ include 'subroutines/get_fcons.f90'
 include 'subroutines/get_lacc.f90'
 include 'subroutines/getgrid.f90'
 include 'subroutines/getlens.f90'
+include 'subroutines/grcache.f90'
 include 'subroutines/GR_factors.f90'
+include 'subroutines/grlibrary.f90'
 include 'subroutines/grtrace.f90'
 include 'subroutines/initialiser.f90'
 include 'subroutines/isco.f90'
@@ -69,7 +75,9 @@ include 'subroutines/rawG.f90'
 include 'subroutines/rawS.f90'
 include 'subroutines/resproutines.f90'
 include 'subroutines/rfunc.f90'
+include 'subroutines/rspcache.f90'
 include 'subroutines/set_param.f90'
+include 'subroutines/simspectra.f90'
 include 'subroutines/sizecheck.f90'
 include 'subroutines/sourcelum.f90'
 include 'subroutines/strans.f90'
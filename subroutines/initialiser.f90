@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,needtrans,me,xe,refvar,ionvar,nlp,verbose, test)
+recursive subroutine initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,me,xe,refvar,ionvar,nlp,verbose, test)
 !!!  Initialises the model and writes the header
 !!!------------------------------------------------------------------
   !    Args:
@@ -8,10 +8,11 @@ subroutine initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,needtrans,me,xe,re
   !        dloge: logarithmic resolution of the internal energy grid
   !        earx:  internal energy grid array (0:nex) [nex is shared variable in conv_mod]
   !        d, rnmax: distance of the source, max radius for which GR ray tracing is used
-  !        needtrans: check if transfer function has to be calculated
   !        me, xe: number of angle and radial zones
   !        verbose: check if the verbose env variable is active
   !        nphi, nro: (constant) resolution variables, number of pixels on the observer's camera(b and phib)
+  !    Everything set here is shared by all threads and contexts: genreltrans calls this in the
+  !    reltrans_init critical section. The arrays of a context are allocated by init_gr_arrays
 
   !    Internal variables:
   !        i: loop index
@@ -22,8 +23,6 @@ subroutine initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,needtrans,me,xe,re
   use dyn_gr
   use env_variables
   use xillver_tables
-  use radial_grids
-  use gr_continuum
       implicit none
       integer          , intent(out)   :: xe,me,refvar,ionvar,verbose
       integer          , intent(in)    :: nlp !constant
@@ -31,19 +30,17 @@ subroutine initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,needtrans,me,xe,re
       real             , intent(out)   :: dloge, earx(0:nex)
       double precision , intent(in)    :: rnmax
       double precision , intent(out)   :: d
-      logical          , intent(inout) :: firstcall, needtrans, test
+      logical          , intent(inout) :: firstcall, test
       integer i, env_test
       integer get_env_int
       character (len=200) :: get_env_char
  
-      needtrans = .false.     
       if( firstcall )then
 
 !call the initializer of the FFtw convolution
 ! the function is in amodules.f90 it sets the structure for the FFTw       
         call init_fftw_allconv() 
          
-        needtrans = .true.
         write(*,*)"----------------------------------------------------"
         write(*,*)"This is RELTRANS v1.0.0: a transfer function model for"
         write(*,*)"X-ray reverberation mapping."
@@ -74,6 +71,8 @@ subroutine initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,needtrans,me,xe,re
         refvar = get_env_int("REF_VAR",1)         !choose whether to include pivoting reflection
         ionvar = get_env_int("ION_VAR",1)         !choose whether to include ionization changes
         idum = get_env_int("SEED_SIM", -2851043)  !seed for simulations
+        simseed = idum                            !idum changes with every draw, this does not
+        nsimreal = max( get_env_int("RELTRANS_NSIM", 0) , 0 ) !realisations per simrtdist call
 
         write(*,*) 'RADIAL ZONES', xe
         write(*,*) 'ANGLE ZONES', me
@@ -111,28 +110,52 @@ subroutine initialiser(firstcall,Emin,Emax,dloge,earx,rnmax,d,needtrans,me,xe,re
         write(*,'(A, A)') 'Set the XILLVER table to ', trim(pathname_xillver)
         write(*,'(A, A)') 'Set the high density XILLVER table to ', trim(pathname_xillverD)
         write(*,'(A, A)') 'Set the nthComp, high density XILLVER table to ', trim(pathname_xillverDCp)
+        xillver_native = get_env_int("RELTRANS_XILLVER_NATIVE", 1)   !1: keep the table in memory, 0: use xsatbl
         
         firstcall = .false.
 
-        !Allocate some useful arrays
+     end if
+     return
+    end subroutine initialiser
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine init_gr_arrays(nlp,xe)
+!!!  Allocates the radial profile and GR arrays of the current context
+!!!------------------------------------------------------------------
+  !    Args:
+  !        nlp: number of lampposts
+  !        xe: number of radial zones
+  !    The arrays are kept from one call to the next and only made again if nlp or xe changed
+!!!-------------------------------------------------------------------
+  use dyn_gr
+  use radial_grids
+  use gr_continuum
+      implicit none
+      integer, intent(in) :: nlp, xe
 
         !Allocate arrays for radial profiles 
+        if( allocated(logxir) )then
+           if( size(logxir) .ne. xe ) deallocate (dfer_arr, logxir, gsdr, logner)
+        end if
         if (.not. allocated (dfer_arr)) allocate (dfer_arr(xe))
         if (.not. allocated (logxir)  ) allocate (logxir  (xe))
         if (.not. allocated (gsdr)    ) allocate (gsdr    (xe))
         if (.not. allocated (logner)  ) allocate (logner  (xe))
 
         !Allocate GR arrays
-        if (.not. allocated (cosd)        ) allocate (cosd  (ndelta,nlp))
-        if (.not. allocated (dcosdr)      ) allocate (dcosdr(ndelta,nlp))
-        if (.not. allocated (rlp   )      ) allocate (rlp   (ndelta,nlp))
-        if (.not. allocated (tlp   )      ) allocate (tlp   (ndelta,nlp))
-        if (.not. allocated (npts)        ) allocate (npts  (       nlp))
-        if (.not. allocated (gso)         ) allocate (gso   (       nlp))
-        if (.not. allocated (tauso)       ) allocate (tauso (       nlp))
-        if (.not. allocated (cosdelta_obs)) allocate (cosdelta_obs(nlp))
+        if( associated(npts) )then
+           if( size(npts) .ne. nlp ) deallocate (cosd, dcosdr, rlp, tlp, npts, gso, tauso, cosdelta_obs)
+        end if
+        if (.not. associated (cosd)        ) allocate (cosd  (ndelta,nlp))
+        if (.not. associated (dcosdr)      ) allocate (dcosdr(ndelta,nlp))
+        if (.not. associated (rlp   )      ) allocate (rlp   (ndelta,nlp))
+        if (.not. associated (tlp   )      ) allocate (tlp   (ndelta,nlp))
+        if (.not. associated (npts)        ) allocate (npts  (       nlp))
+        if (.not. associated (gso)         ) allocate (gso   (       nlp))
+        if (.not. associated (tauso)       ) allocate (tauso (       nlp))
+        if (.not. associated (cosdelta_obs)) allocate (cosdelta_obs(nlp))
 
-     end if
      return
-    end subroutine initialiser
+    end subroutine init_gr_arrays
 !-----------------------------------------------------------------------
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      function dISCO(a)
+      recursive function dISCO(a)
       !ISCO in Rg 
       implicit none
       double precision a,dISCO,z1,z2
@@ -1,5 +1,5 @@
-subroutine lag_freq(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,&
-                    h,z,Gamma,eta,beta_p,boost,g,DelAB,ionvar,ReGraw,ImGraw)
+recursive subroutine lag_freq(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,&
+                    ReW3,ImW3,h,z,Gamma,eta,beta_p,boost,g,DelAB,ionvar,ReGraw,ImGraw)
 
 ! Calculates the energy-averaged cross spectrum in the energy bins of interest. REDO ALL THIS COMMENT IT'S WRONG
 !
@@ -20,7 +20,7 @@ subroutine lag_freq(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gs
     real                :: ReGrawEa,ImGrawEa,ReGrawEb,ImGrawEb
     real                :: E,fac,TempReG,TempImG 
     real                :: f,DelAB_nu,g_nu
-    real                :: tau_d,phase_d,tau_p,phase_p,beta,flo,fhi
+    real                :: tau_d,phase_d,tau_p,phase_p,beta,flo,fhi,etam
     complex             :: W0,W1,W2,W3,Sraw,cexp_p,cexp_d,cexp_phi,Stemp
     integer             :: i,j,m
 
@@ -29,16 +29,7 @@ subroutine lag_freq(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gs
     gslope = 1.
     ABslope = 1.
     
-    if(nlp .gt. 1) then
-        ReW0(2,:,:) = eta*ReW0(2,:,:)
-        ImW0(2,:,:) = eta*ImW0(2,:,:)
-        ReW1(2,:,:) = eta*ReW1(2,:,:)
-        ImW1(2,:,:) = eta*ImW1(2,:,:)
-        ReW2(2,:,:) = eta*ReW2(2,:,:)
-        ImW2(2,:,:) = eta*ImW2(2,:,:)
-        ReW3(2,:,:) = eta*ReW3(2,:,:)
-        ImW3(2,:,:) = eta*ImW3(2,:,:)
-    endif 
+    !the second lamp post is weighted by eta on the fly (etam), so that the W arrays are left untouched
     
     !Now calculate the cross-spectrum (/complex covariance), including absorption
     do j = 1, nf
@@ -70,10 +61,12 @@ subroutine lag_freq(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gs
                 cexp_phi = cmplx(cos(DelAB_nu),sin(DelAB_nu))  
                 !print*,m,cexp_d,cexp_p,cexp_phi,f*fconv           
                 !set up transfer functions 
-                W0 = boost * cmplx(ReW0(m,i,j),ImW0(m,i,j))
-                W1 = boost * cmplx(ReW1(m,i,j),ImW1(m,i,j))
-                W2 = boost * cmplx(ReW2(m,i,j),ImW2(m,i,j))                       
-                W3 = ionvar * boost * cmplx(ReW3(m,i,j),ImW3(m,i,j))
+                etam = 1.0
+                if (m .gt. 1) etam = eta
+                W0 = boost * cmplx(etam*ReW0(m,i,j),etam*ImW0(m,i,j))
+                W1 = boost * cmplx(etam*ReW1(m,i,j),etam*ImW1(m,i,j))
+                W2 = boost * cmplx(etam*ReW2(m,i,j),etam*ImW2(m,i,j))                       
+                W3 = ionvar * boost * cmplx(etam*ReW3(m,i,j),etam*ImW3(m,i,j))
                 !calculate complex covariance
                 !note: the reason we use complex here is to ease the calculations 
                 !when we add all the extra phases from the double lamp post 
@@ -109,10 +102,12 @@ subroutine lag_freq(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gs
                 cexp_p = cmplx(cos(phase_p),sin(phase_p)) 
                 cexp_phi = cmplx(cos(DelAB_nu),sin(DelAB_nu))             
                 !set up transfer functions 
-                W0 = boost * cmplx(ReW0(m,i,j),ImW0(m,i,j))
-                W1 = boost * cmplx(ReW1(m,i,j),ImW1(m,i,j))
-                W2 = boost * cmplx(ReW2(m,i,j),ImW2(m,i,j))                       
-                W3 = ionvar * boost * cmplx(ReW3(m,i,j),ImW3(m,i,j))
+                etam = 1.0
+                if (m .gt. 1) etam = eta
+                W0 = boost * cmplx(etam*ReW0(m,i,j),etam*ImW0(m,i,j))
+                W1 = boost * cmplx(etam*ReW1(m,i,j),etam*ImW1(m,i,j))
+                W2 = boost * cmplx(etam*ReW2(m,i,j),etam*ImW2(m,i,j))                       
+                W3 = ionvar * boost * cmplx(etam*ReW3(m,i,j),etam*ImW3(m,i,j))
                 !calculate complex covariance
                 !note: the reason we use complex here is to ease the calculations 
                 !when we add all the extra phases from the double lamp post 
@@ -134,7 +129,7 @@ subroutine lag_freq(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gs
     return
 end subroutine lag_freq
 
-subroutine lag_freq_nocoh(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,&
+recursive subroutine lag_freq_nocoh(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,&
                           ReW3,ImW3,h,z,Gamma,eta,boost,g,DelAB,ionvar,ReGraw,ImGraw)
                                 
     use constants
@@ -236,15 +231,117 @@ subroutine lag_freq_nocoh(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,ta
     return
 end subroutine lag_freq_nocoh
 
-subroutine energy_bounds(nex,Emin,Emax,Ea1,Ea2,Eb1,Eb2)
-    use telematrix 
+recursive subroutine lag_freq_bands(nex,earx,nf,fix,flo,fhi,Emin,Emax,nlp,contx,absorbx,tauso,gso,BW,&
+                          h,z,eta,beta_p,boost,g,DelAB,ionvar,ReGraw,ImGraw)
+! Same as lag_freq (or lag_freq_nocoh if nlp>1 and beta_p=0), but from the band sums
+! BW(m,j,k,ib) of the absorbed transfer functions Wk over the two bands (conv_zone_bands)
+! instead of the full W(E). The transfer functions only enter the cross spectrum through
+! their absorbed band sums, so the only per-energy work left is the continuum terms.
+    use constants
+    implicit none
+    integer, intent(in) :: nex,nf,ionvar,nlp
+    real   , intent(in) :: g(nlp),DelAB(nlp),boost,z,Emin,Emax,beta_p,eta
+    real   , intent(in) :: gso(nlp),tauso(nlp),h(nlp)
+    real   , intent(in) :: earx(0:nex),contx(nex,nlp),absorbx(nex),fix(0:nf),flo,fhi
+    complex, intent(in) :: BW(nlp,nf,0:3,2)
+    real,    intent(out):: ReGraw(nf),ImGraw(nf)
+    integer             :: ilo(2),ihi(2),i,j,m,ib
+    real                :: gslope,ABslope,E,fac,f,DelAB_nu,g_nu,tau_d,phase_d,tau_p,phase_p,etam
+    real                :: CA(nlp,2),FA(nlp,2)
+    complex             :: cexp_p,cexp_d,cexp_phi,S(2),Sm(2),Gab
+    logical             :: coh
+
+    call energy_bounds(nex,Emin,Emax,ilo(1),ihi(1),ilo(2),ihi(2))
+
+    gslope = 1.
+    ABslope = 1.
+    coh = nlp .eq. 1 .or. beta_p .ne. 0.
+
+    !Absorbed continuum and continuum*log(gso/E) summed over each band
+    do ib = 1,2
+        do m = 1,nlp
+            CA(m,ib) = 0.0
+            FA(m,ib) = 0.0
+            do i = ilo(ib), ihi(ib)
+                E = 0.5 * ( earx(i) + earx(i-1) )
+                fac = log(gso(m)/((1.0+z)*E))
+                CA(m,ib) = CA(m,ib) + contx(i,m) * absorbx(i)
+                FA(m,ib) = FA(m,ib) + fac * contx(i,m) * absorbx(i)
+            end do
+        end do
+    end do
+
+    do j = 1, nf
+        f = flo * (fhi/flo)**(  (real(j)-0.5) / real(nf) )
+        S = 0.
+        Gab = 0.
+        do m = 1,nlp
+            DelAB_nu = DelAB(m) * ((fix(1) + fix(0))*0.5/f)**ABslope
+            g_nu = g(m) * ((fix(1) + fix(0))*0.5/f)**gslope
+            phase_d = 0.
+            phase_p = 0.
+            if (m .gt. 1) then
+                tau_d = (tauso(m)-tauso(1))
+                phase_d = real( 2.d0*pi*dble(tau_d)*dble(f) )
+                if (coh) then
+                    tau_p = (h(m) - h(1))/(beta_p)
+                    phase_p = real( 2.d0*pi*dble(tau_p)*dble(f) )
+                end if
+            end if
+            cexp_d = cmplx(cos(phase_d),sin(phase_d))
+            cexp_p = cmplx(cos(phase_p),sin(phase_p))
+            cexp_phi = cmplx(cos(DelAB_nu),sin(DelAB_nu))
+            !the second lamp post is weighted by eta only in the coherent case, as in lag_freq
+            etam = 1.0
+            if (coh .and. m .gt. 1) etam = eta
+            do ib = 1,2
+                Sm(ib) = g_nu*cexp_phi*( boost*etam*(BW(m,j,1,ib) + BW(m,j,2,ib)) + cexp_d*FA(m,ib) )
+                Sm(ib) = Sm(ib) + boost*etam*( BW(m,j,0,ib) + ionvar*BW(m,j,3,ib) ) + cexp_d*CA(m,ib)
+            end do
+            if (coh) then
+                S = S + cexp_p*Sm
+            else if (m .eq. 1) then
+                Gab = Sm(1) * conjg(Sm(2))
+            else
+                Gab = Gab + eta**2. * Sm(1) * conjg(Sm(2))
+            end if
+        end do
+        !cross-spectrum between the two energy bands (the conjugate is b)
+        if (coh) Gab = S(1) * conjg(S(2))
+        ReGraw(j) = real(Gab)
+        ImGraw(j) = aimag(Gab)
+    end do
+
+    return
+end subroutine lag_freq_bands
+
+recursive subroutine band_weights(nex,Emin,Emax,absorbx,wband)
+! Weights of the two energy bands of the lag-frequency spectrum: the absorption
+! inside the band (see energy_bounds), zero outside
+    implicit none
+    integer, intent(in) :: nex
+    real   , intent(in) :: Emin,Emax,absorbx(nex)
+    real   , intent(out):: wband(nex,2)
+    integer             :: Ea1,Ea2,Eb1,Eb2
+    call energy_bounds(nex,Emin,Emax,Ea1,Ea2,Eb1,Eb2)
+    wband = 0.0
+    wband(Ea1:Ea2,1) = absorbx(Ea1:Ea2)
+    wband(Eb1:Eb2,2) = absorbx(Eb1:Eb2)
+    return
+end subroutine band_weights
+
+recursive subroutine energy_bounds(nex,Emin,Emax,Ea1,Ea2,Eb1,Eb2)
     implicit none
     integer, intent(in) :: nex
     integer, intent(out):: Ea1,Ea2,Eb1,Eb2 
     real, intent(in)    :: Emin,Emax
     real                :: band1_Elo,band1_Ehi,band2_Elo,band2_Ehi
     real     :: get_env_real, dum
+    logical  :: needchans = .true.
+    !the band energies are read once, by one thread; the indices are returned at every call
+    save band1_Elo,band1_Ehi,band2_Elo,band2_Ehi
      
+    !$omp critical (reltrans_refband)
     if( needchans ) then
         band1_Elo = get_env_real("EMIN_REF",0.0)
         band1_Ehi = get_env_real("EMAX_REF",0.0)
@@ -278,12 +375,13 @@ subroutine energy_bounds(nex,Emin,Emax,Ea1,Ea2,Eb1,Eb2)
            band2_Ehi = dum
            write(*,*)"Elo2>Ehi2! Switched!"
         end if
-        Ea1 = ceiling( real(nex) * log10(band1_Elo / Emin) / log10(Emax / Emin))
-        Ea2 = ceiling( real(nex) * log10(band1_Ehi / Emin) / log10(Emax / Emin))
-        Eb1 = ceiling( real(nex) * log10(band2_Elo / Emin) / log10(Emax / Emin))
-        Eb2 = ceiling( real(nex) * log10(band2_Ehi / Emin) / log10(Emax / Emin))
         needchans = .false.
     end if
+    !$omp end critical (reltrans_refband)
+    Ea1 = ceiling( real(nex) * log10(band1_Elo / Emin) / log10(Emax / Emin))
+    Ea2 = ceiling( real(nex) * log10(band1_Ehi / Emin) / log10(Emax / Emin))
+    Eb1 = ceiling( real(nex) * log10(band2_Elo / Emin) / log10(Emax / Emin))
+    Eb2 = ceiling( real(nex) * log10(band2_Ehi / Emin) / log10(Emax / Emin))
 
     return
 end subroutine energy_bounds
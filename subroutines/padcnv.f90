@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine pad4FFT(ne,photar,padFT)
+recursive subroutine pad4FFT(ne,photar,padFT)
 ! Takes spectrum photar(1:ne), pads out with zeros to make it a length
 ! of 4*ne, and Fourier transforms to padFT(1:4*ne), which is a function
 ! of 1/E
@@ -25,7 +25,7 @@ end subroutine pad4FFT
 
 
 !-----------------------------------------------------------------------
-subroutine pad4invFFT(dyn,ne,padFT,conv)
+recursive subroutine pad4invFFT(dyn,ne,padFT,conv)
 ! Takes padFT(1:4*ne), and zero-padded function of 1/E and inverse
 ! Fourier transforms to conv(ne), which is a non-zero padded spectrum
   implicit none
@@ -57,7 +57,7 @@ end subroutine pad4invFFT
 
 
 !-----------------------------------------------------------------------
-subroutine E_invFT(nex,cc,conv)
+recursive subroutine E_invFT(nex,cc,conv)
 ! Takes the complex array cc(1:nex), which is a function of 1/E
 ! and inverse Fourier transforms to get back a real spectrum as a
 ! function of E, conv(1:nex)
@@ -93,7 +93,7 @@ end subroutine E_invFT
 
 
 !-----------------------------------------------------------------------
-subroutine E_FT(nex,photarx,bc)
+recursive subroutine E_FT(nex,photarx,bc)
 ! Takes the real array photarx(1:nex), which is a spectrum as a
 ! function of photon energy E and Fourier transforms to bc(1:nex),
 ! which is complex and a function of 1/E.
@@ -1,77 +1,29 @@
 !-----------------------------------------------------------------------
-subroutine propercross(nex, nf, earx, ReSraw, ImSraw, ReGraw, ImGraw, resp_matr)
+recursive subroutine propercross(nex, nf, earx, ReSraw, ImSraw, ReGraw, ImGraw, resp_matr)
   use telematrix
-  use telematrix2
   implicit none
   integer, intent(in)  :: nex, nf, resp_matr
   real,    intent(in)  :: earx(0:nex), ReSraw(nex,nf), ImSraw(nex,nf)
   real,    intent(out) :: ReGraw(nex,nf), ImGraw(nex,nf)
-  real,    allocatable :: ReStel(:), ImStel(:)
-  real,    allocatable :: ReStel2(:), ImStel2(:)
   real                 :: reref, imref
-  integer              :: i, j
+  integer              :: i, j, m
 
 
   call response_and_energy_bounds(resp_matr)
-
-  
-  if (resp_matr .eq. 1) then 
-     !Allocate arrays
-     if( .not. allocated(ReStel) ) allocate(ReStel(numchn))
-     if( .not. allocated(ImStel) ) allocate(ImStel(numchn))
-
-     !Calculate `raw' cross-spectrum
-     do j = 1, nf
-        !Fold around the response matrix
-
-        ! write(*,*) 'Folding the first matrix'
-        call cfold(nex, earx, ReSraw(:,j), ImSraw(:,j), ReStel, ImStel)
-        ! write(*,*) 'finished'
-        !Calcluate reference band
-        reref = 0.0
-        imref = 0.0
-        do i = Ilo, Ihi
-           reref = reref + ReStel(i)
-           imref = imref + ImStel(i)
-        end do
-
-        !Cross subject band with reference band
-        do i = 1, nex
-           ReGraw(i,j) = ReSraw(i,j) * reref + ImSraw(i,j) * imref
-           ImGraw(i,j) = ImSraw(i,j) * reref - ReSraw(i,j) * imref
-        end do
+  m = respslot(resp_matr)
+
+  !Calculate `raw' cross-spectrum
+  do j = 1, nf
+     !Calcluate reference band: same as folding with cfold and summing
+     !channels Ilo..Ihi, but only the reference band weights are needed
+     call cref(nex, earx, ReSraw(:,j), ImSraw(:,j), rsp(m)%nenerg, rsp(m)%En, refw(resp_matr)%w, reref, imref)
+
+     !Cross subject band with reference band
+     do i = 1, nex
+        ReGraw(i,j) = ReSraw(i,j) * reref + ImSraw(i,j) * imref
+        ImGraw(i,j) = ImSraw(i,j) * reref - ReSraw(i,j) * imref
      end do
-  endif
-  
-
-  if (resp_matr .eq. 2) then 
-     !Allocate arrays
-     if( .not. allocated(ReStel2) ) allocate(ReStel2(numchn2))
-     if( .not. allocated(ImStel2) ) allocate(ImStel2(numchn2))
-     do j = 1, nf
- !Fold around the response matrix
-        ! write(*,*) 'Folding the second matrix'
-        call cfold2(nex, earx, ReSraw(:,j), ImSraw(:,j), ReStel2, ImStel2)
-        ! write(*,*) 'finished'
-        !Calcluate reference band
-        reref = 0.0
-        imref = 0.0
-        ! write(*,*) 'Calculating the refenrece band with the second matrix'
-        do i = Ilo2, Ihi2
-           reref = reref + ReStel2(i)
-           imref = imref + ImStel2(i)
-        end do
-        ! write(*,*) 'finished'
-
-        !Cross subject band with reference band
-        ! write(*,*) 'Cross spectrum with the refence band (second matrix)'
-        do i = 1, nex
-           ReGraw(i,j) = ReSraw(i,j) * reref + ImSraw(i,j) * imref
-           ImGraw(i,j) = ImSraw(i,j) * reref - ReSraw(i,j) * imref
-        end do
-        ! write(*,*) 'finished'
-     end do
-  endif
+  end do
   
   return
 end subroutine propercross
@@ -80,135 +32,82 @@ end subroutine propercross
 
 
 !-----------------------------------------------------------------------
-subroutine response_and_energy_bounds(resp_matr)
+recursive subroutine response_and_energy_bounds(resp_matr)
+! Loads the response of RESP id resp_matr and sets its reference band:
+! EMIN_REF and EMAX_REF for id 1, EMIN_REF<n> and EMAX_REF<n> for id n>1
   use telematrix
-  use telematrix2
   implicit none
   integer, INTENT(IN) :: resp_matr
   
   real     :: dum
   real     :: get_env_real
-  integer  :: i
+  integer  :: i, m
+  character (len=20) :: cid, who
   
 !Read from response file
-  if(resp_matr .eq. 1) then 
-     if( needresp )then
-        ! write(*,*) 'calling intmatrix'
-        call initmatrix
-     endif
-!Get energy bounds of the reference band
-     if( needchans )then
-        Elo = get_env_real("EMIN_REF",0.0)
-        Ehi = get_env_real("EMAX_REF",0.0)
-        if (Elo .eq. 0.0) then 
-           write(*,*)"Enter lower energy in reference band"
-           read(*,*)Elo
-        endif
-        if (Ehi .eq. 0.0) then  
-           write(*,*)"Enter upper energy in reference band"
-        read(*,*)Ehi
-        end if
-        if( Elo .gt. Ehi )then
-           dum = Elo
-           Elo = Ehi
-           Ehi = dum
-           write(*,*)"Elo>Ehi! Switched!"
-        end if
-        Ilo = 1
-        Ihi = numchn
-        do i = 0, numchn
-           if( echn(i) .lt. Elo ) Ilo = i
-           if( echn(i) .le. Ehi ) Ihi = i
-        end do
-        Ilo = Ilo + 1
-        if( Ilo .gt. Ihi ) Ihi = Ilo
-        needchans = .false.
+  call loadresp(resp_matr)
+  m = respslot(resp_matr)
+!Get energy bounds of the reference band (once, for all threads)
+  !$omp critical (reltrans_refband)
+  if( needchans(resp_matr) )then
+     if( resp_matr .eq. 1 )then
+        cid = ' '
+        who = ' '
+     else
+        write(cid,'(i0)') resp_matr
+        who = ' of RESP '//trim(cid)
      end if
-
-  else if (resp_matr .eq. 2) then
-     if( needresp2 )then
-        ! write(*,*) 'calling intmatrix2'
-        call initmatrix2
+     Elo(resp_matr) = get_env_real("EMIN_REF"//trim(cid),0.0)
+     Ehi(resp_matr) = get_env_real("EMAX_REF"//trim(cid),0.0)
+     if (Elo(resp_matr) .eq. 0.0) then 
+        write(*,*)"Enter lower energy in reference band"//trim(who)
+        read(*,*)Elo(resp_matr)
      endif
-!second response matrix     
-     if( needchans2 )then
-        Elo2 = get_env_real("EMIN_REF2",0.0)
-        Ehi2 = get_env_real("EMAX_REF2",0.0)
-        if (Elo2 .eq. 0.0) then
-           write(*,*)"Enter lower energy in reference band of the second response"
-           read(*,*)Elo2
-        endif
-        if (Ehi2 .eq. 0.0) then
-           write(*,*)"Enter upper energy in reference band of the second response"
-           read(*,*)Ehi2
-        endif
-        if( Elo2 .gt. Ehi2 )then
-           dum  = Elo2
-           Elo2 = Ehi2
-           Ehi2 = dum
-           write(*,*)"Elo>Ehi! Switched!"
-        end if
-        Ilo2 = 1
-        Ihi2 = numchn2
-        do i = 0, numchn2
-           if( echn2(i) .lt. Elo2 ) Ilo2 = i
-           if( echn2(i) .le. Ehi2 ) Ihi2 = i
-        end do
-
-        Ilo2 = Ilo2 + 1
-        if( Ilo2 .gt. Ihi2 ) Ihi2 = Ilo2
-        needchans2 = .false.
+     if (Ehi(resp_matr) .eq. 0.0) then  
+        write(*,*)"Enter upper energy in reference band"//trim(who)
+        read(*,*)Ehi(resp_matr)
      end if
-
-  else
-     write(*,*) 'MORE THAN 2 RESPONSES NOT YET IMPLEMENTED... TAKES THE FIRST ONE'
-     if( needresp )then
-        call initmatrix
-     endif
-!Get energy bounds of the reference band
-     if( needchans )then
-        write(*,*)"Enter lower energy in reference band"
-        read(*,*)Elo
-        write(*,*)"Enter upper energy in reference band"
-        read(*,*)Ehi
-        if( Elo .gt. Ehi )then
-           dum = Elo
-           Elo = Ehi
-           Ehi = dum
-           write(*,*)"Elo>Ehi! Switched!"
-        end if
-        Ilo = 1
-        Ihi = numchn
-        do i = 0, numchn
-           if( echn(i) .lt. Elo ) Ilo = i
-           if( echn(i) .le. Ehi ) Ihi = i
-        end do
-        Ilo = Ilo + 1
-        if( Ilo .gt. Ihi ) Ihi = Ilo
-        needchans = .false.
+     if( Elo(resp_matr) .gt. Ehi(resp_matr) )then
+        dum = Elo(resp_matr)
+        Elo(resp_matr) = Ehi(resp_matr)
+        Ehi(resp_matr) = dum
+        write(*,*)"Elo>Ehi! Switched!"
      end if
-  endif
-
-  
+     Ilo(resp_matr) = 1
+     Ihi(resp_matr) = rsp(m)%numchn
+     do i = 0, rsp(m)%numchn
+        if( rsp(m)%ECHN(i) .lt. Elo(resp_matr) ) Ilo(resp_matr) = i
+        if( rsp(m)%ECHN(i) .le. Ehi(resp_matr) ) Ihi(resp_matr) = i
+     end do
+     Ilo(resp_matr) = Ilo(resp_matr) + 1
+     if( Ilo(resp_matr) .gt. Ihi(resp_matr) ) Ihi(resp_matr) = Ilo(resp_matr)
+     if( allocated(refw(resp_matr)%w) ) deallocate(refw(resp_matr)%w)
+     allocate( refw(resp_matr)%w(rsp(m)%nenerg) )
+     call refweights(rsp(m)%nenerg, rsp(m)%respcol, rsp(m)%respchn, rsp(m)%respval, &
+                     Ilo(resp_matr), Ihi(resp_matr), refw(resp_matr)%w)
+     needchans(resp_matr) = .false.
+  end if
+  !$omp end critical (reltrans_refband)
   
-   end subroutine response_and_energy_bounds
-
+end subroutine response_and_energy_bounds
 
-!-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-subroutine propercross_NOmatrix(nex, nf, earx, ReSraw, ImSraw, ReGraw, ImGraw)
-  use telematrix
+recursive subroutine propercross_NOmatrix(nex, nf, earx, ReSraw, ImSraw, ReGraw, ImGraw)
+! Reference band taken directly on the model energy grid (diagonal response)
   implicit none
   integer, intent(in)  :: nex, nf
   real,    intent(in)  :: earx(0:nex), ReSraw(nex,nf), ImSraw(nex,nf)
   real,    intent(out) :: ReGraw(nex,nf), ImGraw(nex,nf)
   real,    allocatable :: ReStel(:), ImStel(:)
-  real                 :: reref, imref, dum, dE
-  integer              :: i, j
+  real                 :: reref, imref, dum, dE, Elo, Ehi
+  integer              :: i, j, Ilo, Ihi
+  logical              :: needchans = .true.
+  save Elo, Ehi, Ilo, Ihi
 
 
-!Get energy bounds of the reference band
+!Get energy bounds of the reference band (once, for all threads)
+     !$omp critical (reltrans_refband)
      if( needchans )then
         write(*,*)"Enter lower energy in reference band"
         read(*,*)Elo
@@ -230,6 +129,7 @@ subroutine propercross_NOmatrix(nex, nf, earx, ReSraw, ImSraw, ReGraw, ImGraw)
         if( Ilo .gt. Ihi ) Ihi = Ilo
         needchans = .false.
      end if
+     !$omp end critical (reltrans_refband)
 
      !Calculate `raw' cross-spectrum
      do j = 1, nf
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function interper(rlp,ylp,ndelta,re,kk)
+recursive function interper(rlp,ylp,ndelta,re,kk)
 ! Interpolates the array ylp between ylp(kk-1) and ylp(kk)
 ! ylp is a function of rlp and rlp(kk-1) .le. re .le. rlp(kk)
   implicit none
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function mylogne(r,rin)
+recursive function mylogne(r,rin)
 ! Calculates log10(ne). Don't let r = rin
   implicit none
   double precision mylogne,r,rin
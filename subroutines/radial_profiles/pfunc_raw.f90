@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function pfunc_raw(mu,b1,b2,boost)
+recursive function pfunc_raw(mu,b1,b2,boost)
   implicit none
   double precision pfunc_raw,mu,b1,b2,boost
   double precision calB,norm,pm,mup,p
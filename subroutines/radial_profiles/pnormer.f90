@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function pnormer(b1,b2,boost)
+recursive function pnormer(b1,b2,boost)
   implicit none
   double precision pnormer,b1,b2,boost,pi
   integer i,imax
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine radfuncs_dist(xe, rin, rnmax, b1, b2, qboost, fcons,&
+recursive subroutine radfuncs_dist(xe, rin, rnmax, b1, b2, qboost, fcons,&
      & lognep, spin, h, honr, rlp, dcosdr, cosd, ndelta, rmin, npts,&
      & logxieff, gsdr, logner, pnorm)
 ! Calculates ionization parameter, g-factor and disc density as a
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function sysfref(rin,rlp,cosd,ndelta,cosdout)
+recursive function sysfref(rin,rlp,cosd,ndelta,cosdout)
 ! Calculates the relxill definition of reflection fraction        
 ! In: rin,rlp,ndelta,cosd,cosdout
 ! Out: stsfref
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function xiraw(re,spin,h,honr,rlp,dcosdr,ndelta,rmin,npts,mudisk,gsd)
+recursive function xiraw(re,spin,h,honr,rlp,dcosdr,ndelta,rmin,npts,mudisk,gsd)
     ! In: re,spin,h,honr,rlp,dcosdr,ndelta,rmin,npts
     ! Out: logxiraw,gsd
     implicit none
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function zA_logne(r,rin,lognep)
+recursive function zA_logne(r,rin,lognep)
 ! log(ne), where ne is the density.
 ! This function is normalised to have a maximum of lognep.
 ! We can therefore calculate the ionization parameter by taking
@@ -54,3 +54,46 @@
       return
    end function
 !-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      subroutine gaussstream(seed,k,n,x)
+! n standard normal deviates x(1:n) of stream k for a given seed.
+! Counter based: x(i) is a fixed function of (seed,k,i), made by hashing
+! the counters (32-bit lowbias hash) and a Box-Muller transform, so that
+! any realisation k can be reproduced on its own, in any order, and the
+! loop over i has no carried state.
+      implicit none
+      integer seed,k,n,i
+      real x(n)
+      integer(kind=8), parameter :: mask = 4294967295_8
+      integer(kind=8) key,h1,h2
+      double precision u1,u2
+      double precision, parameter :: twopi = 6.283185307179586d0
+      key = hash32( iand( int(seed,8) , mask ) )
+      key = hash32( ieor( key , iand( int(k,8) , mask ) ) )
+      do i = 1,n
+         h1 = hash32( ieor( hash32( iand( key + 2*i-1 , mask ) ) , key ) )
+         h2 = hash32( ieor( hash32( iand( key + 2*i   , mask ) ) , key ) )
+         u1 = ( dble(h1) + 0.5d0 ) / 4294967296.d0
+         u2 = ( dble(h2) + 0.5d0 ) / 4294967296.d0
+         x(i) = real( sqrt( -2.d0 * log(u1) ) * cos( twopi * u2 ) )
+      end do
+      return
+      contains
+        function hash32(y)
+        !Bijective mixing of a 32-bit value held in the low bits of y
+        integer(kind=8) hash32,y
+        hash32 = ieor( y , ishft(y,-16) )
+        hash32 = mul32( hash32 , 2146121005_8 )
+        hash32 = ieor( hash32 , ishft(hash32,-15) )
+        hash32 = mul32( hash32 , 2221713035_8 )
+        hash32 = ieor( hash32 , ishft(hash32,-16) )
+        end function hash32
+        function mul32(a,b)
+        !a*b modulo 2^32 for 32-bit a and b, without overflowing 64 bits
+        integer(kind=8) mul32,a,b
+        mul32 = iand( a * iand(b,65535_8) , mask )
+        mul32 = iand( mul32 + iand( a * ishft(b,-16) , 65535_8 ) * 65536_8 , mask )
+        end function mul32
+      end subroutine gaussstream
+!-----------------------------------------------------------------------
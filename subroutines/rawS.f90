@@ -1,4 +1,4 @@
-subroutine rawS(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,h,z,Gamma,eta,&
+recursive subroutine rawS(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2,ImW2,ReW3,ImW3,h,z,Gamma,eta,&
                 beta_p,boost,g,DelAB,ionvar,DC,ReSraw,ImSraw)
     ! Calculates the FT of the spectrum before multiplying by the absorption model
     !
@@ -40,7 +40,7 @@ subroutine rawS(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2
     real earx(0:nex),contx(nex,nlp),tauso(nlp),ReW0(nlp,nex,nf),ImW0(nlp,nex,nf)
     real ReW1(nlp,nex,nf),ImW1(nlp,nex,nf),ReW2(nlp,nex,nf),ImW2(nlp,nex,nf),ReW3(nlp,nex,nf),ImW3(nlp,nex,nf)
     real DelAB(nlp),g(nlp),boost,z,gso(nlp),Gamma,eta,ReSraw(nex,nf),ImSraw(nex,nf),h(nlp),beta_p 
-    real E,fac,tau_d,phase_d,tau_p,phase_p,f,flo,fhi
+    real E,fac,tau_d,phase_d,tau_p,phase_p,f,flo,fhi,etam
     integer i,j,m
 
     ReSraw = 0.
@@ -53,24 +53,19 @@ subroutine rawS(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2
     tau_p = 0.
 
     do m=1,nlp 
+       !weight of the second lamp post; applied on the fly so that the W arrays are left untouched
+       !(genreltrans keeps them between calls when the convolutions do not need to be redone)
+       etam = 1.0
+       if (m .gt. 1) etam = eta
        if (boost .lt. 0 .and. DC .eq. 1) then
             do j = 1,nf
                do i = 1,nex
-                  if (m .gt. 1) ReW0(m,i,j) = eta*ReW0(m,i,j)
-                  ReSraw(i,j) = ReSraw(i,j) + (-boost) * ReW0(m,i,j)
+                  ReSraw(i,j) = ReSraw(i,j) + (-boost) * (etam*ReW0(m,i,j))
                 enddo
             enddo  
         else
             if( m .gt. 1 ) then
                 !set up extra terms if second lamp post present
-                ReW0(m,:,:) = eta*ReW0(m,:,:)
-                ImW0(m,:,:) = eta*ImW0(m,:,:)
-                ReW1(m,:,:) = eta*ReW1(m,:,:)
-                ImW1(m,:,:) = eta*ImW1(m,:,:)
-                ReW2(m,:,:) = eta*ReW2(m,:,:)
-                ImW2(m,:,:) = eta*ImW2(m,:,:)
-                ReW3(m,:,:) = eta*ReW3(m,:,:)
-                ImW3(m,:,:) = eta*ImW3(m,:,:)
                 tau_d = tauso(m)-tauso(1)
                 tau_p = (h(m) - h(1))/(beta_p)
             end if
@@ -92,10 +87,10 @@ subroutine rawS(nex,earx,nf,flo,fhi,nlp,contx,tauso,gso,ReW0,ImW0,ReW1,ImW1,ReW2
                     cexp_p = cmplx(cos(phase_p),sin(phase_p)) 
                     cexp_phi = cmplx(cos(DelAB(m)),sin(DelAB(m)))
                     !set up transfer functions 
-                    W0 = boost * cmplx(ReW0(m,i,j),ImW0(m,i,j))
-                    W1 = (1-DC) * boost * cmplx(ReW1(m,i,j),ImW1(m,i,j))
-                    W2 = (1-DC) * boost * cmplx(ReW2(m,i,j),ImW2(m,i,j))                       
-                    W3 = ionvar * (1-DC) * boost * cmplx(ReW3(m,i,j),ImW3(m,i,j))
+                    W0 = boost * cmplx(etam*ReW0(m,i,j),etam*ImW0(m,i,j))
+                    W1 = (1-DC) * boost * cmplx(etam*ReW1(m,i,j),etam*ImW1(m,i,j))
+                    W2 = (1-DC) * boost * cmplx(etam*ReW2(m,i,j),etam*ImW2(m,i,j))                       
+                    W3 = ionvar * (1-DC) * boost * cmplx(etam*ReW3(m,i,j),etam*ImW3(m,i,j))
                     !calculate complex covariance
                     !note: the reason we use complex here is to ease the calculations 
                     !when we add all the extra phases from the double lamp post 
@@ -1,145 +1,47 @@
 !-----------------------------------------------------------------------
-subroutine cfoldandbin(nex,earx,ReGx,ImGx,ne,ear,ReG,ImG, resp_matr)
-! Initmatrix must have alreadt been called
+recursive subroutine cfoldandbin(nex,earx,ReGx,ImGx,ne,ear,ReG,ImG, resp_matr)
 ! Input:  {ReGx(nex),ImGx(nex)]: in units of photar; i.e. (dN/dE)*dE
 ! Output: {ReG(nex) ,ImG(nex) ]: in units of photar; i.e. (dN/dE)*dE
-! G is folded around the instrument response and re-binned onto the
-! input energy array ear(0:ne)
+! G is folded around the instrument response of RESP id resp_matr and
+! re-binned onto the input energy array ear(0:ne)
   use telematrix
-  use telematrix2
   implicit none
   integer, intent(in) :: nex,ne,resp_matr
   real earx(0:nex),ReGx(nex),ImGx(nex),ear(0:ne),ReG(ne),ImG(ne)
-  real E,dE,E2ReGx(nex),E2ImGx(nex)
-  ! real ReGi(nenerg),ImGi(nenerg)
-  ! real ReGtel(numchn),ImGtel(numchn)
- 
-  real, allocatable :: ReGtel(:), ImGtel(:), ReGi(:), ImGi(:)
+  real E,dE
+  real, allocatable :: ReGtel(:), ImGtel(:)
+  integer :: i,m
 
-  integer :: i,j,k
-  
-  !Convert to E^2*dN/dE for better accuracy
-  do i = 1,nex
-     E  = 0.5 * ( earx(i) + earx(i-1) )
-     dE = earx(i) - earx(i-1)
-     E2ReGx(i) = E**2 * ReGx(i) / dE
-     E2ImGx(i) = E**2 * ImGx(i) / dE
-  end do
-
-  if (resp_matr .eq. 1) then 
+  call loadresp(resp_matr)
+  m = respslot(resp_matr)
 
-     allocate(ReGi(nenerg))
-     allocate(ImGi(nenerg))
-     allocate(ReGtel(numchn))
-     allocate(ImGtel(numchn))
-     
-     !Rebin input arrays onto internal telescope energy grid
-     call rebinE(earx,E2ReGx,nex,En,ReGi,nenerg)
-     call rebinE(earx,E2ImGx,nex,En,ImGi,nenerg)
-
-     !Convert back to (dN/dE)*dE
-     do i = 1,nenerg
-        E  = 0.5 * ( En(i) + En(i-1) )
-        dE = En(i) - En(i-1)
-        ReGi(i) = ReGi(i) / E**2 * dE
-        ImGi(i) = ImGi(i) / E**2 * dE
-     end do
-
-     !Fold around response
-     ReGtel = 0.0
-     ImGtel = 0.0
-     do J = 1,NENERG
-        do K = 1,NGRP(J)
-           do I = FCHAN(J,K)+1,LCHAN(J,K)
-              dE = En(J) - En(J-1)
-              ReGtel(I) = ReGtel(I) + ReGi(J) * RESP(I,J)
-              ImGtel(I) = ImGtel(I) + ImGi(J) * RESP(I,J)
-           end do
-        end do
-     end do
+  allocate(ReGtel(rsp(m)%numchn))
+  allocate(ImGtel(rsp(m)%numchn))
 
-     !Convert Gtel from photar to dN/dE
-     do I = 1,numchn
-        E  = 0.5 * ( ECHN(I) + ECHN(I-1) )
-        dE = ( ECHN(I) - ECHN(I-1) )
-        ReGtel(I) = ReGtel(I) / dE  
-        ImGtel(I) = ImGtel(I) / dE        
-     end do
-     
-     !Rebin onto input energy grid
-     call rebinE(echn,ReGtel,numchn,ear,ReG,ne)
-     call rebinE(echn,ImGtel,numchn,ear,ImG,ne)
-     
-    !Convert G from dN/dE to photar
-     do i = 1,ne
-        E  = 0.5 * ( ear(i) + ear(i-1) )
-        dE = ear(i) - ear(i-1)
-        ReG(i) = ReG(i) * dE  
-        ImG(i) = ImG(i) * dE  
-     end do
-     
-     deallocate(ReGi)
-     deallocate(ImGi)
-     deallocate(ReGtel)
-     deallocate(ImGtel)
-  endif
-  
-  if (resp_matr .eq. 2) then 
+  !Fold around response
+  call cfold(m, nex, earx, ReGx, ImGx, ReGtel, ImGtel)
+
+  !Convert Gtel from photar to dN/dE
+  do I = 1,rsp(m)%numchn
+     E  = 0.5 * ( rsp(m)%ECHN(I) + rsp(m)%ECHN(I-1) )
+     dE = ( rsp(m)%ECHN(I) - rsp(m)%ECHN(I-1) )
+     ReGtel(I) = ReGtel(I) / dE  
+     ImGtel(I) = ImGtel(I) / dE        
+  end do
      
-     allocate(ReGi(nenerg2))
-     allocate(ImGi(nenerg2))
-     allocate(ReGtel(numchn2))
-     allocate(ImGtel(numchn2))
-
-     !Rebin input arrays onto internal telescope energy grid
-     call rebinE(earx,E2ReGx,nex,En2,ReGi,nenerg2)
-     call rebinE(earx,E2ImGx,nex,En2,ImGi,nenerg2)
-     !Convert back to (dN/dE)*dE
-     do i = 1,nenerg2
-        E  = 0.5 * ( En2(i) + En2(i-1) )
-        dE = En2(i) - En2(i-1)
-        ReGi(i) = ReGi(i) / E**2 * dE
-        ImGi(i) = ImGi(i) / E**2 * dE
-     end do
+  !Rebin onto input energy grid
+  call rebinE2(rsp(m)%ECHN,ReGtel,ImGtel,rsp(m)%numchn,ear,ReG,ImG,ne)
      
-     !Fold around response
-     ReGtel = 0.0
-     ImGtel = 0.0
-     do J = 1,NENERG2
-        do K = 1,NGRP2(J)
-           do I = FCHAN2(J,K)+1,LCHAN2(J,K)
-              dE = En2(J) - En2(J-1)
-              ReGtel(I) = ReGtel(I) + ReGi(J) * RESP2(I,J)
-              ImGtel(I) = ImGtel(I) + ImGi(J) * RESP2(I,J)
-           end do
-        end do
-     end do
-
-     !Convert Gtel from photar to dN/dE
-     do I = 1,numchn2
-        E  = 0.5 * ( ECHN2(I) + ECHN2(I-1) )
-        dE = ( ECHN2(I) - ECHN2(I-1) )
-        ReGtel(I) = ReGtel(I) / dE  
-        ImGtel(I) = ImGtel(I) / dE      
-     end do
-     
-     !Rebin onto input energy grid
-     call rebinE(echn2,ReGtel,numchn2,ear,ReG,ne)
-     call rebinE(echn2,ImGtel,numchn2,ear,ImG,ne)
+  !Convert G from dN/dE to photar
+  do i = 1,ne
+     E  = 0.5 * ( ear(i) + ear(i-1) )
+     dE = ear(i) - ear(i-1)
+     ReG(i) = ReG(i) * dE  
+     ImG(i) = ImG(i) * dE  
+  end do
      
-    !Convert G from dN/dE to photar
-     do i = 1,ne
-        E  = 0.5 * ( ear(i) + ear(i-1) )
-        dE = ear(i) - ear(i-1)
-        ReG(i) = ReG(i) * dE  
-        ImG(i) = ImG(i) * dE  
-     end do
-
-     deallocate(ReGi)
-     deallocate(ImGi)
-     deallocate(ReGtel)
-     deallocate(ImGtel)
-  endif
+  deallocate(ReGtel)
+  deallocate(ImGtel)
 
   return
 end subroutine cfoldandbin
@@ -203,15 +105,15 @@ end subroutine cfoldandbin
 
 
 !-----------------------------------------------------------------------
-subroutine cfold(nex, earx, ReGx, ImGx, ReGtel, ImGtel)
-! Initmatrix must have alreadt been called
+recursive subroutine cfold(m, nex, earx, ReGx, ImGx, ReGtel, ImGtel)
+! Folds around the matrix in slot m of the response registry (see loadresp)
 ! Input (ReGx,ImGx) is in terms of **PHOTAR**; i.e. (dN/dE)*dE
 ! RGtel, ImGtel is in count rate vs channel number
   use telematrix
   implicit none
-  integer nex,i,j,k
-  real earx(0:nex),ReGx(nex),ImGx(nex),ReGtel(numchn),ImGtel(numchn)
-  real ReGi(nenerg),ImGi(nenerg),E,dE,E2ReGx(nex),E2ImGx(nex)
+  integer m,nex,i
+  real earx(0:nex),ReGx(nex),ImGx(nex),ReGtel(rsp(m)%numchn),ImGtel(rsp(m)%numchn)
+  real ReGi(rsp(m)%nenerg),ImGi(rsp(m)%nenerg),E,dE,E2ReGx(nex),E2ImGx(nex)
   
   !Convert to E^2*dN/dE for better accuracy
   do i = 1,nex
@@ -222,44 +124,37 @@ subroutine cfold(nex, earx, ReGx, ImGx, ReGtel, ImGtel)
   end do
   
   !Rebin input arrays onto internal telescope energy grid
-  call rebinE(earx,E2ReGx,nex,En,ReGi,nenerg)
-  call rebinE(earx,E2ImGx,nex,En,ImGi,nenerg)
+  call rebinE2(earx,E2ReGx,E2ImGx,nex,rsp(m)%En,ReGi,ImGi,rsp(m)%nenerg)
   
   !Convert back to (dN/dE)*dE
-  do i = 1,nenerg
-     E  = 0.5 * ( En(i) + En(i-1) )
-     dE = En(i) - En(i-1)
+  do i = 1,rsp(m)%nenerg
+     E  = 0.5 * ( rsp(m)%En(i) + rsp(m)%En(i-1) )
+     dE = rsp(m)%En(i) - rsp(m)%En(i-1)
      ReGi(i) = ReGi(i) / E**2 * dE
      ImGi(i) = ImGi(i) / E**2 * dE
   end do
 
   !Fold around response
-  ReGtel = 0.0
-  ImGtel = 0.0
-  do J = 1, NENERG
-     do K = 1,NGRP(J)
-        do I = FCHAN(J,K) + 1, LCHAN(J,K)
-           ReGtel(I) = ReGtel(I) + ReGi(J) * RESP(I,J)
-           ImGtel(I) = ImGtel(I) + ImGi(J) * RESP(I,J)
-        end do
-     end do
-  end do
-
+  call foldresp(rsp(m)%nenerg,rsp(m)%numchn,rsp(m)%respcol,rsp(m)%respchn,rsp(m)%respval,&
+                ReGi,ImGi,ReGtel,ImGtel)
   
   return
 end subroutine cfold
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-subroutine cfold2(nex, earx, ReGx, ImGx, ReGtel, ImGtel)
-! Initmatrix must have alreadt been called
+recursive subroutine cref(nex, earx, ReGx, ImGx, nenerg, En, refw, reref, imref)
+! Count rate of (ReGx,ImGx) in the reference band, i.e. the sum over
+! channels Ilo..Ihi of cfold's output, without folding the whole matrix:
+! the band is a fixed linear functional of the spectrum on the response
+! energy grid, refw (see refweights).
 ! Input (ReGx,ImGx) is in terms of **PHOTAR**; i.e. (dN/dE)*dE
-! RGtel, ImGtel is in count rate vs channel number
-  use telematrix2
   implicit none
-  integer nex,i,j,k
-  real earx(0:nex),ReGx(nex),ImGx(nex),ReGtel(numchn2),ImGtel(numchn2)
-  real ReGi(nenerg2),ImGi(nenerg2),E,dE,E2ReGx(nex),E2ImGx(nex)
+  integer, intent(in)  :: nex, nenerg
+  real   , intent(in)  :: earx(0:nex), ReGx(nex), ImGx(nex), En(0:nenerg), refw(nenerg)
+  real   , intent(out) :: reref, imref
+  integer i
+  real ReGi(nenerg),ImGi(nenerg),E,dE,E2ReGx(nex),E2ImGx(nex)
   
   !Convert to E^2*dN/dE for better accuracy
   do i = 1,nex
@@ -269,121 +164,79 @@ subroutine cfold2(nex, earx, ReGx, ImGx, ReGtel, ImGtel)
      E2ImGx(i) = E**2 * ImGx(i) / dE
   end do
   
-  !Rebin input arrays onto interpal telescope energy grid
-  call rebinE(earx,E2ReGx,nex,En2,ReGi,nenerg2)
-  call rebinE(earx,E2ImGx,nex,En2,ImGi,nenerg2)
+  !Rebin input arrays onto internal telescope energy grid
+  call rebinE2(earx,E2ReGx,E2ImGx,nex,En,ReGi,ImGi,nenerg)
   
-  !Convert back to (dN/dE)*dE
-  do i = 1,nenerg2
-     E  = 0.5 * ( En2(i) + En2(i-1) )
-     dE = En2(i) - En2(i-1)
-     ReGi(i) = ReGi(i) / E**2 * dE
-     ImGi(i) = ImGi(i) / E**2 * dE
+  !Convert back to (dN/dE)*dE and project on the reference band
+  reref = 0.0
+  imref = 0.0
+  do i = 1,nenerg
+     E  = 0.5 * ( En(i) + En(i-1) )
+     dE = En(i) - En(i-1)
+     reref = reref + refw(i) * ReGi(i) / E**2 * dE
+     imref = imref + refw(i) * ImGi(i) / E**2 * dE
   end do
+  
+  return
+end subroutine cref
+!-----------------------------------------------------------------------
 
-  !Fold around response
-  ReGtel = 0.0
-  ImGtel = 0.0
-  do J = 1, NENERG2
-     do K = 1,NGRP2(J)
-        do I = FCHAN2(J,K) + 1, LCHAN2(J,K)
-           dE = En2(J) - En2(J-1) !I think this can be commented out
-           ReGtel(I) = ReGtel(I) + ReGi(J) * RESP2(I,J)
-           ImGtel(I) = ImGtel(I) + ImGi(J) * RESP2(I,J)
-        end do
+!-----------------------------------------------------------------------
+recursive subroutine refweights(nenerg, respcol, respchn, respval, Ilo, Ihi, refw)
+! Reference band weights: refw(J) = sum of the response column J over the
+! channels Ilo..Ihi, so that the band count rate is sum_J refw(J)*S(J)
+  implicit none
+  integer, intent(in)  :: nenerg, respcol(nenerg+1), respchn(*), Ilo, Ihi
+  real   , intent(in)  :: respval(*)
+  real   , intent(out) :: refw(nenerg)
+  integer :: j, n
+  do j = 1, nenerg
+     refw(j) = 0.0
+     do n = respcol(j), respcol(j+1) - 1
+        if( respchn(n) .ge. Ilo .and. respchn(n) .le. Ihi ) refw(j) = refw(j) + respval(n)
      end do
   end do
-
-  
   return
-end subroutine cfold2
+end subroutine refweights
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-subroutine readinresp
-! Reads in the response matrix
-! ***Must already know numchn nd nenerg***
-  use telematrix
+recursive subroutine foldresp(nenerg,numchn,respcol,respchn,respval,ReGi,ImGi,ReGtel,ImGtel)
+! Folds (ReGi,ImGi), in photar on the response energy grid, around a
+! response stored in compressed sparse column format (see telematrix).
+! Output is the count rate vs channel number. The real and imaginary
+! parts are folded in the same pass through the matrix.
   implicit none
-  integer status,U1,readwrite,blocksize,hdutype,i,colnum,felem
-  integer nelem,j,rows,k
-  character (len=200) exname,comment
-  real nullval,area(10000)
-  logical anynull
-  status = 0
-  call ftgiou(U1,status)
-  !Open the response matrix fits file with read-only access
-  readwrite = 0
-  call ftopen(U1,RESPNAME,readwrite,blocksize,status)
-  if( status .ne. 0 ) then 
-     write(*,*) 'response file name: ', trim(RESPNAME)
-     stop 'cannot open response file'
-  endif
-  !Shift to extension 1
-  call ftmrhd(U1,1,hdutype,status)
-  !Get the name of this extension
-  call ftgkys(U1,'EXTNAME',EXNAME,comment,status)
-  !Read in whatever this extension this is
-  if( EXNAME .eq. 'EBOUNDS' )then     
-     call energyextension(U1)
-  else if(EXNAME.eq.'MATRIX'.or.EXNAME.eq.'SPECRESP MATRIX')then
-     call matrixextension(U1)
-  end if
-  !Shift to extension 2
-  call ftmrhd(U1,1,hdutype,status)
-  !Get the name of this extension
-  call ftgkys(U1,'EXTNAME',EXNAME,comment,status)
-  if( EXNAME .eq. 'EBOUNDS' )then     
-     call energyextension(U1)
-  else if(EXNAME.eq.'MATRIX'.or.EXNAME.eq.'SPECRESP MATRIX')then
-     call matrixextension(U1)
-  end if
-  !Close unit
-  call ftclos(U1,status)
-  call ftfiou(U1,status)
-  !-----------------------------------------------------------------
-  !Read in the arf file if required
-  if( ARF )then
-     !Open file
-     status = 0
-     call ftgiou(U1,status)
-     call ftopen(U1,ARFNAME,readwrite,blocksize,status)
-     if( status .ne. 0 ) stop 'cannot open arf file'
-     !Move to the SPECRESP extension
-     status = 0
-     call ftmrhd(U1,1,hdutype,status)
-     if(status .ne. 0) stop 'Cannot move to the SPECRESP extension'
-     !Check this has the same number of rows as the rmf file
-     call ftgkyj(U1,'NAXIS2',rows,comment,status)
-     if(status .ne. 0) stop 'Cannot determine NENERG from arf file'
-     if( rows .ne. NENERG ) stop 'rmf and arf not compatible!'
-     !Read in rows and re-normalise response matrix
-     do J = 1,NENERG
-        colnum = 3
-        call ftgcve(U1,colnum,J,1,1,nullval,AREA(J),anynull,status)
-        if( status .ne. 0 ) stop 'problem reading AREA'
-        do K = 1,NGRP(J)
-           do I = FCHAN(J,K)+1,LCHAN(J,K)
-              resp(I,J) = resp(I,J) * AREA(J)
-           end do
-        end do
+  integer, intent(in)  :: nenerg, numchn, respcol(nenerg+1), respchn(*)
+  real   , intent(in)  :: respval(*), ReGi(nenerg), ImGi(nenerg)
+  real   , intent(out) :: ReGtel(numchn), ImGtel(numchn)
+  integer :: j, n
+  real    :: re, im
+  ReGtel = 0.0
+  ImGtel = 0.0
+  do j = 1, nenerg
+     re = ReGi(j)
+     im = ImGi(j)
+     !the channels of one column are all different, so the scatter can be vectorised
+     !$omp simd
+     do n = respcol(j), respcol(j+1) - 1
+        ReGtel(respchn(n)) = ReGtel(respchn(n)) + re * respval(n)
+        ImGtel(respchn(n)) = ImGtel(respchn(n)) + im * respval(n)
      end do
-     !Close unit
-     call ftclos(U1,status)
-     call ftfiou(U1,status)
-  end if
+  end do
   return
-end subroutine readinresp
+end subroutine foldresp
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-subroutine readinresp2
-! Reads in the second response matrix 
+recursive subroutine readinresp(m)
+! Reads in the response matrix of slot m of the registry
 ! ***Must already know numchn nd nenerg***
-  use telematrix2
+  use telematrix
   implicit none
+  integer, intent(in) :: m
   integer status,U1,readwrite,blocksize,hdutype,i,colnum,felem
-  integer nelem,j,rows,k
+  integer nelem,j,rows
   character (len=200) exname,comment
   real nullval,area(10000)
   logical anynull
@@ -391,9 +244,9 @@ subroutine readinresp2
   call ftgiou(U1,status)
   !Open the response matrix fits file with read-only access
   readwrite = 0
-  call ftopen(U1,RESPNAME2,readwrite,blocksize,status)
+  call ftopen(U1,rsp(m)%respname,readwrite,blocksize,status)
   if( status .ne. 0 ) then
-     write(*,*) 'response file name: ', trim(RESPNAME2)
+     write(*,*) 'response file name: ', trim(rsp(m)%respname)
      stop 'cannot open response file'
   endif
   !Shift to extension 1
@@ -401,39 +254,30 @@ subroutine readinresp2
   !Get the name of this extension
   call ftgkys(U1,'EXTNAME',EXNAME,comment,status)
   !Read in whatever this extension this is
-  if( EXNAME .eq. 'EBOUNDS' )then     
-     ! write(*,*) ' call energyextension2 (second matrix)'
-     call energyextension2(U1)
-     ! write(*,*) 'out from energyextension2'
+  if( EXNAME .eq. 'EBOUNDS' )then
+     call energyextension(U1,m)
   else if(EXNAME.eq.'MATRIX'.or.EXNAME.eq.'SPECRESP MATRIX')then
-     ! write(*,*) ' call matrixextension2 (second matrix)'
-     call matrixextension2(U1)
-     ! write(*,*) 'out from matrixextension2'
+     call matrixextension(U1,m)
   end if
   !Shift to extension 2
   call ftmrhd(U1,1,hdutype,status)
   !Get the name of this extension
   call ftgkys(U1,'EXTNAME',EXNAME,comment,status)
-  if( EXNAME .eq. 'EBOUNDS' )then     
-     ! write(*,*) ' call energyextension2 (second matrix)'
-     call energyextension2(U1)
-     ! write(*,*) 'out from energyextension2'
+  if( EXNAME .eq. 'EBOUNDS' )then
+     call energyextension(U1,m)
   else if(EXNAME.eq.'MATRIX'.or.EXNAME.eq.'SPECRESP MATRIX')then
-     ! write(*,*) ' call matrixextension2 (second matrix)'
-    call matrixextension2(U1)
-     ! write(*,*) 'out from matrixextension2'
+     call matrixextension(U1,m)
   end if
   !Close unit
   call ftclos(U1,status)
   call ftfiou(U1,status)
-  !----------------------------------------------------------------
-  
+  !-----------------------------------------------------------------
   !Read in the arf file if required
-  if( ARF2 )then
+  if( rsp(m)%arf )then
      !Open file
      status = 0
      call ftgiou(U1,status)
-     call ftopen(U1,ARFNAME2,readwrite,blocksize,status)
+     call ftopen(U1,rsp(m)%arfname,readwrite,blocksize,status)
      if( status .ne. 0 ) stop 'cannot open arf file'
      !Move to the SPECRESP extension
      status = 0
@@ -442,16 +286,14 @@ subroutine readinresp2
      !Check this has the same number of rows as the rmf file
      call ftgkyj(U1,'NAXIS2',rows,comment,status)
      if(status .ne. 0) stop 'Cannot determine NENERG from arf file'
-     if( rows .ne. NENERG2 ) stop 'rmf and arf not compatible!'
+     if( rows .ne. rsp(m)%nenerg ) stop 'rmf and arf not compatible!'
      !Read in rows and re-normalise response matrix
-     do J = 1,NENERG2
+     do J = 1,rsp(m)%nenerg
         colnum = 3
         call ftgcve(U1,colnum,J,1,1,nullval,AREA(J),anynull,status)
         if( status .ne. 0 ) stop 'problem reading AREA'
-        do K = 1,NGRP2(J)
-           do I = FCHAN2(J,K)+1,LCHAN2(J,K)
-              resp2(I,J) = resp2(I,J) * AREA(J)
-           end do
+        do I = rsp(m)%respcol(J), rsp(m)%respcol(J+1) - 1
+           rsp(m)%respval(I) = rsp(m)%respval(I) * AREA(J)
         end do
      end do
      !Close unit
@@ -459,21 +301,20 @@ subroutine readinresp2
      call ftfiou(U1,status)
   end if
   return
-end subroutine readinresp2
+end subroutine readinresp
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-subroutine energyextension(U1)
+recursive subroutine energyextension(U1,m)
   use telematrix
   implicit none
-  integer, INTENT(IN)  :: U1
-  ! real   , INTENT(OUT) :: ECHN(numchn)
+  integer, INTENT(IN)  :: U1, m
   integer status,i,colnum,felem,nelem
   character (len=200) exname,comment
   real nullval
   logical anynull
-  !Read in En(numchn)
-  do I = 1, numchn
+  !Read in ECHN(0:numchn)
+  do I = 1, rsp(m)%numchn
      status = 0
      !Read in E_MIN
      colnum  = 2
@@ -481,180 +322,135 @@ subroutine energyextension(U1)
      nelem   = 1
      nullval = -1.0
      anynull = .false.
-     call ftgcve(U1,colnum,I,felem,nelem,nullval,ECHN(I-1),anynull,status)
+     call ftgcve(U1,colnum,I,felem,nelem,nullval,rsp(m)%ECHN(I-1),anynull,status)
      !Read in E_MAX
      colnum  = 3
-     call ftgcve(U1,colnum,I,felem,nelem,nullval,ECHN(I),anynull,status)
+     call ftgcve(U1,colnum,I,felem,nelem,nullval,rsp(m)%ECHN(I),anynull,status)
      if( status .ne. 0 ) stop 'problem reading in EBOUNDS'
   end do
   return
-end subroutine energyextension  
+end subroutine energyextension
 !-----------------------------------------------------------------------
 
+
 !-----------------------------------------------------------------------
-subroutine energyextension2(U1)
-  use telematrix2
+recursive subroutine matrixextension(U1,m)
+  use telematrix
   implicit none
-  integer, INTENT(IN)  :: U1
-  ! real   , INTENT(OUT) :: ECHN(numchn)
-  integer status,i,colnum,felem,nelem
-  character (len=200) exname,comment
-  real nullval
-  logical anynull
-  !Read in En(numchn)
-  do I = 1, numchn2
-     status = 0
-     !Read in E_MIN
-     colnum  = 2
-     felem   = 1
-     nelem   = 1
-     nullval = -1.0
-     anynull = .false.
-     call ftgcve(U1,colnum,I,felem,nelem,nullval,ECHN2(I-1),anynull,status)
-     !Read in E_MAX
-     colnum  = 3
-     call ftgcve(U1,colnum,I,felem,nelem,nullval,ECHN2(I),anynull,status)
-     if( status .ne. 0 ) stop 'problem reading in EBOUNDS'
-  end do
+  integer U1,m
+  call countresp(U1,rsp(m)%nenerg,rsp(m)%respnnz)
+  if( allocated(rsp(m)%respchn) ) deallocate(rsp(m)%respchn)
+  if( allocated(rsp(m)%respval) ) deallocate(rsp(m)%respval)
+  allocate( rsp(m)%respchn(rsp(m)%respnnz), rsp(m)%respval(rsp(m)%respnnz) )
+  call readrespcsc(U1,rsp(m)%nenerg,rsp(m)%numchn,rsp(m)%En,rsp(m)%respcol,&
+                   rsp(m)%respchn,rsp(m)%respval,rsp(m)%respnnz)
   return
-end subroutine energyextension2
+end subroutine matrixextension
 !-----------------------------------------------------------------------
 
 
 !-----------------------------------------------------------------------
-subroutine matrixextension(U1)
-  use telematrix
+recursive subroutine countresp(U1,nenerg,nnz)
+! Upper bound of the number of non-zero elements of the MATRIX extension
+! (open on unit U1), from the N_GRP and N_CHAN columns only
   implicit none
-  integer status,U1,i,colnum,felem,nelem,j,k,i0,arrayj(5000)
-  real nullval,arraye(5000)
+  integer, intent(in)  :: U1, nenerg
+  integer, intent(out) :: nnz
+  integer status,colnum,j,k,ngrp(1),nchan(5000)
+  integer :: inull = 0
   logical anynull
-  !Read in resp(numchn,nenerg) and En
-  resp = 0.0
+  anynull = .false.
+  nnz = 0
   do J = 1,NENERG
      status = 0
-     !Read in ENERG_LO
-     colnum  = 1
-     felem   = 1
-     nelem   = 1
-     nullval = -1.0
-     anynull = .false.
-     call ftgcve(U1,colnum,J,felem,nelem,nullval,En(J-1),anynull,status)
-     if( status .ne. 0 ) stop 'problem reading ENERG_LO'
-     !Read in ENERG_HI
-     colnum  = 2
-     call ftgcve(U1,colnum,J,felem,nelem,nullval,En(J),anynull,status)
-     if( status .ne. 0 ) stop 'problem reading ENERG_HI'
-     !Read in NGRP(J)
-     colnum  = 3
-     call ftgcvj(U1,colnum,J,felem,nelem,nullval,NGRP(J),anynull,status)
+     colnum = 3
+     call ftgcvj(U1,colnum,J,1,1,inull,NGRP,anynull,status)
      if( status .ne. 0 ) stop 'problem reading NGRP'
-     !Read in FCHAN(J,K)
-     colnum = 4
-     anynull = .false.
-     call ftgcvj(U1,colnum,J,1,NGRP(J),nullval,ARRAYJ,anynull,status)
-     do K = 1,NGRP(J)
-        FCHAN(J,K) = ARRAYJ(K)
-     end do
-     if( status .ne. 0 ) stop 'problem reading FCHAN'
-     !Read in NCHAN(J,K)
      colnum = 5
-     call ftgcvj(U1,colnum,J,1,NGRP(J),nullval,ARRAYJ,anynull,status)
-     do K = 1,NGRP(J)
-        NCHAN(J,K) = ARRAYJ(K)
-        LCHAN(J,K) = FCHAN(J,K)+NCHAN(J,K)
-     end do
+     call ftgcvj(U1,colnum,J,1,NGRP(1),inull,NCHAN,anynull,status)
      if( status .ne. 0 ) stop 'problem reading NCHAN'
-     !Read in MATRIX - first calculate number of elements per row
-     colnum = 6
-     nelem  = 0
-     do K = 1,NGRP(J)
-        nelem = nelem + NCHAN(J,K)
-     end do
-     !Now can read in and put in a sensible format
-     call ftgcve(U1,colnum,J,1,nelem,nullval,ARRAYE,anynull,status)
-     if( status .ne. 0 ) stop 'problem reading MATRIX'
-     if( anynull ) write(*,*)"Null values in MATRIX"
-     I0 = 0
-     do K = 1,NGRP(J)
-        do I = FCHAN(J,K)+1,LCHAN(J,K)
-           I0 = I0 + 1
-           resp(I,J) = ARRAYE(I0)
-        end do
+     do K = 1,NGRP(1)
+        nnz = nnz + NCHAN(K)
      end do
   end do
   return
-end subroutine matrixextension
+end subroutine countresp
 !-----------------------------------------------------------------------
 
 
 !-----------------------------------------------------------------------
-subroutine matrixextension2(U1)
-  use telematrix2
+recursive subroutine readrespcsc(U1,nenerg,numchn,En,respcol,respchn,respval,nnz)
+! Reads the MATRIX extension (already open on unit U1) into compressed
+! sparse column format: only the elements listed in the channel groups
+! (F_CHAN, N_CHAN) are kept, minus exact zeros. respchn and respval must
+! hold at least the nnz elements counted by countresp; on output nnz is
+! the number actually stored.
   implicit none
-  integer status,U1,i,colnum,felem,nelem,j,k,i0,arrayj(5000)
+  integer, intent(in)    :: U1, nenerg, numchn
+  real   , intent(out)   :: En(0:nenerg)
+  integer, intent(out)   :: respcol(nenerg+1)
+  integer, intent(inout) :: nnz
+  integer, intent(out)   :: respchn(nnz)
+  real   , intent(out)   :: respval(nnz)
+  integer status,i,colnum,felem,nelem,j,k,i0,ngrp(1),fchan(5000),nchan(5000)
   real nullval,arraye(5000)
+  integer :: inull = 0
   logical anynull
-  !Read in resp(numchn,nenerg) and En
-  resp2 = 0.0
-  do J = 1,NENERG2
+  felem   = 1
+  nullval = -1.0
+  anynull = .false.
+  nnz = 0
+  do J = 1,NENERG
      status = 0
+     respcol(J) = nnz + 1
      !Read in ENERG_LO
      colnum  = 1
-     felem   = 1
      nelem   = 1
-     nullval = -1.0
-     anynull = .false.
-     call ftgcve(U1,colnum,J,felem,nelem,nullval,En2(J-1),anynull,status)
+     call ftgcve(U1,colnum,J,felem,nelem,nullval,En(J-1),anynull,status)
      if( status .ne. 0 ) stop 'problem reading ENERG_LO'
      !Read in ENERG_HI
      colnum  = 2
-     call ftgcve(U1,colnum,J,felem,nelem,nullval,En2(J),anynull,status)
+     call ftgcve(U1,colnum,J,felem,nelem,nullval,En(J),anynull,status)
      if( status .ne. 0 ) stop 'problem reading ENERG_HI'
      !Read in NGRP(J)
      colnum  = 3
-     call ftgcvj(U1,colnum,J,felem,nelem,nullval,NGRP2(J),anynull,status)
+     call ftgcvj(U1,colnum,J,felem,nelem,inull,NGRP,anynull,status)
      if( status .ne. 0 ) stop 'problem reading NGRP'
-     !Read in FCHAN(J,K)
+     !Read in FCHAN(K) and NCHAN(K)
      colnum = 4
-     anynull = .false.
-     call ftgcvj(U1,colnum,J,1,NGRP2(J),nullval,ARRAYJ,anynull,status)
-     do K = 1,NGRP2(J)
-        FCHAN2(J,K) = ARRAYJ(K)
-     end do
+     call ftgcvj(U1,colnum,J,1,NGRP(1),inull,FCHAN,anynull,status)
      if( status .ne. 0 ) stop 'problem reading FCHAN'
-     !Read in NCHAN(J,K)
      colnum = 5
-     call ftgcvj(U1,colnum,J,1,NGRP2(J),nullval,ARRAYJ,anynull,status)
-     do K = 1,NGRP2(J)
-        NCHAN2(J,K) = ARRAYJ(K)
-        LCHAN2(J,K) = FCHAN2(J,K)+NCHAN2(J,K)
-     end do
+     call ftgcvj(U1,colnum,J,1,NGRP(1),inull,NCHAN,anynull,status)
      if( status .ne. 0 ) stop 'problem reading NCHAN'
      !Read in MATRIX - first calculate number of elements per row
      colnum = 6
      nelem  = 0
-     do K = 1,NGRP2(J)
-        nelem = nelem + NCHAN2(J,K)
+     do K = 1,NGRP(1)
+        nelem = nelem + NCHAN(K)
      end do
-     !Now can read in and put in a sensible format
      call ftgcve(U1,colnum,J,1,nelem,nullval,ARRAYE,anynull,status)
      if( status .ne. 0 ) stop 'problem reading MATRIX'
      if( anynull ) write(*,*)"Null values in MATRIX"
      I0 = 0
-     do K = 1,NGRP2(J)
-        do I = FCHAN2(J,K)+1,LCHAN2(J,K)
+     do K = 1,NGRP(1)
+        do I = FCHAN(K)+1,FCHAN(K)+NCHAN(K)
            I0 = I0 + 1
-           resp2(I,J) = ARRAYE(I0)
+           if( ARRAYE(I0) .eq. 0.0 .or. I .gt. numchn ) cycle
+           nnz = nnz + 1
+           respchn(nnz) = I
+           respval(nnz) = ARRAYE(I0)
         end do
      end do
   end do
+  respcol(NENERG+1) = nnz + 1
   return
-end subroutine matrixextension2
+end subroutine readrespcsc
 !-----------------------------------------------------------------------
 
 
 !-----------------------------------------------------------------------
-subroutine getdim(respname,nenerg,numchn)
+recursive subroutine getdim(respname,nenerg,numchn)
   implicit none
   character (len=500) respname
   integer nenerg,numchn
@@ -711,20 +507,54 @@ end subroutine getdim
 
 
 !-----------------------------------------------------------------------
-subroutine initmatrix
+recursive subroutine loadresp(id)
+! Makes sure the response of RESP id is in the registry (see telematrix).
+! Id 1 is named by RMF_SET and ARF_SET, id n>1 by RMF<n>SET and ARF<n>SET.
+! The matrix is read the first time the id is used, unless another id
+! already loaded the same rmf and arf, in which case the slot is shared.
+! The registry is shared by all threads, so it is filled by one at a time.
+  implicit none
+  integer, intent(in) :: id
+  !$omp critical (reltrans_resp)
+  call loadresp_locked(id)
+  !$omp end critical (reltrans_resp)
+  return
+end subroutine loadresp
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine loadresp_locked(id)
+! Body of loadresp, called inside its critical section
   use telematrix
   implicit none
-  character (len=500) strenv
+  integer, intent(in) :: id
+  character (len=500) strenv,respname,arfname
   character (len=200) rmfenv,arfenv
+  character (len=20)  cid,who
+  logical arf
+  integer m
+  if( id .lt. 1 .or. id .gt. nrespmax )then
+     write(*,*)"RESP must be between 1 and",nrespmax
+     stop 'unknown response'
+  end if
+  if( respslot(id) .ne. 0 ) return
 !Set environment variable names
-  rmfenv = 'RMF_SET'
-  arfenv = 'ARF_SET'  
+  write(cid,'(i0)') id
+  if( id .eq. 1 )then
+     rmfenv = 'RMF_SET'
+     arfenv = 'ARF_SET'
+     who    = ' '
+  else
+     rmfenv = 'RMF'//trim(cid)//'SET'
+     arfenv = 'ARF'//trim(cid)//'SET'
+     who    = ' of RESP '//trim(cid)
+  end if
 !Get name of response file and arf file
   respname = strenv(rmfenv)
-  arfname  = strenv(arfenv)        
+  arfname  = strenv(arfenv)
 !If this is not set, ask for it
   if( trim(respname) .eq. 'none' )then
-     write(*,*)"Enter name of the response file (with full path)"
+     write(*,*)"Enter name of the response file"//trim(who)//" (with full path)"
      read(*,'(a)') respname
   end if
 !Check if I need the arf
@@ -733,92 +563,57 @@ subroutine initmatrix
   if( arf )then
      !If not defined, ask for it
      if( trim(arfname) .eq. 'none' )then
-        write(*,*)"Enter name of the anciliary (arf) response file (with full path)"
+        write(*,*)"Enter name of the anciliary (arf) response file"//trim(who)//" (with full path)"
         read(*,'(a)')arfname
      end if
+  else
+     arfname = ' '
   end if
-
-!Get the dimensions of the arrays in the matrix
-  call getdim(respname,nenerg,numchn)
-  
-!Allocate the arrays
-  allocate( En(0:nenerg) )
-  allocate( Echn(0:numchn) )
-  allocate( resp(numchn,nenerg) )
-  allocate( Ngrp(nenerg) )
-  allocate( fchan(nenerg,numchn) )
-  allocate( lchan(nenerg,numchn) )
-  allocate( nchan(nenerg,numchn) )
-  
-! Read matrix to fill the arrays
-  call readinresp
-
-  needresp = .false.
-  needchans = .true.
+!Share the matrix with any id that already loaded the same files
+  needchans(id) = .true.
+  do m = 1, nrsp
+     if( rsp(m)%respname .eq. respname .and. rsp(m)%arfname .eq. arfname )then
+        respslot(id) = m
+        return
+     end if
+  end do
+!Otherwise read it into a new slot
+  nrsp = nrsp + 1
+  m    = nrsp
+  rsp(m)%respname = respname
+  rsp(m)%arfname  = arfname
+  rsp(m)%arf      = arf
+  call initmatrix_cached(m)
+  respslot(id) = m
   return
-end subroutine initmatrix
+end subroutine loadresp_locked
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-subroutine initmatrix2
-  use telematrix2
+recursive subroutine initmatrix(m)
+! Allocates and reads slot m of the registry, whose file names are set
+  use telematrix
   implicit none
-  character (len=500) strenv
-  character (len=200) rmfenv2,arfenv2
-
-!Set environment variable names
-  rmfenv2 = 'RMF2SET'
-  arfenv2 = 'ARF2SET'  
-!Get name of response file and arf file
-  respname2 = strenv(rmfenv2)
-  arfname2  = strenv(arfenv2)
-  ! write(*,*) 'name of the second response', trim(respname2) 
-  ! write(*,*) 'name of the second arf', trim(arfname2)
-  ! read(*,*) 
-!If this is not set, ask for it
-  if( trim(respname2) .eq. 'none' )then
-     write(*,*)"Enter name of the second response file (with full path)"
-     read(*,'(a)') respname2
-  end if
-  !Check if I need the arf
-  call arfcheck(respname2, arf2)
-!Look for arf
-  if( arf2 )then
-     !If not defined, ask for it
-     if( trim(arfname2) .eq. 'none' )then
-        write(*,*)"Enter name of the second anciliary (arf) response file (with full path)"
-        read(*,'(a)') arfname2
-     end if
-  end if
+  integer, intent(in) :: m
 
 !Get the dimensions of the arrays in the matrix
-  ! write(*,*) ' Get the dimensions of the arrays in the matrix (second matrix)'
-  call getdim(respname2, nenerg2, numchn2)
-  ! write(*,*) 'finished'
+  call getdim(rsp(m)%respname,rsp(m)%nenerg,rsp(m)%numchn)
   
 !Allocate the arrays
-  allocate( En2(0:nenerg2) )
-  allocate( Echn2(0:numchn2) )
-  allocate( resp2(numchn2,nenerg2) )
-  allocate( Ngrp2(nenerg2) )
-  allocate( fchan2(nenerg2,numchn2) )
-  allocate( lchan2(nenerg2,numchn2) )
-  allocate( nchan2(nenerg2,numchn2) )
+  allocate( rsp(m)%En(0:rsp(m)%nenerg) )
+  allocate( rsp(m)%Echn(0:rsp(m)%numchn) )
+  allocate( rsp(m)%respcol(rsp(m)%nenerg+1) )
   
 ! Read matrix to fill the arrays
-  ! write(*,*) ' Read matrix to fill the arrays (second matrix)'
-  call readinresp2
-  ! write(*,*) 'finished'
+  call readinresp(m)
 
-  needresp2  = .false.
-  needchans2 = .true.
   return
-end subroutine initmatrix2
+end subroutine initmatrix
 !-----------------------------------------------------------------------
 
 
 !-----------------------------------------------------------------------
-      subroutine arfcheck(respname,arf)
+      recursive subroutine arfcheck(respname,arf)
       implicit none
       character (len=500) respname
       logical arf
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine get_reflionx(ear, ne, param, ifl, photar)
+recursive subroutine get_reflionx(ear, ne, param, ifl, photar)
   use xillver_tables
   implicit none
   integer, intent(in)  :: ne, ifl
@@ -12,6 +12,8 @@ subroutine get_reflionx(ear, ne, param, ifl, photar)
   data needfile/.true./
   save needfile
   
+! XSPEC's table routines are not thread safe: one thread at a time
+  !$omp critical (reltrans_xspec)
 ! Get the reflionx table  
   if( needfile )then
      envnm  = 'REFLIONX_FILE'
@@ -26,6 +28,7 @@ subroutine get_reflionx(ear, ne, param, ifl, photar)
   end if
 ! Interpolate a spectrum from it
   call xsatbl(ear, ne, param,  path_name_reflionx_table, ifl, photar, photer) 
+  !$omp end critical (reltrans_xspec)
   return
 end subroutine get_reflionx
 !-----------------------------------------------------------------------
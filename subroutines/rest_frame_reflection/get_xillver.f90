@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-    subroutine get_xillver(ear, ne, dim, dimCp, param_xillPL, param_xillCp, Cp, photar)
+    recursive subroutine get_xillver(ear, ne, dim, dimCp, param_xillPL, param_xillCp, Cp, photar)
 !!! This routine calls the correct version of xillver based on the Cp !!!
 !!!   Arg:
       !  ear: energy grid
@@ -22,18 +22,37 @@
 
       real                :: photer(ne)
       integer             :: ifl
+      logical             :: done
 
-      ifl = 0
+      !Use the in-memory tables (xillver_grid.f90) unless switched off or not usable for this call.
+      !xsatbl is not thread safe, so it is called by one thread at a time
+      ifl  = 0
+      done = .false.
       if( Cp .eq. -1 )then         !xillver
          ! write(*,*) 'xillver parameters', param6
-         call xsatbl(ear, ne, param_xillPL, trim(pathname_xillver), ifl, photar, photer)
+         if( xillver_native .eq. 1 ) call xillver_grid(ear, ne, dim, param_xillPL, pathname_xillver, photar, done)
+         if( .not. done )then
+            !$omp critical (reltrans_xspec)
+            call xsatbl(ear, ne, param_xillPL, trim(pathname_xillver), ifl, photar, photer)
+            !$omp end critical (reltrans_xspec)
+         end if
       else if( Cp .eq. 1 )then     !xillverD
          ! write(*,*) 'xillver powerlaw parameters', param_xillPL
          ! write(*,*) trim(pathname_xillverD)
-         call xsatbl(ear, ne, param_xillPL, trim(pathname_xillverD), ifl, photar, photer)
+         if( xillver_native .eq. 1 ) call xillver_grid(ear, ne, dim, param_xillPL, pathname_xillverD, photar, done)
+         if( .not. done )then
+            !$omp critical (reltrans_xspec)
+            call xsatbl(ear, ne, param_xillPL, trim(pathname_xillverD), ifl, photar, photer)
+            !$omp end critical (reltrans_xspec)
+         end if
       else if ( Cp .eq. 2 )then    !xillverDCp
          ! write(*,*) 'xillverCp parameters', param_xillCp
-         call xsatbl(ear, ne, param_xillCp, trim(pathname_xillverDCp), ifl, photar, photer)
+         if( xillver_native .eq. 1 ) call xillver_grid(ear, ne, dimCp, param_xillCp, pathname_xillverDCp, photar, done)
+         if( .not. done )then
+            !$omp critical (reltrans_xspec)
+            call xsatbl(ear, ne, param_xillCp, trim(pathname_xillverDCp), ifl, photar, photer)
+            !$omp end critical (reltrans_xspec)
+         end if
       else
          write(*,*) 'No xillver model available for this configuration'
          stop 
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine normreflionx(ear,ne,Gamma,Afe,logne,kTe,logxi,thetae,photar)
+recursive subroutine normreflionx(ear,ne,Gamma,Afe,logne,kTe,logxi,thetae,photar)
 ! !
 ! ! Returns reflionx model renormalised with xillverDCp
 ! !  
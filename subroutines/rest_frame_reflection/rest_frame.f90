@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine rest_frame(ear,ne,Gamma,Afe,logne,Ecut,logxi,thetae,Cp,photar)
+recursive subroutine rest_frame(ear,ne,Gamma,Afe,logne,Ecut,logxi,thetae,Cp,photar)
 !
 !  Cp : chooses reflection model
 !      -1 xillver      1e15 density and powerlaw illumination  
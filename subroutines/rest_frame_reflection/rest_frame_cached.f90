@@ -0,0 +1,66 @@
+!-----------------------------------------------------------------------
+recursive subroutine rest_frame_cached(ear,ne,Gamma,Afe,logne,Ecut,logxi,thetae,Cp,photar)
+! Wrapper around rest_frame that remembers the last spectra it returned.
+! Within one model evaluation the same parameters come back often: radial
+! zones whose ionisation is clipped to the logxir bounds, and the five calls
+! per zone around dlogxi1/dlogxi2. Parameters are quantised to rfc_quantum
+! to form the key; the least recently used slot is replaced on a miss.
+! The number of slots is set by RELTRANS_RFCACHE (default 512, 0 = off).
+  use rf_cache
+  implicit none
+  integer, intent(in) :: ne, Cp
+  real   , intent(in) :: ear(0:ne), Gamma, Afe, logne, Ecut, logxi, thetae
+  real   , intent(out):: photar(ne)
+  integer(kind=8)     :: key(rfc_nkey)
+  integer             :: i, islot
+  integer             :: get_env_int
+
+  if( rfc_size .lt. 0 )then
+     rfc_size = max( get_env_int("RELTRANS_RFCACHE", 512) , 0 )
+  end if
+  if( rfc_size .eq. 0 )then
+     call rest_frame(ear,ne,Gamma,Afe,logne,Ecut,logxi,thetae,Cp,photar)
+     return
+  end if
+
+  !(Re)allocate if the energy grid is not the one the cache was filled on
+  if( ne .ne. rfc_ne .or. ear(0) .ne. rfc_elo .or. ear(ne) .ne. rfc_ehi )then
+     if( allocated(rfc_key ) ) deallocate(rfc_key )
+     if( allocated(rfc_used) ) deallocate(rfc_used)
+     if( allocated(rfc_spec) ) deallocate(rfc_spec)
+     allocate( rfc_key(rfc_nkey,rfc_size), rfc_used(rfc_size), rfc_spec(ne,rfc_size) )
+     rfc_used = 0
+     rfc_ne   = ne
+     rfc_elo  = ear(0)
+     rfc_ehi  = ear(ne)
+  end if
+
+  key(1) = Cp
+  key(2) = nint( dble(Gamma ) / rfc_quantum , 8 )
+  key(3) = nint( dble(Afe   ) / rfc_quantum , 8 )
+  key(4) = nint( dble(logne ) / rfc_quantum , 8 )
+  key(5) = nint( dble(Ecut  ) / rfc_quantum , 8 )
+  key(6) = nint( dble(logxi ) / rfc_quantum , 8 )
+  key(7) = nint( dble(thetae) / rfc_quantum , 8 )
+
+  rfc_clock = rfc_clock + 1
+  do i = 1, rfc_size
+     if( rfc_used(i) .eq. 0 ) cycle
+     if( all( rfc_key(:,i) .eq. key ) )then
+        photar      = rfc_spec(:,i)
+        rfc_used(i) = rfc_clock
+        rfc_hits    = rfc_hits + 1
+        return
+     end if
+  end do
+
+  !Miss: compute and store in the least recently used (or an empty) slot
+  rfc_misses = rfc_misses + 1
+  call rest_frame(ear,ne,Gamma,Afe,logne,Ecut,logxi,thetae,Cp,photar)
+  islot = minloc( rfc_used, 1 )
+  rfc_key(:,islot)  = key
+  rfc_spec(:,islot) = photar
+  rfc_used(islot)   = rfc_clock
+  return
+end subroutine rest_frame_cached
+!-----------------------------------------------------------------------
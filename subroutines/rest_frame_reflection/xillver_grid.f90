@@ -0,0 +1,295 @@
+!-----------------------------------------------------------------------
+    recursive subroutine xillver_grid(ear, ne, npar, param, pathname, photar, done)
+!!! Native replacement for xsatbl on the xillver tables: the table is read
+!!! once into memory (load_xillver_grid, into the shared list xtab), the
+!!! spectra are interpolated directly on the table energies and then rebinned
+!!! on ear with weights that are only recomputed when the energy grid or the
+!!! table changes (these belong to the model context of the calling thread).
+!!!   Arg:
+      !  ear: energy grid
+      !  ne: number of grid points
+      !  npar: size of param (interpolated parameters, possibly followed by the redshift)
+      !  param: table parameters, same order as for xsatbl
+      !  pathname: FITS table (full path)
+      !  photar: (output) spectrum, same normalisation as xsatbl
+      !  done: (output) false if the table cannot be used natively (the caller then uses xsatbl)
+
+!!! Interpolation is multilinear in the parameters (in log for the parameters
+!!! with METHOD=1), as done by xspec. Parameters outside the grid are clamped
+!!! to its edges.
+      use xillver_tables
+      implicit none
+      integer          , intent(in)  :: ne, npar
+      real             , intent(in)  :: ear(0:ne), param(npar)
+      character (len=*), intent(in)  :: pathname
+      real             , intent(out) :: photar(ne)
+      logical          , intent(out) :: done
+      integer              :: p, n, lo(npar), icorner, idx, i, k, it
+      real                 :: x, t(npar), w
+      real, allocatable    :: spec(:)
+      logical              :: ok
+
+      done = .false.
+      !Find the table, reading it on first use. A table that cannot be read keeps its slot
+      !(ok=.false.), so it is only tried once
+      !$omp critical (reltrans_xillver)
+      it = 0
+      do k = 1, nxtab
+         if( trim(pathname) .eq. trim(xtab(k)%name) ) it = k
+      end do
+      if( it .eq. 0 .and. nxtab .lt. nxtabmax )then
+         nxtab = nxtab + 1
+         it    = nxtab
+         xtab(it)%name = pathname
+         call load_xillver_grid(pathname, xtab(it), ok)
+         if( .not. ok ) write(*,*) 'Cannot use the in-memory table, reverting to xsatbl for ', trim(pathname)
+      end if
+      !$omp end critical (reltrans_xillver)
+      if( it .eq. 0 ) return
+      if( .not. xtab(it)%ok ) return
+      associate( tb => xtab(it) )
+      if( npar .lt. tb%npar ) return
+      !The rest frame spectra are always called with z=0: anything else goes through xsatbl
+      if( tb%zpar .and. npar .gt. tb%npar )then
+         if( param(tb%npar+1) .ne. 0.0 ) return
+      end if
+      if( ne .ne. xgrid_ne .or. it .ne. xgrid_it )then
+         call xillver_grid_weights(ear, ne, tb)
+      else if( any( ear .ne. xgrid_ear ) )then
+         call xillver_grid_weights(ear, ne, tb)
+      end if
+      xgrid_it = it
+
+      !Find the grid cell and the interpolation fraction along each parameter
+      do p = 1, tb%npar
+         n     = tb%nval(p)
+         x     = param(p)
+         lo(p) = 1
+         t(p)  = 0.0
+         if( n .eq. 1 ) cycle
+         if( x .le. tb%val(1,p) )then
+            lo(p) = 1
+            t(p)  = 0.0
+         else if( x .ge. tb%val(n,p) )then
+            lo(p) = n - 1
+            t(p)  = 1.0
+         else
+            do while( x .ge. tb%val(lo(p)+1,p) )
+               lo(p) = lo(p) + 1
+            end do
+            if( tb%method(p) .eq. 1 .and. tb%val(lo(p),p) .gt. 0.0 )then
+               t(p) = log( x / tb%val(lo(p),p) ) / log( tb%val(lo(p)+1,p) / tb%val(lo(p),p) )
+            else
+               t(p) = ( x - tb%val(lo(p),p) ) / ( tb%val(lo(p)+1,p) - tb%val(lo(p),p) )
+            end if
+         end if
+      end do
+
+      !Sum the 2^npar corners of the cell (corners with zero weight are skipped)
+      allocate( spec(tb%nen) )
+      spec = 0.0
+      do icorner = 0, 2**tb%npar - 1
+         w   = 1.0
+         idx = 1
+         do p = 1, tb%npar
+            if( btest(icorner,p-1) )then
+               w   = w * t(p)
+               idx = idx + lo(p) * tb%stride(p)
+            else
+               w   = w * ( 1.0 - t(p) )
+               idx = idx + ( lo(p) - 1 ) * tb%stride(p)
+            end if
+            if( w .eq. 0.0 ) exit
+         end do
+         if( w .eq. 0.0 ) cycle
+         spec = spec + w * tb%spec(:,idx)
+      end do
+
+      !Rebin on the output grid
+      do i = 1, ne
+         photar(i) = 0.0
+         do k = xgrid_woff(i), xgrid_woff(i+1) - 1
+            photar(i) = photar(i) + xgrid_w(k) * spec(xgrid_wk(k))
+         end do
+      end do
+      deallocate( spec )
+      end associate
+      done = .true.
+      return
+    end subroutine xillver_grid
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+    recursive subroutine load_xillver_grid(pathname, tb, ok)
+!!! Reads an xspec additive table model (PARAMETERS, ENERGIES and SPECTRA
+!!! extensions) into tb (see xillver_tables). The spectra are stored in
+!!! one contiguous array, indexed by the position of PARAMVAL on the
+!!! parameter grid (so the row order of the file does not matter).
+!!! ok=.false. if the file cannot be read or the table has additional
+!!! parameters, which are not supported here.
+      use xillver_tables
+      implicit none
+      character (len=*), intent(in)    :: pathname
+      type(xtable)     , intent(inout) :: tb
+      logical          , intent(out)   :: ok
+      integer             :: status, unit, readwrite, blocksize, hdutype
+      integer             :: naddparm, nrows, nvalmax, colval, colnum, colmeth, colspec
+      integer             :: p, row, idx, j
+      integer             :: inull = 0
+      integer, allocatable:: filled(:)
+      real                :: nullval
+      real, allocatable   :: parval(:)
+      logical             :: anynull
+      character (len=80)  :: comment
+
+      ok = .false.
+      tb%ok   = .false.
+      nullval = 0.0
+      anynull    = .false.
+
+      status = 0
+      call ftgiou(unit, status)
+      readwrite = 0
+      call ftopen(unit, trim(pathname), readwrite, blocksize, status)
+      if( status .ne. 0 )then
+         write(*,*) 'Cannot open table ', trim(pathname)
+         call ftfiou(unit, status)
+         return
+      end if
+
+      !Parameters: names of the grid values and interpolation method
+      call ftmnhd(unit, 2, 'PARAMETERS', 0, status)
+      call ftgkyj(unit, 'NINTPARM', tb%npar, comment, status)
+      call ftgkyj(unit, 'NADDPARM', naddparm, comment, status)
+      if( status .ne. 0 .or. naddparm .ne. 0 ) goto 100
+      allocate( tb%nval(tb%npar), tb%method(tb%npar), tb%stride(tb%npar) )
+      call ftgcno(unit, .false., 'NUMBVALS', colnum , status)
+      call ftgcno(unit, .false., 'METHOD'  , colmeth, status)
+      call ftgcno(unit, .false., 'VALUE'   , colval , status)
+      call ftgcvj(unit, colnum , 1, 1, tb%npar, inull, tb%nval  , anynull, status)
+      call ftgcvj(unit, colmeth, 1, 1, tb%npar, inull, tb%method, anynull, status)
+      if( status .ne. 0 ) goto 100
+      nvalmax = maxval(tb%nval)
+      allocate( tb%val(nvalmax,tb%npar) )
+      tb%val = 0.0
+      do p = 1, tb%npar
+         call ftgcve(unit, colval, p, 1, tb%nval(p), nullval, tb%val(:,p), anynull, status)
+      end do
+      tb%nspec = 1
+      do p = 1, tb%npar
+         tb%stride(p) = tb%nspec
+         tb%nspec     = tb%nspec * tb%nval(p)
+      end do
+      !The redshift is an extra (non interpolated) parameter only if the REDSHIFT keyword is set
+      call ftmahd(unit, 1, hdutype, status)
+      tb%zpar = .false.
+      call ftgkyl(unit, 'REDSHIFT', tb%zpar, comment, status)
+      if( status .eq. 202 ) status = 0   !keyword not present
+      if( status .ne. 0 ) goto 100
+
+      !Energy bins
+      call ftmnhd(unit, 2, 'ENERGIES', 0, status)
+      call ftgkyj(unit, 'NAXIS2', tb%nen, comment, status)
+      if( status .ne. 0 ) goto 100
+      allocate( tb%elo(tb%nen), tb%ehi(tb%nen) )
+      call ftgcno(unit, .false., 'ENERG_LO', colnum, status)
+      call ftgcve(unit, colnum, 1, 1, tb%nen, nullval, tb%elo, anynull, status)
+      call ftgcno(unit, .false., 'ENERG_HI', colnum, status)
+      call ftgcve(unit, colnum, 1, 1, tb%nen, nullval, tb%ehi, anynull, status)
+      if( status .ne. 0 ) goto 100
+
+      !Spectra
+      call ftmnhd(unit, 2, 'SPECTRA', 0, status)
+      call ftgkyj(unit, 'NAXIS2', nrows, comment, status)
+      if( status .ne. 0 .or. nrows .ne. tb%nspec )then
+         write(*,*) 'Table ', trim(pathname), ' has ', nrows, ' spectra, expected ', tb%nspec
+         goto 100
+      end if
+      allocate( tb%spec(tb%nen,tb%nspec), parval(tb%npar), filled(tb%nspec) )
+      filled = 0
+      call ftgcno(unit, .false., 'PARAMVAL', colnum , status)
+      call ftgcno(unit, .false., 'INTPSPEC', colspec, status)
+      do row = 1, nrows
+         call ftgcve(unit, colnum, row, 1, tb%npar, nullval, parval, anynull, status)
+         idx = 1
+         do p = 1, tb%npar
+            j   = minloc( abs( tb%val(1:tb%nval(p),p) - parval(p) ), 1 )
+            idx = idx + ( j - 1 ) * tb%stride(p)
+         end do
+         call ftgcve(unit, colspec, row, 1, tb%nen, nullval, tb%spec(:,idx), anynull, status)
+         filled(idx) = filled(idx) + 1
+         if( status .ne. 0 ) goto 100
+      end do
+      if( any( filled .ne. 1 ) )then
+         write(*,*) 'Table ', trim(pathname), ' does not cover its parameter grid'
+         goto 100
+      end if
+      deallocate( parval, filled )
+
+      call ftclos(unit, status)
+      call ftfiou(unit, status)
+      tb%ok = .true.
+      ok = .true.
+      write(*,'(A,A,A,I0,A,F8.1,A)') 'Loaded ', trim(pathname), ' in memory (', tb%nspec, ' spectra, ',&
+           4.0 * real(tb%nen) * real(tb%nspec) / 1024.0**2, ' MB)'
+      return
+
+100   write(*,*) 'Problem reading table ', trim(pathname), ' (FITSIO status ', status, ')'
+      if( allocated(tb%spec) ) deallocate(tb%spec)
+      if( allocated(parval    ) ) deallocate(parval    )
+      if( allocated(filled    ) ) deallocate(filled    )
+      status = 0
+      call ftclos(unit, status)
+      call ftfiou(unit, status)
+      return
+    end subroutine load_xillver_grid
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+    recursive subroutine xillver_grid_weights(ear, ne, tb)
+!!! Overlap weights between the energy bins of table tb and the bins of ear:
+!!! output bin i collects xgrid_w(k)*spec(xgrid_wk(k)) for
+!!! k = xgrid_woff(i), ..., xgrid_woff(i+1)-1, where xgrid_w is the fraction
+!!! of the table bin that falls in the output bin (flat spectrum within a
+!!! table bin, as in xspec). Both grids are increasing, so this is a merge.
+      use xillver_tables
+      implicit none
+      integer     , intent(in) :: ne
+      real        , intent(in) :: ear(0:ne)
+      type(xtable), intent(in) :: tb
+      integer             :: i, k, n
+      real                :: elo, ehi
+
+      if( allocated(xgrid_ear ) ) deallocate(xgrid_ear )
+      if( allocated(xgrid_woff) ) deallocate(xgrid_woff)
+      if( allocated(xgrid_wk  ) ) deallocate(xgrid_wk  )
+      if( allocated(xgrid_w   ) ) deallocate(xgrid_w   )
+      allocate( xgrid_ear(0:ne), xgrid_woff(ne+1) )
+      !Every overlapping pair advances at least one of the two grids
+      allocate( xgrid_wk(ne+tb%nen), xgrid_w(ne+tb%nen) )
+      xgrid_ear = ear
+      xgrid_ne  = ne
+
+      n = 0
+      k = 1
+      do i = 1, ne
+         xgrid_woff(i) = n + 1
+         do while( k .le. tb%nen )
+            if( tb%ehi(k) .gt. ear(i-1) ) exit
+            k = k + 1
+         end do
+         do while( k .le. tb%nen )
+            if( tb%elo(k) .ge. ear(i) ) exit
+            elo = max( tb%elo(k), ear(i-1) )
+            ehi = min( tb%ehi(k), ear(i) )
+            n   = n + 1
+            xgrid_wk(n) = k
+            xgrid_w(n)  = ( ehi - elo ) / ( tb%ehi(k) - tb%elo(k) )
+            if( tb%ehi(k) .gt. ear(i) ) exit
+            k = k + 1
+         end do
+      end do
+      xgrid_woff(ne+1) = n + 1
+      return
+    end subroutine xillver_grid_weights
+!-----------------------------------------------------------------------
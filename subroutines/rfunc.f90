@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      function rfunc(a,mu0)
+      recursive function rfunc(a,mu0)
 ! Sets minimum rn to use for impact parameter grid depending on mu0
 ! This is just an analytic function based on empirical calculations:
 ! I simply set a=0.998, went through the full range of mu0, and then
@@ -0,0 +1,157 @@
+!-----------------------------------------------------------------------
+      recursive subroutine initmatrix_cached(m)
+! Wrapper around initmatrix that keeps the processed response of slot m
+! (channel bounds, energy grid and the ARF-multiplied sparse matrix) on
+! disk. Reading a large rmf row by row through CFITSIO dominates the
+! start-up of each worker; the cache file replaces it with three reads.
+! The cache is only used if the environment variable RELTRANS_RSPCACHE
+! is set to a (writable) directory. The header stores the rmf and arf
+! names with their size and modification time and is checked exactly on
+! load, so a file made from different or since modified inputs is rebuilt.
+        use telematrix
+      implicit none
+      integer m
+      character (len=500) cachedir,strenv,fname
+      character (len=200) envnm
+      integer key(4)
+      logical loaded
+      envnm    = 'RELTRANS_RSPCACHE'
+      cachedir = strenv(envnm)
+      if( trim(cachedir) .eq. 'none' )then
+        call initmatrix(m)
+        return
+      end if
+      call rspcache_key(m,key)
+      call rspcache_name(cachedir,m,fname)
+      call rspcache_read(fname,m,key,loaded)
+      if( .not. loaded )then
+        call initmatrix(m)
+        call rspcache_write(fname,m,key)
+      end if
+      return
+      end subroutine initmatrix_cached
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine rspcache_key(m,key)
+! Size and modification time of the rmf and (if used) arf of slot m.
+! A file that cannot be stat'ed gets -1, which never matches a cache file
+! written from an existing one.
+        use telematrix
+      implicit none
+      integer m,key(4)
+      integer sarray(13),status
+      key = -1
+      call stat(trim(rsp(m)%respname),sarray,status)
+      if( status .eq. 0 )then
+        key(1) = sarray(8)
+        key(2) = sarray(10)
+      end if
+      if( rsp(m)%arf )then
+        call stat(trim(rsp(m)%arfname),sarray,status)
+        if( status .eq. 0 )then
+          key(3) = sarray(8)
+          key(4) = sarray(10)
+        end if
+      else
+        key(3:4) = 0
+      end if
+      return
+      end subroutine rspcache_key
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine rspcache_name(cachedir,m,fname)
+! Builds the cache file name from the base name of the rmf and a hash of
+! the full rmf and arf names. As for the GR cache the name is only a label:
+! the names themselves are stored in (and checked against) the file header.
+        use telematrix
+      implicit none
+      integer m
+      character (len=500) cachedir,fname
+      character (len=1000) names
+      integer i,i0
+      integer(kind=8) h
+      names = trim(rsp(m)%respname)//'|'//trim(rsp(m)%arfname)
+      h = 0
+      do i = 1, len_trim(names)
+        h = mod( h * 131_8 + ichar(names(i:i)) , 4294967291_8 )
+      end do
+      i0 = index( rsp(m)%respname, '/', back=.true. )
+      write(fname,'(A,A,A,A,Z8.8,A)') trim(cachedir),'/rsp_',trim(rsp(m)%respname(i0+1:)),'_',h,'.bin'
+      return
+      end subroutine rspcache_name
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine rspcache_read(fname,m,key,loaded)
+! Fills slot m from the cache file fname. loaded=.false. if there is no
+! file, or it was made from other rmf/arf names, or from files of another
+! size or modification time (key); initmatrix then reads the FITS files.
+        use telematrix
+      implicit none
+      integer m,key(4)
+      character (len=500) fname
+      logical loaded
+      integer unit,ios,keyf(4),nenerg,numchn,nnz
+      character (len=500) respnamef,arfnamef
+      loaded = .false.
+      call cachefile_openr(fname,rspcache_magic,rspcache_version,unit,loaded)
+      if( .not. loaded ) return
+      loaded = .false.
+      read(unit,iostat=ios) respnamef,arfnamef,keyf
+      if( ios .ne. 0 .or. respnamef .ne. rsp(m)%respname .or. arfnamef .ne. rsp(m)%arfname &
+           .or. any( keyf .ne. key ) .or. any( key .eq. -1 ) )then
+        close(unit)
+        return
+      end if
+      read(unit,iostat=ios) nenerg,numchn,nnz
+      if( ios .ne. 0 )then
+        close(unit)
+        return
+      end if
+      rsp(m)%nenerg  = nenerg
+      rsp(m)%numchn  = numchn
+      rsp(m)%respnnz = nnz
+      if( allocated(rsp(m)%En     ) ) deallocate(rsp(m)%En     )
+      if( allocated(rsp(m)%ECHN   ) ) deallocate(rsp(m)%ECHN   )
+      if( allocated(rsp(m)%respcol) ) deallocate(rsp(m)%respcol)
+      if( allocated(rsp(m)%respchn) ) deallocate(rsp(m)%respchn)
+      if( allocated(rsp(m)%respval) ) deallocate(rsp(m)%respval)
+      allocate( rsp(m)%En(0:nenerg), rsp(m)%ECHN(0:numchn), rsp(m)%respcol(nenerg+1) )
+      allocate( rsp(m)%respchn(nnz), rsp(m)%respval(nnz) )
+      read(unit,iostat=ios) rsp(m)%En,rsp(m)%ECHN,rsp(m)%respcol,rsp(m)%respchn,rsp(m)%respval
+      close(unit)
+      if( ios .ne. 0 )then
+        !truncated file: leave the slot empty for initmatrix
+        deallocate( rsp(m)%En, rsp(m)%ECHN, rsp(m)%respcol, rsp(m)%respchn, rsp(m)%respval )
+        return
+      end if
+      loaded = .true.
+      return
+      end subroutine rspcache_read
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine rspcache_write(fname,m,key)
+! Saves slot m, as just built by initmatrix, to fname together with the
+! rmf/arf names and key. Nothing is written if either file could not be
+! stat'ed, since such a key could never be matched again.
+        use telematrix
+      implicit none
+      integer m,key(4)
+      character (len=500) fname
+      character (len=520) tmpname
+      integer unit,ios
+      logical ok
+      if( any( key .eq. -1 ) ) return
+      call cachefile_openw(fname,rspcache_magic,rspcache_version,tmpname,unit,ok)
+      if( .not. ok ) return
+      write(unit,iostat=ios) rsp(m)%respname,rsp(m)%arfname,key
+      if( ios .eq. 0 ) write(unit,iostat=ios) rsp(m)%nenerg,rsp(m)%numchn,rsp(m)%respnnz
+      if( ios .eq. 0 ) write(unit,iostat=ios) rsp(m)%En,rsp(m)%ECHN,rsp(m)%respcol,&
+           rsp(m)%respchn(1:rsp(m)%respnnz),rsp(m)%respval(1:rsp(m)%respnnz)
+      call cachefile_close(unit,tmpname,fname,ios)
+      return
+      end subroutine rspcache_write
+!-----------------------------------------------------------------------
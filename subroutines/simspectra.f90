@@ -0,0 +1,38 @@
+!-----------------------------------------------------------------------
+subroutine simspectra(Cp, dset, nlp, ear, ne, param, ifl, photar, nex, earx, rephotarx, imphotarx, photarx)
+! Model products needed by the simulation wrappers, for one set of parameters:
+! photar(ne)     `folded' lags (ReIm=6) on the grid ear, in photar form
+! rephotarx(nex) real part of the cross spectrum on the grid earx
+! imphotarx(nex) imaginary part of the cross spectrum on the grid earx
+! photarx(nex)   DC spectrum on the grid earx
+! The real and imaginary parts come out of the lag call (see sim_products), and
+! the DC call only rebuilds the kernels from the pixel list of the lag call, so
+! this costs one ray tracing and one set of convolutions plus a DC convolution.
+  use sim_products
+  implicit none
+  integer, intent(in)    :: Cp, dset, nlp, ne, nex
+  integer, intent(inout) :: ifl
+  real   , intent(in)    :: ear(0:ne), earx(0:nex), param(32)
+  real   , intent(out)   :: photar(ne), rephotarx(nex), imphotarx(nex), photarx(nex)
+  real    :: par(32)
+  par = param
+  if( allocated(earsim) )then
+     if( size(resim) .ne. nex ) deallocate( earsim, resim, imsim )
+  end if
+  if( .not. allocated(earsim) ) allocate( earsim(0:nex), resim(nex), imsim(nex) )
+  earsim = earx
+! Folded lags, plus real and imaginary parts
+  nsim    = nex
+  par(25) = 6.0   !ReIm
+  call genreltrans(Cp, dset, nlp, ear, ne, par, ifl, photar)
+  nsim    = 0
+  rephotarx = resim
+  imphotarx = imsim
+! DC component
+  par(23) = 0.0   !floHz
+  par(24) = 0.0   !fhiHz
+  par(25) = 1.0   !ReIm
+  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, photarx)
+  return
+end subroutine simspectra
+!-----------------------------------------------------------------------
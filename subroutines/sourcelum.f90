@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      subroutine sourcelum(nex,earx,contx,mass,gso,gamma)
+      recursive subroutine sourcelum(nex,earx,contx,mass,gso,gamma)
 ! Calculates implies source luminosity in units of the Eddington limit       
       integer nex,i
       real earx(0:nex),contx(nex),integral,E,lambda,mass
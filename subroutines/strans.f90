@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b1,b2,qboost,eta_0,&
+recursive subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b1,b2,qboost,eta_0,&
                   fcons,nro,nphi,ne,dloge,nf,fhi,flo,me,xe,ker_W0,ker_W1,ker_W2,ker_W3,frobs,frrel)
     ! Code to calculate the transfer function for an accretion disk.
     ! This code first does full GR ray tracing for a camera with impact parameters < bmax
@@ -36,13 +36,13 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
     use blcoordinate
     use radial_grids
     use gr_continuum
+    use kernel_pixels
     implicit none
     integer nro,nphi,ne,nf,me,xe,dset,nlp
     double precision spin,h(nlp),mu0,Gamma,rin,rout,zcos,fhi,flo,honr
     double precision b1,b2,qboost
     double precision fcons,cosdout(nlp)
     real dloge, lognep
-    complex cexp!,transe(0:nlp,ne,nf,me,xe),transe_a(nlp,ne,nf,me,xe)
 
     integer i,j,odisc,n,gbin,rbin,mubin,l,m,k,nl
     double precision domega(nro),d,taudo,g,dlgfacthick,dFe(nlp),newtex,contx_int(nlp)
@@ -54,13 +54,17 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
     double precision rnmax,rnmin,rn(nro),phin,mueff,dlogr,interper
     double precision fi(nf),dgsofac,sindisk,mue,demang,frobs(nlp),cosdin,frrel(nlp)
     double precision pnormer,mus,ptf,pfunc_raw,ang_fac
-    integer nron,nphin,nrosav,nphisav,verbose
-    double precision spinsav,musav,routsav,mudsav,rnn(nro),domegan(nro)
+    integer nron,nphin,verbose
+    double precision rnn(nro),domegan(nro)
     integer get_env_int
     double precision lximax
     double precision eta_0
     logical dotrace
 
+    !pixel list used to build the kernels (see below); the part needed by kernel_scatter is kept in kernel_pixels
+    integer npixgr,ilast,p
+    double precision, allocatable :: pixgfac(:),pixdFe(:,:),pixfro(:,:)
+
     !new stuff - move back above once it's implemented properly    
     complex ker_W0(nlp,ne,nf,me,xe),ker_W1(nlp,ne,nf,me,xe),ker_W2(nlp,ne,nf,me,xe),ker_W3(nlp,ne,nf,me,xe)
     real emisfac,thetafac(nlp),kfac,normfac
@@ -71,8 +75,6 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
     double precision   :: tmin, tmax, sumresp, tar(0:nt), dlogt, dg, E
     double precision, allocatable :: resp(:,:)
 
-    data nrosav,nphisav,spinsav,musav /0,0,2.d0,2.d0/
-    save nrosav,nphisav,spinsav,musav,routsav,mudsav
        
     ! Settings/initialization
     nron     = 100
@@ -138,6 +140,7 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
 
     ! Trace rays in full GR for the small camera (ie with relativistic effects) from the osberver to the disk,
     !which is why it doesnt depend on h
+    !The camera in re1, taudo1, pem1 belongs to the geometry spinsav, musav, routsav, mudsav (dyn_gr)
     if(status_re_tau) then !Only if the geodesics grid isn't loaded
         dotrace = .false.
         if( abs(spinsav-spin)  .gt. tiny(spin)   ) dotrace = .true.
@@ -145,7 +148,7 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
         if( abs(routsav-rout)  .gt. tiny(rout)   ) dotrace = .true.
         if( abs(mudsav-mudisk) .gt. tiny(mudisk) ) dotrace = .true.         
         if( dotrace )then
-            call GRtrace(nro,nphi,rn,mueff,mu0,spin,rmin,rout,mudisk,d)
+            call GRtrace_cached(nro,nphi,rn,mueff,mu0,spin,rmin,rout,mudisk,d)
             spinsav = spin
             musav   = mu0
             routsav = rout
@@ -157,7 +160,7 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
     do fbin = 1,nf
         fi(fbin) = flo * (fhi/flo)**((float(fbin)-0.5d0)/dble(nf))
     end do
-    if( fhi .lt. tiny(fhi) ) fi(1) = 0.0d0
+    if( fhi .lt. tiny(fhi) .and. nf .gt. 0 ) fi(1) = 0.0d0
 
     !initialize radius grid, angles, and transfer functions
     dlogr    = log10(rnmax/rin) / real(xe-1)
@@ -179,13 +182,47 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
     !transfer function/convolution kernel in energy (gbin), frequency (fbin), emission angle (mubin), disk radial 
     !bin (rbin) from the m-th/nl-th lamp post
     
-    ! Construct the transfer function by summing over all pixels
+    ! Construct the transfer function by summing over all pixels.
+    ! This is done in three steps so that it can run on several threads and still give
+    ! exactly the same kernels as a serial run:
+    ! 1) every pixel that hits the disk is evaluated independently (in parallel) and its
+    !    bins, time lags and weights are stored in the pixel list pix*
+    ! 2) the scalar sums (frobs, dfer_arr, impulse response) are added up serially in pixel order
+    ! 3) the pixel list is scattered into ker_W0..3 by kernel_scatter, which shares out the
+    !    frequency bins between threads so that each kernel element is summed in pixel order
+    ! Pixels are numbered in the order of the original loops: the GR camera from the outside
+    ! ring inwards, then the Newtonian camera.
+    ! The module arrays used in the loops (dyn_gr, gr_continuum, kernel_pixels, pnorm) are
+    ! threadprivate, since they belong to the model context: copyin passes them to the team.
+
+    ! Find the rings of the GR camera to visit: the camera is scanned from the outside in,
+    ! stopping after the first ring that does not hit the disk between rin and rout
     odisc    = 1       !flag to ensure the chosen disk radius is between rin and rout
-    i        = nro + 1
-    do while( odisc .eq. 1 .and. i .gt. 1 )             !main loops of the subroutine: first is for GR
-        i = i - 1                                       !i counts over the camera until it reaches the disk inner radius
+    ilast    = nro + 1
+    do while( odisc .eq. 1 .and. ilast .gt. 1 )
+        ilast = ilast - 1
         odisc = 0
+        do j = 1,nphi
+            if( pem1(j,ilast) .gt. 0.0d0 )then
+                if( re1(j,ilast) .gt. rin .and. re1(j,ilast) .lt. rout ) odisc = 1
+            end if
+        end do
+    end do
+    npixgr = (nro-ilast+1) * nphi
+    npix   = npixgr + nron * nphin
+    if( associated(pixhit) ) deallocate( pixhit, pixg, pixr, pixmu, pixtau, pixw )
+    allocate( pixhit(npix), pixg(npix), pixr(npix), pixmu(npix), pixgfac(npix) )
+    allocate( pixtau(nlp,npix), pixdFe(nlp,npix), pixfro(nlp,npix), pixw(0:3,nlp,npix) )
+
+    !main loops of the subroutine: first is for GR
+    !$omp parallel do collapse(2) schedule(dynamic) default(shared) &
+    !$omp& private(i,j,p,m,phin,alpha,beta,re,taudo,g,kk,tausd,tau,cosfac,mus,ptf,gsd,emissivity,dFe,&
+    !$omp& thetafac,gbin,rbin,mue,mubin,emisfac,kfac,normfac,nl) &
+    !$omp& copyin(re1,taudo1,pem1,npts,rlp,tlp,dcosdr,cosd,tauso,gso,pnorm,pixhit,pixg,pixr,pixmu,pixtau,pixw)
+    do i = nro,ilast,-1                                 !i counts over the camera until it reaches the disk inner radius
         do j = 1,NPHI                                   !azimuth over BH on the disk
+            p = (nro-i)*nphi + j
+            pixhit(p) = .false.
             phin  = (j-0.5) * 2.d0 * pi / dble(nphi) 
             alpha = rn(i) * sin(phin)
             beta  = -rn(i) * cos(phin) * mueff
@@ -193,10 +230,10 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
             if( pem1(j,i) .gt. 0.0d0 )then
                 re    = re1(j,i)
                 if( re .gt. rin .and. re .lt. rout )then
-                    odisc = 1  
+                    pixhit(p) = .true.
+                    g = dlgfacthick(spin,mu0,alpha,re,mudisk) !disk to observer g factor
                     do m=1,nlp                           
                         taudo = taudo1(j,i)           
-                        g = dlgfacthick(spin,mu0,alpha,re,mudisk) !disk to observer g factor
                         !Find the rlp bin that corresponds to re
                         kk = get_index(rlp(:,m),ndelta,re,rmin,npts(m))
                         !Interpolate (or extrapolate) the time function
@@ -223,81 +260,71 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
                         else !single lamp post case, double check this later
                             thetafac(m) = 1.                            
                         endif                        
-                        !Add to reflection fraction
-                        frobs(m) = frobs(m) + 2.0*g**3*gsd(m)*cosfac/dareafac(re,spin)*domega(i)    
-                        ! write(*,*) g, gsd(m), cosfac, dareafac(re, spin), domega(i)
+                        !Contribution to the reflection fraction
+                        pixfro(m,p) = 2.0*g**3*gsd(m)*cosfac/dareafac(re,spin)*domega(i)    
                     end do
-                   
-                    !tbd: put a second for loop over lps here, now that both emissivity/dfe/tau are known
+                    !Work out energy bin
+                    gbin = ceiling( log10( g/(1.d0+zcos) ) / dloge ) + ne / 2
+                    gbin = MAX( 1    , gbin  )
+                    gbin = MIN( gbin , ne    )         
+                    !Work out radial bin
+                    rbin = ceiling( log10(re/rin) / dlogr )
+                    rbin = MAX( rbin , 1  )
+                    rbin = MIN( rbin , xe )
+                    !Calculate emission angle and work out which mue bin to add to
+                    mue   = demang(spin,mu0,re,alpha,beta)
+                    mubin = ceiling( mue * dble(me) )
+                    !calculate the extra factors for w2/3
+                    !if (nl .eq. 1 .and. nlp .gt. 1) then
+                    !    emisfac = emissivity(1)+eta_0*emissivity(2)                          
+                    if (nlp .gt. 1) then
+                        emisfac = (emissivity(1)+eta_0*emissivity(2))/(1.+eta_0)
+                        kfac = (emissivity(1)+eta_0*emissivity(2))/(thetafac(1)+eta_0*thetafac(2)) 
+                    else
+                        emisfac = emissivity(1)
+                        kfac = emissivity(1)
+                        !single lamp post case, double check this later
+                    endif     
+                    !this is just to make the formatting below less ugly     
+                    normfac = real(g**3*domega(i)/(1.d0+zcos)**3)                 
+                    pixg(p)    = gbin
+                    pixr(p)    = rbin
+                    pixmu(p)   = mubin
+                    pixgfac(p) = g
+                    !Weights of the pixel in the transfer function integrals
                     do nl=1,nlp 
-                        !Work out energy bin
-                        gbin = ceiling( log10( g/(1.d0+zcos) ) / dloge ) + ne / 2
-                        gbin = MAX( 1    , gbin  )
-                        gbin = MIN( gbin , ne    )         
-                        !Work out radial bin
-                        rbin = ceiling( log10(re/rin) / dlogr )
-                        rbin = MAX( rbin , 1  )
-                        rbin = MIN( rbin , xe )
-                        !Add to the radial dependence of the transfer function TBD MAKE SURE THIS IS RIGHT
-                        dfer_arr(rbin) = dfer_arr(rbin) + dFe(nl)                 
-                        !Calculate emission angle and work out which mue bin to add to
-                        mue   = demang(spin,mu0,re,alpha,beta)
-                        mubin = ceiling( mue * dble(me) )
-                        !calculate the extra factors for w2/3
-                        !if (nl .eq. 1 .and. nlp .gt. 1) then
-                        !    emisfac = emissivity(1)+eta_0*emissivity(2)                          
-                        if (nlp .gt. 1) then
-                            emisfac = (emissivity(1)+eta_0*emissivity(2))/(1.+eta_0)
-                            kfac = (emissivity(1)+eta_0*emissivity(2))/(thetafac(1)+eta_0*thetafac(2)) 
-                        else
-                            emisfac = emissivity(1)
-                            kfac = emissivity(1)
-                            !single lamp post case, double check this later
-                        endif     
-                        !this is just to make the formatting below less ugly     
-                        normfac = real(g**3*domega(i)/(1.d0+zcos)**3)                 
-                        !Add to the transfer function integral
-                        do fbin = 1,nf
-                            cexp = cmplx(cos(real(2.d0*pi*tau(nl)*fi(fbin))),sin(real(2.d0*pi*tau(nl)*fi(fbin))))
-                            ker_W0(nl,gbin,fbin,mubin,rbin) = ker_W0(nl,gbin,fbin,mubin,rbin) + real(dFe(nl))*cexp
-                            ker_W1(nl,gbin,fbin,mubin,rbin) = ker_W1(nl,gbin,fbin,mubin,rbin) + &
-                                                              real(log(gsd(nl)))*real(dFe(nl))*cexp  
-                            !tbd redo these transfer functions                             
-                            ker_W2(nl,gbin,fbin,mubin,rbin) = ker_W2(nl,gbin,fbin,mubin,rbin) + &
-                                                              emisfac*normfac*cexp
-                            ker_W3(nl,gbin,fbin,mubin,rbin) = ker_W3(nl,gbin,fbin,mubin,rbin) + &
-                                                              kfac*thetafac(nl)*normfac*cexp 
-                        end do
-                        !if large verbose, start saving the impulse response function to file 
-                        if( verbose .gt. 1 ) then
-                            !find the appropriate energy and time bins
-                            gbin = ceiling(g/dg) 
-                            gbin = MAX( 1    , gbin  )
-                            gbin = MIN( gbin , ne    )
-                            tbin = ceiling( log10( tau(nl) / tar(0) ) / dlogt )
-                            !write(102,*)re,tau,log10( tau / tar(0) ) / dlogt
-                            tbin = MAX( 1    , tbin )
-                            tbin = MIN( tbin , nt   )
-                            ! kernel of the impulse response function              
-                            resp(gbin,tbin) = resp(gbin,tbin) + dFe(nl)  
-                        end if 
-                    end do                    
+                        pixtau(nl,p)   = tau(nl)
+                        pixdFe(nl,p)   = dFe(nl)
+                        pixw(0,nl,p)   = real(dFe(nl))
+                        pixw(1,nl,p)   = real(log(gsd(nl)))*real(dFe(nl))
+                        !tbd redo these transfer functions                             
+                        pixw(2,nl,p)   = emisfac*normfac
+                        pixw(3,nl,p)   = kfac*thetafac(nl)*normfac
+                    end do
                 end if
             end if                
         end do
     end do
+    !$omp end parallel do
 
     ! Now trace rays for that bigger camera (obviously a lot easier because it's Newtonian)
+    !$omp parallel do collapse(2) schedule(dynamic) default(shared) &
+    !$omp& private(i,j,p,m,phin,alpha,beta,re,phie,g,kk,tau,cosfac,mus,ptf,gsd,emissivity,dFe,&
+    !$omp& thetafac,gbin,rbin,mue,mubin,emisfac,kfac,normfac,nl) &
+    !$omp& copyin(npts,rlp,dcosdr,cosd,gso,pnorm,pixhit,pixg,pixr,pixmu,pixtau,pixw)
     do i = 1,nron
         do j = 1,nphin
+            p = npixgr + (i-1)*nphin + j
+            pixhit(p) = .false.
             phin  = (j-0.5) * 2.d0 * pi / dble(nphin) 
             alpha = rnn(i) * sin(phin)
             beta  = -rnn(i) * cos(phin) * mueff
             call drandphithick(alpha,beta,mu0,mudisk,re,phie)
             !If the ray hits the disk, calculate flux and time lag
             if( re .gt. rin .and. re .lt. rout )then
+                pixhit(p) = .true.
+                g = dlgfacthick( spin,mu0,alpha,re,mudisk )
                 do m=1,nlp
-                    g = dlgfacthick( spin,mu0,alpha,re,mudisk )
                     !Find the rlp bin that corresponds to re
                     kk = get_index(rlp(:,m),ndelta,re,rmin,npts(m))
                     !Time lag
@@ -323,64 +350,80 @@ subroutine rtrans(verbose,dset,nlp,spin,h,mu0,Gamma,rin,rout,honr,d,rnmax,zcos,b
                     else !single lamp post case, double check this later
                         thetafac(m) = 1.                      
                     endif
-                    !Add to reflection fraction
-                    frobs(m) = frobs(m) + 2.0*g**3*gsd(m)*cosfac/dareafac(re,spin)*domegan(i)
+                    !Contribution to the reflection fraction
+                    pixfro(m,p) = 2.0*g**3*gsd(m)*cosfac/dareafac(re,spin)*domegan(i)
                 end do 
-                
+                !Work out energy bin
+                gbin = ceiling( log10( g/(1.d0+zcos) ) / dloge ) + ne / 2
+                gbin = MAX( 1    , gbin  )
+                gbin = MIN( gbin , ne    )
+                !Work out radial bin
+                rbin = ceiling( log10(re/rin) / dlogr )
+                rbin = MAX( rbin , 1  )
+                rbin = MIN( rbin , xe )
+                !Calculate emission angle and work out which mue bin to add to
+                mue = demang(spin,mu0,re,alpha,beta)
+                mubin = ceiling( mue * dble(me) )
+                !calculate the extra factors for w2/3
+                if (nlp .gt. 1) then
+                    emisfac = (emissivity(1)+eta_0*emissivity(2))/(1.+eta_0)
+                    kfac = (emissivity(1)+eta_0*emissivity(2))/(thetafac(1)+eta_0*thetafac(2)) 
+                else
+                    emisfac = emissivity(1)
+                    kfac = emissivity(1)
+                    !single lamp post case, double check this later
+                endif  
+                !this is just to make the formatting below less ugly     
+                normfac = real(g**3*domegan(i)/(1.d0+zcos)**3)                 
+                pixg(p)    = gbin
+                pixr(p)    = rbin
+                pixmu(p)   = mubin
+                pixgfac(p) = g
+                !Weights of the pixel in the transfer function integrals
                 do nl=1,nlp
-                    !Work out energy bin
-                    gbin = ceiling( log10( g/(1.d0+zcos) ) / dloge ) + ne / 2
-                    gbin = MAX( 1    , gbin  )
-                    gbin = MIN( gbin , ne    )
-                    !Work out radial bin
-                    rbin = ceiling( log10(re/rin) / dlogr )
-                    rbin = MAX( rbin , 1  )
-                    rbin = MIN( rbin , xe )
-                    !Add to the radial dependence of the transfer function
-                    dfer_arr(rbin) = dfer_arr(rbin) + dFe(nl)                     
-                    !Calculate emission angle and work out which mue bin to add to
-                    mue = demang(spin,mu0,re,alpha,beta)
-                    mubin = ceiling( mue * dble(me) )
-                    !calculate the extra factors for w2/3
-                    if (nlp .gt. 1) then
-                        emisfac = (emissivity(1)+eta_0*emissivity(2))/(1.+eta_0)
-                        kfac = (emissivity(1)+eta_0*emissivity(2))/(thetafac(1)+eta_0*thetafac(2)) 
-                    else
-                        emisfac = emissivity(1)
-                        kfac = emissivity(1)
-                        !single lamp post case, double check this later
-                    endif  
-                    !this is just to make the formatting below less ugly     
-                    normfac = real(g**3*domegan(i)/(1.d0+zcos)**3)                 
-                    !Add to the transfer function integral
-                    do fbin = 1,nf
-                        cexp = cmplx(cos(real(2.d0*pi*tau(nl)*fi(fbin))),sin(real(2.d0*pi*tau(nl)*fi(fbin))))
-                        ker_W0(nl,gbin,fbin,mubin,rbin) = ker_W0(nl,gbin,fbin,mubin,rbin) + real(dFe(nl))*cexp
-                        ker_W1(nl,gbin,fbin,mubin,rbin) = ker_W1(nl,gbin,fbin,mubin,rbin) + &
-                                                          real(log(gsd(nl)))*real(dFe(nl))*cexp  
-                        !tbd redo these transfer functions                             
-                        ker_W2(nl,gbin,fbin,mubin,rbin) = ker_W2(nl,gbin,fbin,mubin,rbin) + &
-                                                          emisfac*normfac*cexp
-                        ker_W3(nl,gbin,fbin,mubin,rbin) = ker_W3(nl,gbin,fbin,mubin,rbin) + &
-                                                          kfac*thetafac(nl)*normfac*cexp 
-                    end do          
-                    !if large verbose, start saving the impulse response function to file 
-                    if( verbose .gt. 1 ) then
-                        !find the appropriate energy and time bins
-                        gbin = ceiling(g/dg) 
-                        gbin = MAX( 1    , gbin  )
-                        gbin = MIN( gbin , ne    )
-                        tbin = ceiling( log10( tau(nl) / tar(0) ) / dlogt )
-                        !write(102,*)re,tau,log10( tau / tar(0) ) / dlogt
-                        tbin = MAX( 1    , tbin )
-                        tbin = MIN( tbin , nt   )
-                        ! kernel of the impulse response function              
-                        resp(gbin,tbin) = resp(gbin,tbin) + dFe(nl)  
-                    end if 
+                    pixtau(nl,p)   = tau(nl)
+                    pixdFe(nl,p)   = dFe(nl)
+                    pixw(0,nl,p)   = real(dFe(nl))
+                    pixw(1,nl,p)   = real(log(gsd(nl)))*real(dFe(nl))
+                    !tbd redo these transfer functions                             
+                    pixw(2,nl,p)   = emisfac*normfac
+                    pixw(3,nl,p)   = kfac*thetafac(nl)*normfac
                 end do
             end if
         end do
     end do
+    !$omp end parallel do
+
+    ! Sum up the reflection fraction, the radial dependence of the transfer function and
+    ! the impulse response in pixel order
+    do p = 1,npix
+        if( .not. pixhit(p) ) cycle
+        do m=1,nlp
+            !Add to reflection fraction
+            frobs(m) = frobs(m) + pixfro(m,p)
+        end do
+        do nl=1,nlp
+            !Add to the radial dependence of the transfer function TBD MAKE SURE THIS IS RIGHT
+            dfer_arr(pixr(p)) = dfer_arr(pixr(p)) + pixdFe(nl,p)
+            !if large verbose, start saving the impulse response function to file 
+            if( verbose .gt. 1 ) then
+                !find the appropriate energy and time bins
+                gbin = ceiling(pixgfac(p)/dg) 
+                gbin = MAX( 1    , gbin  )
+                gbin = MIN( gbin , ne    )
+                tbin = ceiling( log10( pixtau(nl,p) / tar(0) ) / dlogt )
+                tbin = MAX( 1    , tbin )
+                tbin = MIN( tbin , nt   )
+                ! kernel of the impulse response function              
+                resp(gbin,tbin) = resp(gbin,tbin) + pixdFe(nl,p)  
+            end if 
+        end do
+    end do
+
+    !Add to the transfer function integral
+    !(nf=0 only builds the pixel list, see kernel_chunk)
+    call kernel_scatter(nlp,ne,nf,me,xe,npix,pixhit,pixg,pixr,pixmu,pixtau,pixw,fi,ker_W0,ker_W1,ker_W2,ker_W3)
+    deallocate( pixgfac, pixdFe, pixfro )
     
     do m=1,nlp 
         ! Calculate 4pi p(theta0,phi0) = ang_fac
@@ -457,7 +500,7 @@ end subroutine rtrans
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-function newtex(rlp,dcosdr,ndelta,re,h,honr,kk)
+recursive function newtex(rlp,dcosdr,ndelta,re,h,honr,kk)
 ! Extrapolates using Newtonian value
   implicit none
   integer ndelta,kk
@@ -467,3 +510,119 @@ function newtex(rlp,dcosdr,ndelta,re,h,honr,kk)
   return
 end function newtex  
 !-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine kernel_scatter(nlp,ne,nf,me,xe,npix,pixhit,pixg,pixr,pixmu,pixtau,pixw,fi,ker_W0,ker_W1,ker_W2,ker_W3)
+! Adds the pixel list built in rtrans to the transfer function kernels ker_W0..3.
+! pixw(0:3,nl,p) are the weights of pixel p for the four kernels and pixtau(nl,p) its time lag.
+! The frequency bins are split in tiles of nftile bins that are shared out between the threads:
+! each thread only writes to its own tiles, and inside a tile the pixels are added in list order,
+! so the kernels are identical whatever the number of threads.
+! The phase factors exp(i 2 pi tau f) of a pixel are computed for a whole tile at once by
+! phasor_table (see there for the accuracy).
+  implicit none
+  integer nlp,ne,nf,me,xe,npix
+  logical pixhit(npix)
+  integer pixg(npix),pixr(npix),pixmu(npix)
+  double precision pixtau(nlp,npix),fi(nf)
+  real pixw(0:3,nlp,npix)
+  complex ker_W0(nlp,ne,nf,me,xe),ker_W1(nlp,ne,nf,me,xe),ker_W2(nlp,ne,nf,me,xe),ker_W3(nlp,ne,nf,me,xe)
+  integer, parameter :: nftile = 16
+  integer ftile,nft,k,fbin,p,nl,gbin,rbin,mubin
+  complex cexp(nftile)
+  !$omp parallel do schedule(dynamic) default(shared) private(ftile,nft,k,fbin,p,nl,gbin,rbin,mubin,cexp)
+  do ftile = 1,nf,nftile
+     nft = min( nftile , nf-ftile+1 )
+     do p = 1,npix
+        if( .not. pixhit(p) ) cycle
+        gbin  = pixg(p)
+        rbin  = pixr(p)
+        mubin = pixmu(p)
+        do nl = 1,nlp
+           call phasor_table(nft,pixtau(nl,p),fi(ftile),cexp)
+           do k = 1,nft
+              fbin = ftile + k - 1
+              ker_W0(nl,gbin,fbin,mubin,rbin) = ker_W0(nl,gbin,fbin,mubin,rbin) + pixw(0,nl,p)*cexp(k)
+              ker_W1(nl,gbin,fbin,mubin,rbin) = ker_W1(nl,gbin,fbin,mubin,rbin) + pixw(1,nl,p)*cexp(k)
+              ker_W2(nl,gbin,fbin,mubin,rbin) = ker_W2(nl,gbin,fbin,mubin,rbin) + pixw(2,nl,p)*cexp(k)
+              ker_W3(nl,gbin,fbin,mubin,rbin) = ker_W3(nl,gbin,fbin,mubin,rbin) + pixw(3,nl,p)*cexp(k)
+           end do
+        end do
+     end do
+  end do
+  !$omp end parallel do
+  return
+end subroutine kernel_scatter
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine kernel_chunk(nlp,ne,me,xe,nf,fhi,flo,j1,nfc,ker_W0,ker_W1,ker_W2,ker_W3)
+! Kernels of frequency bins j1..j1+nfc-1 of the nf bins between flo and fhi, from the
+! pixel list kept by the last rtrans call (kernel_pixels). Gives the same kernels as
+! the corresponding slice of a full rtrans call, without holding all the frequencies.
+  use kernel_pixels
+  implicit none
+  integer nlp,ne,me,xe,nf,j1,nfc
+  double precision fhi,flo
+  complex ker_W0(nlp,ne,nfc,me,xe),ker_W1(nlp,ne,nfc,me,xe),ker_W2(nlp,ne,nfc,me,xe),ker_W3(nlp,ne,nfc,me,xe)
+  double precision fi(nfc)
+  integer fbin
+  if( fhi .lt. tiny(fhi) )then
+     !DC: zero frequency, as in rtrans
+     fi = 0.0d0
+  else
+     do fbin = 1,nfc
+        fi(fbin) = flo * (fhi/flo)**((dble(j1+fbin-1)-0.5d0)/dble(nf))
+     end do
+  end if
+  ker_W0 = 0.
+  ker_W1 = 0.
+  ker_W2 = 0.
+  ker_W3 = 0.
+  call kernel_scatter(nlp,ne,nfc,me,xe,npix,pixhit,pixg,pixr,pixmu,pixtau,pixw,fi,ker_W0,ker_W1,ker_W2,ker_W3)
+  return
+end subroutine kernel_chunk
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine phasor_table(n,tau,f,cexp)
+! Returns cexp(k) = exp( i 2 pi tau f(k) ) for k=1,n.
+! The frequency grid is logarithmic, so the phase step between bins is not constant and a
+! complex recurrence in f would still need a cos/sin per bin. Instead the phase is reduced
+! to [-pi/4,pi/4] in double precision and cos/sin are evaluated in single precision with
+! their Taylor series (to x^10 and x^9). The loop has no calls or branches (the rounding
+! uses the 1.5*2^52 trick and the quadrant is restored arithmetically), so it vectorises
+! over the frequency bins.
+! Accuracy: |cexp - exp(i phase)| < 2e-7 for any phase. The previous code took cos/sin of
+! real(phase), whose error grows as ~6e-8*phase (~1e-4 for phases of a few 1000 rad), so
+! the new kernels are, if anything, more accurate; they are not bitwise identical to the old ones.
+  use constants
+  implicit none
+  integer n,k
+  double precision tau,f(n)
+  complex cexp(n)
+  double precision, parameter :: twoonpi = 2.d0 / pi, pio2 = 0.5d0 * pi
+  double precision, parameter :: rnd = 1.5d0 * 2.d0**52
+  double precision phase,q
+  real x,x2,s,c,sc,ss,w
+  integer iq
+  !$omp simd private(phase,q,iq,x,x2,s,c,sc,ss,w)
+  do k = 1,n
+     phase = 2.d0 * pi * tau * f(k)
+     !nearest multiple of pi/2 and reduced phase
+     q     = ( phase * twoonpi + rnd ) - rnd
+     iq    = int( q )
+     x     = real( phase - q * pio2 )
+     x2    = x * x
+     s = x * ( 1.0 - x2/6.0 * ( 1.0 - x2/20.0 * ( 1.0 - x2/42.0 * ( 1.0 - x2/72.0 ) ) ) )
+     c = 1.0 - x2/2.0 * ( 1.0 - x2/12.0 * ( 1.0 - x2/30.0 * ( 1.0 - x2/56.0 * ( 1.0 - x2/90.0 ) ) ) )
+     !rotate back to the original quadrant: odd quadrants swap cos and sin,
+     !quadrants 1,2 flip the sign of cos and quadrants 2,3 the sign of sin
+     w   = real( iand( iq , 1 ) )
+     sc  = 1.0 - 2.0 * iand( ishft(iq+1,-1) , 1 )
+     ss  = 1.0 - 2.0 * iand( ishft(iq,-1) , 1 )
+     cexp(k) = cmplx( sc * ( c + w*(s-c) ) , ss * ( s + w*(c-s) ) )
+  end do
+  return
+end subroutine phasor_table
+!-----------------------------------------------------------------------
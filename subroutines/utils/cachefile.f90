@@ -0,0 +1,80 @@
+!-----------------------------------------------------------------------
+      recursive subroutine cachefile_openr(fname,magic,version,unit,ok)
+! Opens the binary cache file fname (unformatted stream) for reading and
+! checks its first record: an 8 character magic string and a format
+! version. If ok, unit is left open just after them and the caller reads
+! and checks the rest of its header; otherwise no file is left open.
+      implicit none
+      character (len=*) fname
+      character (len=8) magic
+      integer version,unit
+      logical ok,exists
+      character (len=8) magicf
+      integer ios,versionf
+      ok = .false.
+      inquire(file=trim(fname),exist=exists)
+      if( .not. exists ) return
+      open(newunit=unit,file=trim(fname),access='stream',form='unformatted',&
+           status='old',action='read',iostat=ios)
+      if( ios .ne. 0 ) return
+      read(unit,iostat=ios) magicf,versionf
+      if( ios .ne. 0 .or. magicf .ne. magic .or. versionf .ne. version )then
+        close(unit)
+        return
+      end if
+      ok = .true.
+      return
+      end subroutine cachefile_openr
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine cachefile_openw(fname,magic,version,tmpname,unit,ok)
+! Starts a new cache file for fname. The data go to tmpname (fname plus
+! .tmp and the process id, so no two processes share it) until
+! cachefile_close moves it into place. magic and version are written
+! first, matching what cachefile_openr checks.
+      implicit none
+      character (len=*) fname,tmpname
+      character (len=8) magic
+      integer version,unit
+      logical ok
+      integer ios,getpid
+      ok = .false.
+      write(tmpname,'(A,A,I0)') trim(fname),'.tmp',getpid()
+      open(newunit=unit,file=trim(tmpname),access='stream',form='unformatted',&
+           status='replace',action='write',iostat=ios)
+      if( ios .ne. 0 )then
+        write(*,*)"Warning! Cannot write cache file ",trim(tmpname)
+        return
+      end if
+      write(unit,iostat=ios) magic,version
+      if( ios .ne. 0 )then
+        write(*,*)"Warning! Cannot write cache file ",trim(tmpname)
+        close(unit,status='delete')
+        return
+      end if
+      ok = .true.
+      return
+      end subroutine cachefile_openw
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+      recursive subroutine cachefile_close(unit,tmpname,fname,ios)
+! Finishes a file started by cachefile_openw. ios is the first non-zero
+! iostat of the writes (0 if they all succeeded). A complete file is
+! renamed to fname, which replaces any old one in a single step; an
+! incomplete one is deleted and fname is left as it was.
+      implicit none
+      integer unit,ios
+      character (len=*) tmpname,fname
+      integer iosc
+      close(unit,iostat=iosc)
+      if( ios .ne. 0 .or. iosc .ne. 0 )then
+        write(*,*)"Warning! Cannot write cache file ",trim(tmpname)
+        call unlink(trim(tmpname))
+        return
+      end if
+      call rename(trim(tmpname),trim(fname))
+      return
+      end subroutine cachefile_close
+!-----------------------------------------------------------------------
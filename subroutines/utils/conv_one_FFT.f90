@@ -1,4 +1,4 @@
-  subroutine conv_one_FFT(dyn,photarx,reline,imline,ReW_conv,ImW_conv,DC,nlp)
+  recursive subroutine conv_one_FFT(dyn,photarx,reline,imline,ReW_conv,ImW_conv,DC,nlp)
     use conv_mod
     implicit none
     integer, intent(in) :: DC, nlp 
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine crebin(nex,earx,ReGx,ImGx,ne,ear,ReG,ImG)
+recursive subroutine crebin(nex,earx,ReGx,ImGx,ne,ear,ReG,ImG)
 ! Re-bins ReGx and ImGx from the earx(0:nex) energy array onto the
 ! ear(0:ne) energy array. Output is ReG and ImG.
 ! Gx and G are in units of (dN/dE)*dE (i.e. photar)
@@ -18,8 +18,7 @@ subroutine crebin(nex,earx,ReGx,ImGx,ne,ear,ReG,ImG)
   end do
   
   !Re-bin
-  call rebinE(earx,E2ReGx,nex,ear,ReG,ne)
-  call rebinE(earx,E2ImGx,nex,ear,ImG,ne)
+  call rebinE2(earx,E2ReGx,E2ImGx,nex,ear,ReG,ImG,ne)
 
   !Convert back to (dN/dE)*dE
   do i = 1,ne
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-    function get_env_char(name, default)
+    recursive function get_env_char(name, default)
       implicit none
       character (len=*), intent(in) :: name, default
 
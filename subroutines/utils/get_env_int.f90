@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      function get_env_int(name,default)
+      recursive function get_env_int(name,default)
         implicit none
         integer get_env_int, stat, default
         character (len=5) str
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      function get_env_real(name, default)
+      recursive function get_env_real(name, default)
         implicit none
         integer           :: stat 
         real              :: get_env_real, default
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-function get_index(rlp,ndelta,re,rmin,npts)
+recursive function get_index(rlp,ndelta,re,rmin,npts)
   implicit none
   integer get_index,ndelta,npts,kk
   double precision rlp(ndelta),re,rmin
@@ -3,46 +3,178 @@ subroutine rebinE(earx,px,nex,ear,p,ne)
 !General rebinning scheme, should be nice and robust - BUT IT FUCKING ISN'T
 !i,nex,earx,px = input
 !j,ne,ear,p    = output
+!The rebinning is linear in px, so the weights are worked out once per
+!(earx,ear) pair (see getplan) and applied as a sparse product
+  use rebin_plans
   implicit none
-  integer i,nex,j,ne,ilo,ihi
-  real earx(0:nex),ear(0:ne),px(nex),p(ne),Ehigh,Elow,upper,lower
-  real FRAC,Ej,Ei,pi,Ei2,pi2,grad,cons,Ehi,Elo,phi,plo
-  logical interp
-  ilo = 1
+  integer nex,ne,ip,j,n
+  real earx(0:nex),ear(0:ne),px(nex),p(ne),s
+  call getplan(earx,nex,ear,ne,ip)
   do j = 1,ne
-     do while( earx(ilo) .le. ear(j-1) .and. ilo .lt. nex )
-        ilo = ilo + 1
+     s = 0.0
+     do n = plans(ip)%row(j), plans(ip)%row(j+1) - 1
+        s = s + plans(ip)%w(n) * px(plans(ip)%col(n))
      end do
-     ihi = ilo
-     do while( earx(ihi) .le. ear(j) .and. ihi .lt. nex )
-        ihi = ihi + 1
+     p(j) = s
+  end do
+  RETURN
+END subroutine rebinE
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine rebinE2(earx,px,qx,nex,ear,p,q,ne)
+!Same as rebinE for two arrays on the same grids (e.g. the real and
+!imaginary parts), in one pass through the weights
+  use rebin_plans
+  implicit none
+  integer nex,ne,ip,j,n
+  real earx(0:nex),ear(0:ne),px(nex),qx(nex),p(ne),q(ne),s,t
+  call getplan(earx,nex,ear,ne,ip)
+  do j = 1,ne
+     s = 0.0
+     t = 0.0
+     do n = plans(ip)%row(j), plans(ip)%row(j+1) - 1
+        s = s + plans(ip)%w(n) * px(plans(ip)%col(n))
+        t = t + plans(ip)%w(n) * qx(plans(ip)%col(n))
      end do
-     if( ihi .gt. ilo )then
-        p(j) = 0.0
-        do i = ilo,ihi
-           lower = MAX( earx(i-1) , ear(j-1)  )
-           upper = MIN( earx(i)   , ear(j)    )
-           p(j) = p(j) + px(i) * ( upper - lower )
+     p(j) = s
+     q(j) = t
+  end do
+  RETURN
+END subroutine rebinE2
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine getplan(earx,nex,ear,ne,ip)
+!Returns in ip the plan for rebinning from earx(0:nex) onto ear(0:ne),
+!building it in the least recently used slot if these grids have not
+!been seen recently. Slots are first matched on the sizes and the grid
+!fingerprints, which cost a few loads each; the grids are only compared
+!element by element for a slot that passes. The plans are threadprivate
+!(and part of the model context inside genreltrans), so each thread
+!builds and uses its own.
+  use rebin_plans
+  implicit none
+  integer nex,ne,ip,k
+  real earx(0:nex),ear(0:ne)
+  double precision fpx(3),fpe(3)
+  if( .not. allocated(plans) )then
+     allocate( plans(nplanmax), planused(nplanmax) )
+     planused = 0
+  end if
+  planclock = planclock + 1
+  call gridfp(earx,nex,fpx)
+  call gridfp(ear,ne,fpe)
+  do k = 1,nplanmax
+     if( planused(k) .eq. 0 ) cycle
+     if( plans(k)%nex .ne. nex .or. plans(k)%ne .ne. ne ) cycle
+     if( any( plans(k)%fpx .ne. fpx ) .or. any( plans(k)%fpe .ne. fpe ) ) cycle
+     if( any( plans(k)%earx .ne. earx ) ) cycle
+     if( any( plans(k)%ear  .ne. ear  ) ) cycle
+     ip = k
+     planused(ip) = planclock
+     return
+  end do
+  ip = minloc( planused, 1 )
+  call buildplan(earx,nex,ear,ne,ip)
+  planused(ip) = planclock
+  return
+end subroutine getplan
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine buildplan(earx,nex,ear,ne,ip)
+!Works out the weights of the old rebinE loop: bins of ear that contain at
+!least one edge of earx get the overlap-weighted average of the earx bins,
+!narrower ones are linearly interpolated (or extrapolated) between the two
+!nearest earx bin centres. First pass counts the weights, second fills them.
+  use rebin_plans
+  implicit none
+  integer nex,ne,ip
+  real earx(0:nex),ear(0:ne)
+  integer i,j,ilo,ihi,nnz,pass
+  real upper,lower,Ej,Ei,Ehi,Elo,frac
+  do pass = 1,2
+     nnz = 0
+     ilo = 1
+     do j = 1,ne
+        if( pass .eq. 2 ) plans(ip)%row(j) = nnz + 1
+        do while( earx(ilo) .le. ear(j-1) .and. ilo .lt. nex )
+           ilo = ilo + 1
+        end do
+        ihi = ilo
+        do while( earx(ihi) .le. ear(j) .and. ihi .lt. nex )
+           ihi = ihi + 1
         end do
-        p(j) = p(j) / ( ear(j) - ear(j-1) )
-     else
-        !Interpolate (or extrapolate)
-        i = ilo
-        Ei = 0.5 * ( earx(i) + earx(i-1) )
-        if( Ei .gt. Ej ) i = ilo - 1
-        i = max( i , 2     )
-        i = min( i , nex-1 )
-        Ej  = 0.5 * ( ear(j) + ear(j-1) )
-        Ehi = 0.5 * ( earx(i+1) + earx(i)   )
-        Elo = 0.5 * ( earx(i)   + earx(i-1) )
-        phi = px(i+1)
-        plo = px(i)
-        p(j) = plo + (phi-plo)*(Ej-Elo)/(Ehi-Elo)
+        if( ihi .gt. ilo )then
+           do i = ilo,ihi
+              nnz = nnz + 1
+              if( pass .eq. 1 ) cycle
+              lower = MAX( earx(i-1) , ear(j-1)  )
+              upper = MIN( earx(i)   , ear(j)    )
+              plans(ip)%col(nnz) = i
+              plans(ip)%w(nnz)   = ( upper - lower ) / ( ear(j) - ear(j-1) )
+           end do
+        else
+           !Interpolate (or extrapolate)
+           nnz = nnz + 2
+           if( pass .eq. 2 )then
+              Ej  = 0.5 * ( ear(j) + ear(j-1) )
+              i = ilo
+              Ei = 0.5 * ( earx(i) + earx(i-1) )
+              if( Ei .gt. Ej ) i = ilo - 1
+              i = max( i , 2     )
+              i = min( i , nex-1 )
+              Ehi = 0.5 * ( earx(i+1) + earx(i)   )
+              Elo = 0.5 * ( earx(i)   + earx(i-1) )
+              frac = (Ej-Elo)/(Ehi-Elo)
+              plans(ip)%col(nnz-1) = i
+              plans(ip)%w(nnz-1)   = 1.0 - frac
+              plans(ip)%col(nnz)   = i + 1
+              plans(ip)%w(nnz)     = frac
+           end if
+        end if
+        if( ilo .gt. 1 ) ilo = ilo - 1
+     end do
+     if( pass .eq. 1 )then
+        if( allocated(plans(ip)%earx) ) deallocate(plans(ip)%earx)
+        if( allocated(plans(ip)%ear ) ) deallocate(plans(ip)%ear )
+        if( allocated(plans(ip)%row ) ) deallocate(plans(ip)%row )
+        if( allocated(plans(ip)%col ) ) deallocate(plans(ip)%col )
+        if( allocated(plans(ip)%w   ) ) deallocate(plans(ip)%w   )
+        allocate( plans(ip)%earx(0:nex), plans(ip)%ear(0:ne), plans(ip)%row(ne+1) )
+        allocate( plans(ip)%col(nnz), plans(ip)%w(nnz) )
      end if
-     if( ilo .gt. 1 ) ilo = ilo - 1
   end do
-  RETURN   
-END subroutine rebinE
+  plans(ip)%row(ne+1) = nnz + 1
+  plans(ip)%nex  = nex
+  plans(ip)%ne   = ne
+  plans(ip)%earx = earx
+  plans(ip)%ear  = ear
+  call gridfp(earx,nex,plans(ip)%fpx)
+  call gridfp(ear,ne,plans(ip)%fpe)
+  return
+end subroutine buildplan
 !-----------------------------------------------------------------------
 
-
+!-----------------------------------------------------------------------
+recursive subroutine gridfp(e,n,fp)
+!Fingerprint of the grid e(0:n): its two end points and a checksum of
+!at most 16 inner edges spread evenly over it (weighted by position, so that
+!swapped edges differ). Equal grids always have equal fingerprints.
+  implicit none
+  integer n,i,k,nstep
+  real e(0:n)
+  double precision fp(3)
+  fp(1) = e(0)
+  fp(2) = e(n)
+  fp(3) = 0.d0
+  nstep = max( 1 , (n+15) / 16 )
+  k = 0
+  do i = nstep,n-1,nstep
+     k = k + 1
+     fp(3) = fp(3) + dble(k) * dble(e(i))
+  end do
+  return
+end subroutine gridfp
+!-----------------------------------------------------------------------
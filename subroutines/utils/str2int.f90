@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine str2int(str,int,stat)
+recursive subroutine str2int(str,int,stat)
   implicit none
   character (len=*) str
   integer int,stat
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine str2real(str, real_num, stat)
+recursive subroutine str2real(str, real_num, stat)
   implicit none
   character (len=*) str
   integer stat
@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-      function strenv(name)
+      recursive function strenv(name)
 ! STATUS is -1 if VALUE is present but too short for the environment variable;
 ! it is 1 if the environment variable does not exist and 2 if the processor does
 ! not support environment variables; in all other cases STATUS is zero.        
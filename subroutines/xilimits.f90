@@ -1,5 +1,5 @@
 !-----------------------------------------------------------------------
-subroutine xilimits(nex,earx,nlp,contx,DeltaGamma,gso,lens,z,dlogxi1,dlogxi2)
+recursive subroutine xilimits(nex,earx,nlp,contx,DeltaGamma,gso,lens,z,dlogxi1,dlogxi2)
 ! Inputs: nex,earx,contx,DeltaGamma,gso
 ! Outputs: dlogxi1,dlogxi2
 ! logxi1 = logxi0 + dlogxi1
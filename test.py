@@ -29,6 +29,33 @@ def plot(ax, data_archive, test_model, sub_type = 'Spectrum', identifier = ''):
             file.write(line)
             file.write('\n')
 
+def thread_check(ear, param, nthreads = (1, 8)):
+    '''
+    The GR ray tracing runs on OpenMP threads (GRtrace): the model must not
+    depend on their number. OMP_NUM_THREADS is read when the library is
+    loaded, so reltransDCp is run in a new process for each value, with the
+    GR cache and library off so that the camera is traced every time, and
+    the outputs are compared byte by byte.
+    '''
+    import subprocess, sys, tempfile
+    child = ('import sys, numpy as np, f2py_interface as ib\n'
+             'ear, param = np.load(sys.argv[1]), np.load(sys.argv[2])\n'
+             'np.save(sys.argv[3], ib.reltransDCp(ear, param))\n')
+    with tempfile.TemporaryDirectory() as tmp:
+        np.save(tmp + '/ear.npy', ear)
+        np.save(tmp + '/param.npy', param)
+        out = []
+        for n in nthreads:
+            env = dict(os.environ, OMP_NUM_THREADS = str(n), RELTRANS_GRCACHE = '', RELTRANS_GRLIB = '')
+            name = tmp + '/photar' + str(n) + '.npy'
+            subprocess.run([sys.executable, '-c', child, tmp + '/ear.npy', tmp + '/param.npy', name],
+                           env = env, check = True)
+            out.append(np.load(name))
+    for n, photar in zip(nthreads[1:], out[1:]):
+        same = photar.tobytes() == out[0].tobytes()
+        print(f'OMP_NUM_THREADS={nthreads[0]} vs {n}: ' + ('byte-identical' if same else
+              f'DIFFERENT, max |diff| = {np.max(np.abs(photar - out[0]))}'))
+
 #-----------------------------#
 #set env variables for tests
 os.environ["REV_VERB" ] = "2"
@@ -81,6 +108,9 @@ param[19] = 0.0     #gamma
 param[20] = 1       #telescope response
 
 
+print('Checking that the model does not depend on the number of threads...')
+thread_check(ear, param)
+
 source     = ['xrb','dbl','agn']
 frange     = [['0,12_0,25', '0,31_0,73', '0,80_2,10', '2,10_5,80', '5,80_16,0'], \
               ['0,10_0,40', '0,50_0,60', '1,10_1,40', '3,00_4,20', '3,00_4,20'], \
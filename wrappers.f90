@@ -13,11 +13,15 @@ include 'subroutines/amodules.f90'
 include 'subroutines/header.h'
           
 !-----------------------------------------------------------------------
-subroutine tdreltransDCp(ear, ne, param, ifl, photar)
+recursive subroutine tdreltransDCp(ear, ne, param, ifl, photar)
   implicit none
   integer, parameter :: nlp = 1 !use a single lamp post
   integer :: ne, ifl, Cp, dset
   real    :: ear(0:ne), param(21), photar(ne), par(32)
+  logical :: emulated
+! Use the emulator instead if there is one for these parameters (RELTRANS_EMU)
+  call emulate(1, ear, ne, param, 21, photar, emulated)
+  if( emulated ) return
 ! Settings
   Cp   = 2   !|Cp|=2 means nthcomp, Cp>1 means there is a density parameter     
   dset = 0   !dset=0 means distance is not set, logxi set instead
@@ -61,11 +65,15 @@ end subroutine tdreltransDCp
 !-----------------------------------------------------------------------
 
 !-----------------------------------------------------------------------
-subroutine tdreltransPL(ear, ne, param, ifl, photar)
+recursive subroutine tdreltransPL(ear, ne, param, ifl, photar)
   implicit none
   integer, parameter :: nlp = 1 !use a single lamp post
   integer :: ne, ifl, Cp, dset
   real    :: ear(0:ne), param(21), photar(ne), par(32)
+  logical :: emulated
+! Use the emulator instead if there is one for these parameters (RELTRANS_EMU)
+  call emulate(2, ear, ne, param, 21, photar, emulated)
+  if( emulated ) return
 ! Settings
   Cp   = 1   !|Cp|=2 means nthcomp, Cp>1 means there is a density parameter     
   dset = 0   !dset=0 means distance is not set, logxi set instead
@@ -110,11 +118,15 @@ end subroutine tdreltransPL
 
 
 !-----------------------------------------------------------------------
-subroutine tdreltransx(ear,ne,param,ifl,photar)
+recursive subroutine tdreltransx(ear,ne,param,ifl,photar)
   implicit none
   integer, parameter :: nlp = 1 !use a single lamp post
   integer :: ne, ifl, Cp, dset
   real    :: ear(0:ne), param(21), photar(ne), par(32)
+  logical :: emulated
+! Use the emulator instead if there is one for these parameters (RELTRANS_EMU)
+  call emulate(3, ear, ne, param, 21, photar, emulated)
+  if( emulated ) return
 ! Settings
   Cp   = 0   !Cp=0 means use the reflionx model with nthcomp and free density
   dset = 0   !dset=0 means distance is not set, logxi set instead
@@ -159,11 +171,15 @@ end subroutine tdreltransx
 
 
 !-----------------------------------------------------------------------
-subroutine tdreltransDbl(ear, ne, param, ifl, photar)
+recursive subroutine tdreltransDbl(ear, ne, param, ifl, photar)
   implicit none
   integer, parameter :: nlp = 2 !use a double lamp post 
   integer :: ne, ifl, Cp, dset
   real    :: ear(0:ne), param(27), photar(ne), par(32)
+  logical :: emulated
+! Use the emulator instead if there is one for these parameters (RELTRANS_EMU)
+  call emulate(4, ear, ne, param, 27, photar, emulated)
+  if( emulated ) return
 !Settings
   Cp   = 2   !|Cp|=2 means nthcomp, Cp>1 means there is a density parameter     
   dset = 0   !dset=0 means distance is not set, logxi set instead
@@ -208,12 +224,16 @@ end subroutine tdreltransDbl
 
 
 !-----------------------------------------------------------------------
-subroutine tdrtdist(ear, ne, param, ifl, photar)
+recursive subroutine tdrtdist(ear, ne, param, ifl, photar)
   implicit none
   integer, parameter :: nlp = 1 !use a single lamp post
   integer :: ne, ifl, Cp, dset
   real    :: ear(0:ne), param(25), photar(ne), par(32), getcountrate
   double precision    :: honr,pi,cosi,cos0
+  logical :: emulated
+! Use the emulator instead if there is one for these parameters (RELTRANS_EMU)
+  call emulate(5, ear, ne, param, 25, photar, emulated)
+  if( emulated ) return
 ! Settings
   Cp   = 2   !|Cp|=2 means nthcomp, Cp>1 means there is a density parameter     
   dset = 1   !dset=1 means distance is set, logxi is calculated internally
@@ -273,12 +293,16 @@ end subroutine tdrtdist
 
 
 !-----------------------------------------------------------------------
-subroutine tdrtdistX(ear, ne, param, ifl, photar)
+recursive subroutine tdrtdistX(ear, ne, param, ifl, photar)
   implicit none
   integer, parameter :: nlp = 1 !use a single lamp post
   integer :: ne, ifl, Cp, dset
   real    :: ear(0:ne), param(25), photar(ne), par(32), getcountrate
   double precision    :: honr,pi,cosi,cos0
+  logical :: emulated
+! Use the emulator instead if there is one for these parameters (RELTRANS_EMU)
+  call emulate(6, ear, ne, param, 25, photar, emulated)
+  if( emulated ) return
 ! Settings
   Cp   = 0   !Cp=0 means use the reflionx model with nthcomp and free density 
   dset = 1   !dset=1 means distance is set, logxi is calculated internally
@@ -335,6 +359,177 @@ subroutine tdrtdistX(ear, ne, param, ifl, photar)
 end subroutine tdrtdistX
 !-----------------------------------------------------------------------
 
+!-----------------------------------------------------------------------
+recursive subroutine tdsetctx(ic)
+! Makes the following model calls of this thread use context ic (see
+! model_contexts), so that a caller alternating between parameter sets,
+! e.g. MCMC walkers, can give each its own kernels and transfer functions;
+! ic=0 goes back to choosing the context automatically. ic must be at most
+! RELTRANS_NCTX, otherwise the choice stays automatic. Threads pinned to
+! different contexts run their model calls at the same time; a thread
+! asking for a context in use waits for it
+  use model_contexts
+  implicit none
+  integer :: ic
+  call ctx_init()
+  if( ic .gt. nctx )then
+     write(*,*)"Warning! There is no context",ic," (RELTRANS_NCTX=",nctx,"): choosing it automatically"
+     ctxpin = 0
+  else
+     ctxpin = max( ic , 0 )
+  end if
+  return
+end subroutine tdsetctx
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine tdbatch(imod, ear, ne, param, npar, nk, ifl, photar)
+! Evaluates the model imod for nk parameter vectors param(:,k) on the same
+! energy grid; photar(:,k) is the model for vector k. imod is
+! 1 tdreltransDCp, 2 tdreltransPL, 3 tdreltransx, 4 tdreltransDbl,
+! 5 tdrtdist, 6 tdrtdistX, and npar must be its number of parameters.
+! The vectors are evaluated in lexicographic order of their parameters.
+! The geometry comes first in every parameter list, so the vectors that
+! share it are evaluated one after the other: the ray tracing and kernels
+! (and the convolutions, if the rest frame parameters also agree) are
+! done once per group instead of once per vector. The vectors are
+! evaluated one at a time, as the model is not thread safe (see
+! model_contexts). A wrong npar gives photar=0, as an unknown imod does
+  implicit none
+  integer :: imod, ne, npar, nk, ifl
+  real    :: ear(0:ne), param(npar,nk), photar(ne,nk)
+  integer :: order(nk), i, j, k, tdnpar
+  if( npar .ne. tdnpar(imod) )then
+     write(*,*)"Wrong number of parameters npar=",npar," for model imod=",imod
+     photar = 0.0
+     return
+  end if
+  do k = 1,nk
+     order(k) = k
+  end do
+  !insertion sort, stable so that equal vectors keep their order
+  do i = 2,nk
+     k = order(i)
+     j = i - 1
+     do while( j .ge. 1 )
+        if( .not. lexless( param(:,k) , param(:,order(j)) ) ) exit
+        order(j+1) = order(j)
+        j = j - 1
+     end do
+     order(j+1) = k
+  end do
+  do i = 1,nk
+     k = order(i)
+     call tdmodel(imod, ear, ne, param(1,k), ifl, photar(1,k))
+  end do
+  return
+contains
+  logical function lexless(p, q)
+    real :: p(npar), q(npar)
+    integer :: l
+    lexless = .false.
+    do l = 1,npar
+       if( p(l) .ne. q(l) )then
+          lexless = p(l) .lt. q(l)
+          return
+       end if
+    end do
+  end function lexless
+end subroutine tdbatch
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine tdfdjac(imod, ear, ne, param, npar, nj, ij, ifl, photar, jac)
+! Model imod (numbered as in tdbatch) and its derivatives jac(:,l) with
+! respect to the parameters param(ij(l)), l=1..nj, by finite differences:
+! a convenience wrapper around tdmodel. Closed-form derivatives computed in
+! the same pass as the model (from W, contx and absorbx through rawS,
+! rawG, lag_freq and the ReIm output) are not implemented.
+! Differences are central, or forward for a parameter at zero (e.g. Nh=0).
+! The step is about the cube root of the single precision epsilon, which
+! balances truncation and rounding, and the exact step after rounding is
+! divided by in double precision: expect 4-5 significant digits.
+! genreltrans keeps the transfer functions and their convolutions as long
+! as the parameters they depend on do not change (see need_check), so the
+! derivatives with respect to Nh, boost, DelA, DelAB, g, and eta for a
+! single lamp post only rerun the last steps of the model. Any other
+! parameter costs two full model calls, including Anorm of the distance
+! flavours, which sets the ionisation profile. A wrong npar, or an ij(l)
+! outside 1..npar, gives photar=0 and jac=0
+  implicit none
+  integer :: imod, ne, npar, nj, ij(nj), ifl
+  real    :: ear(0:ne), param(npar), photar(ne), jac(ne,nj)
+  real    :: par(npar), hi(ne), lo(ne), p, dp, phi, plo
+  real, parameter :: rstep = 5e-3
+  integer :: l, tdnpar
+  if( npar .ne. tdnpar(imod) .or. any( ij .lt. 1 .or. ij .gt. npar ) )then
+     write(*,*)"Wrong npar=",npar," or parameter index for model imod=",imod
+     photar = 0.0
+     jac    = 0.0
+     return
+  end if
+  par = param
+  call tdmodel(imod, ear, ne, par, ifl, photar)
+  do l = 1,nj
+     p  = param(ij(l))
+     dp = rstep * max( abs(p) , 1e-2 )
+     par = param
+     phi = p + dp
+     par(ij(l)) = phi
+     call tdmodel(imod, ear, ne, par, ifl, hi)
+     if( p .ge. 0.0 .and. p - dp .lt. 0.0 )then
+        jac(:,l) = real( ( dble(hi) - dble(photar) ) / ( dble(phi) - dble(p) ) )
+     else
+        plo = p - dp
+        par(ij(l)) = plo
+        call tdmodel(imod, ear, ne, par, ifl, lo)
+        jac(:,l) = real( ( dble(hi) - dble(lo) ) / ( dble(phi) - dble(plo) ) )
+     end if
+  end do
+  return
+end subroutine tdfdjac
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive subroutine tdmodel(imod, ear, ne, param, ifl, photar)
+! Calls the wrapper number imod (see tdbatch)
+  implicit none
+  integer :: imod, ne, ifl
+  real    :: ear(0:ne), param(*), photar(ne)
+  select case( imod )
+  case( 1 )
+     call tdreltransDCp(ear, ne, param, ifl, photar)
+  case( 2 )
+     call tdreltransPL(ear, ne, param, ifl, photar)
+  case( 3 )
+     call tdreltransx(ear, ne, param, ifl, photar)
+  case( 4 )
+     call tdreltransDbl(ear, ne, param, ifl, photar)
+  case( 5 )
+     call tdrtdist(ear, ne, param, ifl, photar)
+  case( 6 )
+     call tdrtdistX(ear, ne, param, ifl, photar)
+  case default
+     write(*,*)"Unknown model imod=",imod
+     photar = 0.0
+  end select
+  return
+end subroutine tdmodel
+!-----------------------------------------------------------------------
+
+!-----------------------------------------------------------------------
+recursive integer function tdnpar(imod)
+! Number of parameters of the wrapper number imod (see tdbatch), 0 if
+! there is no such wrapper
+  implicit none
+  integer :: imod
+  integer, parameter :: npars(6) = (/ 21, 21, 21, 27, 25, 25 /)
+  tdnpar = 0
+  if( imod .ge. 1 .and. imod .le. 6 ) tdnpar = npars(imod)
+  return
+end function tdnpar
+!-----------------------------------------------------------------------
+
 !-----------------------------------------------------------------------
 subroutine simrtdbl(ear, ne, param, ifl, photar)
   use telematrix
@@ -342,7 +537,8 @@ subroutine simrtdbl(ear, ne, param, ifl, photar)
   implicit none
   integer :: ne, ifl, Cp, dset, i
   real    :: ear(0:ne), param(28), photar(ne), par(32)
-  real    :: gammac2, Texp, E, dE, getcountrate
+  real    :: gammac2, Texp, E, dE, cumrate
+  double precision, allocatable :: cumdc(:), cumre(:), cumim(:)
   real    :: rephotar(ne), imphotar(ne)
   real, parameter :: Emin = 1e-1, Emax = 300.0
   integer, parameter :: nex=2**12
@@ -352,7 +548,7 @@ subroutine simrtdbl(ear, ne, param, ifl, photar)
   real :: dlag(ne),G2,ReG,ImG,Psnoise,Prnoise,br,bs(ne)
   real :: flo,fhi,fc,lag(ne),gasdev,lagsim(ne)
   real, parameter :: pi = acos(-1.0)
-  integer  unit,xunit,status,j
+  integer  unit,xunit,status,j,mrsp
   real E1,E2,frac
   character (len=200) command,flxlagfile,phalagfile,rsplagfile,lagfile,root
 ! Settings
@@ -398,61 +594,59 @@ subroutine simrtdbl(ear, ne, param, ifl, photar)
   fhi = par(24)
   fc  = 0.5 * ( fhi + flo )
   
-! Get `folded' lags
-  par(25) = 6.0   !ReIm
-  call genreltrans(Cp, dset, nlp, ear, ne, par, ifl, photar)  
-  do i = 1,ne
-     lag(i) = photar(i) / ( ear(i) - ear(i-1) )
-  end do
-  
 ! Set internal energy grid
   do i = 0, nex
      earx(i) = Emin * (Emax/Emin)**(float(i)/float(nex))
   end do
-  
-! Calculate real and imaginary parts on the fine energy grid
-  par(25) = 1.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, rephotarx)  
-  par(25) = 2.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, imphotarx)  
-! Get DC component
-  par(23) = 0.0   !floHz
-  par(24) = 0.0   !fhiHz
-  par(25) = 1.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, photarx)  
+
+! Get `folded' lags, plus the real and imaginary parts and the DC component on the fine energy grid
+  call simspectra(Cp, dset, nlp, ear, ne, par, ifl, photar, nex, earx, rephotarx, imphotarx, photarx)
+  do i = 1,ne
+     lag(i) = photar(i) / ( ear(i) - ear(i-1) )
+  end do
+
+! Simulations use the channels of RESP id 1
+  call loadresp(1)
+  mrsp = respslot(1)
 
 ! Read in background array
   if( needbkg )then
-     allocate(bkgcounts(1:numchn))
-     allocate(bkgrate(1:numchn))
+     allocate(bkgcounts(1:rsp(mrsp)%numchn))
+     allocate(bkgrate(1:rsp(mrsp)%numchn))
      call readinbkg
      needbkg = .false.
   end if
 
 ! Calculate background in reference band
   br = 0.0
-  do i = ilo,ihi
+  do i = Ilo(1),Ihi(1)
      br = br + bkgrate(i)
   end do
 
 ! Calculate background in subject
   do j = 1,ne
      bs(j) = 0.0
-     do i = 1,numchn
-        if( ECHN(i) .gt. ear(j-1) .and. ECHN(i-1) .le. ear(j) )then
-           E1 = max( ear(j-1) , ECHN(i-1) )
-           E2 = min( ear(j)   , ECHN(i)   )
-           frac = ( E2-E1 ) / ( ECHN(i)-ECHN(i-1) )
+     do i = 1,rsp(mrsp)%numchn
+        if( rsp(mrsp)%ECHN(i) .gt. ear(j-1) .and. rsp(mrsp)%ECHN(i-1) .le. ear(j) )then
+           E1 = max( ear(j-1) , rsp(mrsp)%ECHN(i-1) )
+           E2 = min( ear(j)   , rsp(mrsp)%ECHN(i)   )
+           frac = ( E2-E1 ) / ( rsp(mrsp)%ECHN(i)-rsp(mrsp)%ECHN(i-1) )
            bs(j) = bs(j) + frac * bkgrate(i)
         end if
      end do
      E = 0.5 * ( ear(j) + ear(j-1) )
   end do
   
+! Fold each spectrum once: the count rate in any energy range is then a difference of running sums
+  allocate( cumdc(0:rsp(mrsp)%numchn), cumre(0:rsp(mrsp)%numchn), cumim(0:rsp(mrsp)%numchn) )
+  call foldcumrate(nex,earx,photarx,cumdc)
+  call foldcumrate(nex,earx,rephotarx,cumre)
+  call foldcumrate(nex,earx,imphotarx,cumim)
+
 ! Calculate reference band power (in units of *absolute rms^2*)
-  Pr = pow * getcountrate(Elo,Ehi,nex,earx,rephotarx)
+  Pr = pow * cumrate(Elo(1),Ehi(1),cumre)
 ! Calculate reference band Poisson noise (in *absolutem rms^2)
-  mur = getcountrate(Elo,Ehi,nex,earx,photarx)
+  mur = cumrate(Elo(1),Ehi(1),cumdc)
   Prnoise = 2.0 * ( br + mur )
   write(*,*)"br,mur=",br,mur
   write(*,*)"Pr (fractional rms)^2/Hz",Pr/mur**2
@@ -477,10 +671,10 @@ subroutine simrtdbl(ear, ne, param, ifl, photar)
   do i = 1,ne
      E  = 0.5 * ( ear(i) + ear(i-1) )
      dE = ear(i) - ear(i-1)
-     mus = getcountrate(ear(i-1),ear(i),nex,earx,photarx)
+     mus = cumrate(ear(i-1),ear(i),cumdc)
      Psnoise = 2.0 * ( mus + bs(i) )
-     ReG = getcountrate(ear(i-1),ear(i),nex,earx,rephotarx)
-     ImG = getcountrate(ear(i-1),ear(i),nex,earx,imphotarx)
+     ReG = cumrate(ear(i-1),ear(i),cumre)
+     ImG = cumrate(ear(i-1),ear(i),cumim)
      G2  = pow**2 * ( ReG**2 + ImG**2 )
      ! Can finally calculate error     
      dlag(i) = 1.0 + Prnoise/Pr
@@ -507,6 +701,7 @@ subroutine simrtdbl(ear, ne, param, ifl, photar)
   write(*,*)"command: ",trim(command)
   write(*,*)"-----------------------------------------------"
  
+  deallocate( cumdc, cumre, cumim )
   return
 end subroutine simrtdbl
 !-----------------------------------------------------------------------
@@ -518,7 +713,8 @@ subroutine simrtdist(ear, ne, param, ifl, photar)
   implicit none
   integer :: ne, ifl, Cp, dset, i
   real    :: ear(0:ne), param(27), photar(ne), par(32)
-  real    :: gammac2, Texp, E, dE, getcountrate
+  real    :: gammac2, Texp, E, dE, cumrate
+  double precision, allocatable :: cumdc(:), cumre(:), cumim(:)
   real    :: rephotar(ne), imphotar(ne)
   real, parameter :: Emin = 1e-1, Emax = 300.0
   integer, parameter :: nex=2**12
@@ -528,9 +724,9 @@ subroutine simrtdist(ear, ne, param, ifl, photar)
   real :: dlag(ne),G2,ReG,ImG,Psnoise,Prnoise,br,bs(ne)
   real :: flo,fhi,fc,lag(ne),gasdev,lagsim(ne)
   real, parameter :: pi = acos(-1.0)
-  integer unit,xunit,status,j
+  integer unit,xunit,status,j,mrsp,k
   real E1,E2,frac
-  character (len=200) command,flxlagfile,phalagfile,rsplagfile,lagfile,root
+  character (len=200) command,flxlagfile,phalagfile,rsplagfile,lagfile,root,binfile
 ! Settings
   Cp   = 2   !|Cp|=2 means nthcomp, Cp>1 means there is a density parameter     
   dset = 1   !dset=1 means distance is set, logxi is calculated internally
@@ -574,61 +770,59 @@ subroutine simrtdist(ear, ne, param, ifl, photar)
   fhi = par(24)
   fc  = 0.5 * ( fhi + flo )
   
-! Get `folded' lags
-  par(25) = 6.0   !ReIm
-  call genreltrans(Cp, dset, nlp, ear, ne, par, ifl, photar)  
-  do i = 1,ne
-     lag(i) = photar(i) / ( ear(i) - ear(i-1) )
-  end do
-  
 ! Set internal energy grid
   do i = 0, nex
      earx(i) = Emin * (Emax/Emin)**(float(i)/float(nex))
   end do
-  
-! Calculate real and imaginary parts on the fine energy grid
-  par(25) = 1.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, rephotarx)  
-  par(25) = 2.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, imphotarx)  
-! Get DC component
-  par(23) = 0.0   !floHz
-  par(24) = 0.0   !fhiHz
-  par(25) = 1.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, photarx)  
+
+! Get `folded' lags, plus the real and imaginary parts and the DC component on the fine energy grid
+  call simspectra(Cp, dset, nlp, ear, ne, par, ifl, photar, nex, earx, rephotarx, imphotarx, photarx)
+  do i = 1,ne
+     lag(i) = photar(i) / ( ear(i) - ear(i-1) )
+  end do
+
+! Simulations use the channels of RESP id 1
+  call loadresp(1)
+  mrsp = respslot(1)
 
 ! Read in background array
   if( needbkg )then
-     allocate(bkgcounts(1:numchn))
-     allocate(bkgrate(1:numchn))
+     allocate(bkgcounts(1:rsp(mrsp)%numchn))
+     allocate(bkgrate(1:rsp(mrsp)%numchn))
      call readinbkg
      needbkg = .false.
   end if
 
 ! Calculate background in reference band
   br = 0.0
-  do i = ilo,ihi
+  do i = Ilo(1),Ihi(1)
      br = br + bkgrate(i)
   end do
 
 ! Calculate background in subject
   do j = 1,ne
      bs(j) = 0.0
-     do i = 1,numchn
-        if( ECHN(i) .gt. ear(j-1) .and. ECHN(i-1) .le. ear(j) )then
-           E1 = max( ear(j-1) , ECHN(i-1) )
-           E2 = min( ear(j)   , ECHN(i)   )
-           frac = ( E2-E1 ) / ( ECHN(i)-ECHN(i-1) )
+     do i = 1,rsp(mrsp)%numchn
+        if( rsp(mrsp)%ECHN(i) .gt. ear(j-1) .and. rsp(mrsp)%ECHN(i-1) .le. ear(j) )then
+           E1 = max( ear(j-1) , rsp(mrsp)%ECHN(i-1) )
+           E2 = min( ear(j)   , rsp(mrsp)%ECHN(i)   )
+           frac = ( E2-E1 ) / ( rsp(mrsp)%ECHN(i)-rsp(mrsp)%ECHN(i-1) )
            bs(j) = bs(j) + frac * bkgrate(i)
         end if
      end do
      E = 0.5 * ( ear(j) + ear(j-1) )
   end do
   
+! Fold each spectrum once: the count rate in any energy range is then a difference of running sums
+  allocate( cumdc(0:rsp(mrsp)%numchn), cumre(0:rsp(mrsp)%numchn), cumim(0:rsp(mrsp)%numchn) )
+  call foldcumrate(nex,earx,photarx,cumdc)
+  call foldcumrate(nex,earx,rephotarx,cumre)
+  call foldcumrate(nex,earx,imphotarx,cumim)
+
 ! Calculate reference band power (in units of *absolute rms^2*)
-  Pr = pow * getcountrate(Elo,Ehi,nex,earx,rephotarx)
+  Pr = pow * cumrate(Elo(1),Ehi(1),cumre)
 ! Calculate reference band Poisson noise (in *absolutem rms^2)
-  mur = getcountrate(Elo,Ehi,nex,earx,photarx)
+  mur = cumrate(Elo(1),Ehi(1),cumdc)
   Prnoise = 2.0 * ( br + mur )
   write(*,*)"br,mur=",br,mur
   write(*,*)"Pr (fractional rms)^2/Hz",Pr/mur**2
@@ -653,10 +847,10 @@ subroutine simrtdist(ear, ne, param, ifl, photar)
   do i = 1,ne
      E  = 0.5 * ( ear(i) + ear(i-1) )
      dE = ear(i) - ear(i-1)
-     mus = getcountrate(ear(i-1),ear(i),nex,earx,photarx)
+     mus = cumrate(ear(i-1),ear(i),cumdc)
      Psnoise = 2.0 * ( mus + bs(i) )
-     ReG = getcountrate(ear(i-1),ear(i),nex,earx,rephotarx)
-     ImG = getcountrate(ear(i-1),ear(i),nex,earx,imphotarx)
+     ReG = cumrate(ear(i-1),ear(i),cumre)
+     ImG = cumrate(ear(i-1),ear(i),cumim)
      G2  = pow**2 * ( ReG**2 + ImG**2 )
      ! Can finally calculate error     
      dlag(i) = 1.0 + Prnoise/Pr
@@ -675,14 +869,33 @@ subroutine simrtdist(ear, ne, param, ifl, photar)
   call ftfiou(unit,status)
   close(xunit)
   call ftfiou(xunit,status)
+
+! Batch mode: RELTRANS_NSIM more realisations of the same lags and errors,
+! realisation k drawn from its own stream so that it can be reproduced alone
+  if( nsimreal .gt. 0 )then
+     binfile = trim(root) // '.bin'
+     call ftgiou(unit,status)
+     open(unit,file=binfile,access='stream',form='unformatted',status='replace')
+     write(unit) ne, nsimreal
+     write(unit) ear, lag, dlag
+     do k = 1,nsimreal
+        call gaussstream(simseed,k,ne,lagsim)
+        lagsim = lag + lagsim * dlag
+        write(unit) lagsim
+     end do
+     close(unit)
+     call ftfiou(unit,status)
+  end if
  
   command = 'flx2xsp ' // trim(flxlagfile) // ' ' // trim(phalagfile)
   command = trim(command) // ' ' // trim(rsplagfile)
   write(*,*)"-----------------------------------------------"
   write(*,*)"Outputs: ",trim(lagfile),', ',trim(flxlagfile)
   write(*,*)"command: ",trim(command)
+  if( nsimreal .gt. 0 ) write(*,*)nsimreal," realisations in ",trim(binfile)
   write(*,*)"-----------------------------------------------"
  
+  deallocate( cumdc, cumre, cumim )
   return
 end subroutine simrtdist
 !-----------------------------------------------------------------------
@@ -694,7 +907,8 @@ subroutine simrelt(ear, ne, param, ifl, photar)
   implicit none
   integer :: ne, ifl, Cp, dset, i
   real    :: ear(0:ne), param(24), photar(ne), par(32)
-  real    :: gammac2, Texp, E, dE, getcountrate
+  real    :: gammac2, Texp, E, dE, cumrate
+  double precision, allocatable :: cumdc(:), cumre(:), cumim(:)
   real    :: rephotar(ne), imphotar(ne)
   real, parameter :: Emin = 1e-1, Emax = 300.0
   integer, parameter :: nex=2**12
@@ -703,7 +917,7 @@ subroutine simrelt(ear, ne, param, ifl, photar)
   real :: dlag(ne),G2,ReG,ImG,Psnoise,Prnoise,br,bs(ne)
   real :: flo,fhi,fc,lag(ne),gasdev,lagsim(ne)
   real, parameter :: pi = acos(-1.0)
-  integer idum, unit,xunit,status,j
+  integer idum, unit,xunit,status,j,mrsp
   real E1,E2,frac
 
   integer :: nlp !number of lampposts
@@ -755,61 +969,59 @@ subroutine simrelt(ear, ne, param, ifl, photar)
   fhi = param(16)
   fc  = 0.5 * ( fhi + flo )
   
-! Get `folded' lags
-  par(25) = 6.0   !ReIm
-  call genreltrans(Cp, dset, nlp, ear, ne, par, ifl, photar)
-  do i = 1,ne
-     lag(i) = photar(i) / ( ear(i) - ear(i-1) )
-  end do
-  
 ! Set internal energy grid
   do i = 0, nex
      earx(i) = Emin * (Emax/Emin)**(float(i)/float(nex))
   end do
-  
-! Calculate real and imaginary parts on the fine energy grid
-  par(25) = 1.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, rephotarx)
-  par(25) = 2.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, imphotarx)
-! Get DC component
-  par(23) = 0.0   !floHz
-  par(24) = 0.0   !fhiHz
-  par(25) = 1.0   !ReIm
-  call genreltrans(Cp, dset, nlp, earx, nex, par, ifl, photarx)
+
+! Get `folded' lags, plus the real and imaginary parts and the DC component on the fine energy grid
+  call simspectra(Cp, dset, nlp, ear, ne, par, ifl, photar, nex, earx, rephotarx, imphotarx, photarx)
+  do i = 1,ne
+     lag(i) = photar(i) / ( ear(i) - ear(i-1) )
+  end do
+
+! Simulations use the channels of RESP id 1
+  call loadresp(1)
+  mrsp = respslot(1)
 
 ! Read in background array
   if( needbkg )then
-     allocate(bkgcounts(1:numchn))
-     allocate(bkgrate(1:numchn))
+     allocate(bkgcounts(1:rsp(mrsp)%numchn))
+     allocate(bkgrate(1:rsp(mrsp)%numchn))
      call readinbkg
      needbkg = .false.
   end if
 
 ! Calculate background in reference band
   br = 0.0
-  do i = ilo,ihi
+  do i = Ilo(1),Ihi(1)
      br = br + bkgrate(i)
   end do
 
 ! Calculate background in subject
   do j = 1,ne
      bs(j) = 0.0
-     do i = 1,numchn
-        if( ECHN(i) .gt. ear(j-1) .and. ECHN(i-1) .le. ear(j) )then
-           E1 = max( ear(j-1) , ECHN(i-1) )
-           E2 = min( ear(j)   , ECHN(i)   )
-           frac = ( E2-E1 ) / ( ECHN(i)-ECHN(i-1) )
+     do i = 1,rsp(mrsp)%numchn
+        if( rsp(mrsp)%ECHN(i) .gt. ear(j-1) .and. rsp(mrsp)%ECHN(i-1) .le. ear(j) )then
+           E1 = max( ear(j-1) , rsp(mrsp)%ECHN(i-1) )
+           E2 = min( ear(j)   , rsp(mrsp)%ECHN(i)   )
+           frac = ( E2-E1 ) / ( rsp(mrsp)%ECHN(i)-rsp(mrsp)%ECHN(i-1) )
            bs(j) = bs(j) + frac * bkgrate(i)
         end if
      end do
      E = 0.5 * ( ear(j) + ear(j-1) )
   end do
   
+! Fold each spectrum once: the count rate in any energy range is then a difference of running sums
+  allocate( cumdc(0:rsp(mrsp)%numchn), cumre(0:rsp(mrsp)%numchn), cumim(0:rsp(mrsp)%numchn) )
+  call foldcumrate(nex,earx,photarx,cumdc)
+  call foldcumrate(nex,earx,rephotarx,cumre)
+  call foldcumrate(nex,earx,imphotarx,cumim)
+
 ! Calculate reference band power (in units of *absolute rms^2*)
-  Pr = pow * getcountrate(Elo,Ehi,nex,earx,rephotarx)
+  Pr = pow * cumrate(Elo(1),Ehi(1),cumre)
 ! Calculate reference band Poisson noise (in *absolutem rms^2)
-  mur = getcountrate(Elo,Ehi,nex,earx,photarx)
+  mur = cumrate(Elo(1),Ehi(1),cumdc)
   Prnoise = 2.0 * ( br + mur )
   write(*,*)"br,mur=",br,mur
   write(*,*)"Pr (fractional rms)^2/Hz",Pr/mur**2
@@ -836,10 +1048,10 @@ subroutine simrelt(ear, ne, param, ifl, photar)
   do i = 1,ne
      E  = 0.5 * ( ear(i) + ear(i-1) )
      dE = ear(i) - ear(i-1)
-     mus = getcountrate(ear(i-1),ear(i),nex,earx,photarx)
+     mus = cumrate(ear(i-1),ear(i),cumdc)
      Psnoise = 2.0 * ( mus + bs(i) )
-     ReG = getcountrate(ear(i-1),ear(i),nex,earx,rephotarx)
-     ImG = getcountrate(ear(i-1),ear(i),nex,earx,imphotarx)
+     ReG = cumrate(ear(i-1),ear(i),cumre)
+     ImG = cumrate(ear(i-1),ear(i),cumim)
      G2  = pow**2 * ( ReG**2 + ImG**2 )
      ! Write(*,*) 'mus, Psnoise, ReG, ImG, G2' 
      ! Write(10,*) mus, Pr, Psnoise, ReG, ImG, G2, Texp, (fhi-flo) 
@@ -872,6 +1084,7 @@ subroutine simrelt(ear, ne, param, ifl, photar)
   write(*,*)"command: ",trim(command)
   write(*,*)"-----------------------------------------------"
  
+  deallocate( cumdc, cumre, cumim )
   return
 end subroutine simrelt
 !-----------------------------------------------------------------------